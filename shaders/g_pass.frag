@@ -11,10 +11,9 @@ layout (location = 2) in vec3 inTangent;
 layout (location = 3) in vec2 texCoord;
 
 layout (set = 0, binding = 2) uniform sampler2D albedo;
-layout (set = 0, binding = 3) uniform sampler2D specular;
-layout (set = 0, binding = 4) uniform sampler2D normals;
-layout (set = 0, binding = 5) uniform sampler2D metal;
-layout (set = 0, binding = 6) uniform sampler2D ao;
+layout (set = 0, binding = 3) uniform sampler2D normals;
+// R = ambient occlusion, G = roughness, B = metallic
+layout (set = 0, binding = 4) uniform sampler2D orm;
 
 void main()
 {
@@ -23,10 +22,13 @@ void main()
 	vec3 biTangent = normalize(cross(Norm, Tangent));
 	Tangent = normalize(cross(biTangent, Norm));
 	mat3 TBN = (mat3(Tangent, biTangent, Norm));
-	vec3 norm = texture(normals, texCoord).xyz;
+	// Normal maps are BC5, so only xy is stored
+	vec2 norm_xy = texture(normals, texCoord).xy * 2.0f - 1.0f;
+	vec3 norm = vec3(norm_xy, sqrt(max(1.0f - dot(norm_xy, norm_xy), 0.0f)));
 	norm = normalize(TBN * norm);
+	vec3 occlusion_rough_metal = texture(orm, texCoord).rgb;
 	outFragPos = vec4(inPos, 1.0);
-	outFragNorm = vec4(norm, texture(metal, texCoord).r);
-	outFragAlbedoSpecular = vec4(texture(albedo, texCoord).xyz, texture(specular, texCoord).r);
-	outFragAmbientOcclusion = vec4(vec3(texture(ao, texCoord).r), 1.0f);
+	outFragNorm = vec4(norm, occlusion_rough_metal.b);
+	outFragAlbedoSpecular = vec4(texture(albedo, texCoord).xyz, occlusion_rough_metal.g);
+	outFragAmbientOcclusion = vec4(vec3(occlusion_rough_metal.r), 1.0f);
 }
@@ -11,9 +11,14 @@
 #include "glm/gtx/transform.hpp"
 #include "../pipeline_builder.h"
 #include "../asset_system.h"
+#include "../profiler.h"
 
 void AOEngine::init()
 {
+	// Written out as startup_profile.* by cleanup
+	profiler::start();
+	ProfileScope profile("init", "AOEngine::init");
+
 	init_sdl("AO Rendering");
 	init_vulkan("AO Rendering", true);
 	init_swapchain();
@@ -24,15 +29,16 @@ void AOEngine::init()
 	init_framebuffers();
 	_material_system.init("../assets/ao/material_system", this, {_depth_pass, _ao_pass, _blur_pass, _draw_pass});
 	
-	_mat_ids[0] = _material_system.get_material_id("draw_depth");
-	_mat_ids[1] = _material_system.get_material_id("ao");
-	_mat_ids[2] = _material_system.get_material_id("blur");
-	_mat_ids[3] = _material_system.get_material_id("draw_screen");
+	_mat_ids[0] = _material_system.get_material_id("draw_depth"_id);
+	_mat_ids[1] = _material_system.get_material_id("ao"_id);
+	_mat_ids[2] = _material_system.get_material_id("blur"_id);
+	_mat_ids[3] = _material_system.get_material_id("draw_screen"_id);
 
-	_empire_mesh_id = _asset_system.get_mesh_id("empire");
+	// The descriptor sets are written once, so everything has to be loaded first
+	_asset_system.wait_all(this);
+	_empire_mesh = _asset_system.get_mesh_id("empire"_id);
 
 	init_descriptors();
-	init_scene();
 	write_descriptors();
 	init_imgui(_draw_pass);
 
@@ -102,23 +108,11 @@ void AOEngine::draw()
 	ao_data.proj = projection;
 	ao_data.radBiasContrastAspect.w = (float) _window_extent.width / _window_extent.height;
 
-	// Write data to uniform buffers
-	void *data;
-	vmaMapMemory(_allocator, _uniform_buffers[frame_index]._allocation, &data);
-	memcpy(data, &cam_data, sizeof(CameraData));
-	vmaUnmapMemory(_allocator, _uniform_buffers[frame_index]._allocation);
-
-	vmaMapMemory(_allocator, _storage_buffers[frame_index]._allocation, &data);
-	memcpy(data, &obj_data, sizeof(ObjectData));
-	vmaUnmapMemory(_allocator, _storage_buffers[frame_index]._allocation);
-
-	vmaMapMemory(_allocator, _ao_uniform_buffers[frame_index]._allocation, &data);
-	memcpy(data, &ao_data, sizeof(AOData));
-	vmaUnmapMemory(_allocator, _ao_uniform_buffers[frame_index]._allocation);
-
-	vmaMapMemory(_allocator, _draw_mode_uniform_buffers[frame_index]._allocation, &data);
-	memcpy(data, &_draw_mode, sizeof(int));
-	vmaUnmapMemory(_allocator, _draw_mode_uniform_buffers[frame_index]._allocation);
+	// Push this frame's data
+	push_frame_data(_cam_slot, &cam_data, sizeof(CameraData));
+	push_frame_data(_obj_slot, &obj_data, sizeof(ObjectData));
+	push_frame_data(_ao_slot, &ao_data, sizeof(AOData));
+	push_frame_data(_draw_mode_slot, &_draw_mode, sizeof(int));
 
 	VkClearValue clear_value;
 	clear_value.color = {{0.0f, 0.0f, 0.0f, 1.0f}};
@@ -175,13 +169,11 @@ void AOEngine::draw()
 		auto draw = material.draws[i];
 		if (draw->render_pass_id == 0)
 		{
-			auto mesh = _asset_system.get_mesh(_empire_mesh_id);
+			auto &mesh = _asset_system.get_mesh(_empire_mesh);
 			vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, draw->pipeline);
-			vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, draw->layout, 0, 1, &_descriptor_sets[0][i][frame_index], 0, nullptr);
-			VkDeviceSize offset = 0;
-			vkCmdBindVertexBuffers(cmd, 0, 1, &(mesh._vertex_buffer._buffer), &offset);
-			vkCmdBindIndexBuffer(cmd, (mesh._index_buffer._buffer), 0, VK_INDEX_TYPE_UINT32);
-			vkCmdDrawIndexed(cmd, mesh._indices.size(), 1, 0, 0, 0);
+			bind_descriptor_set(cmd, draw->layout, _descriptor_sets[0][i][frame_index], _dynamic_slots[0][i]);
+			bind_mesh_buffers(cmd, mesh._index_type);
+			vkCmdDrawIndexed(cmd, mesh._index_count, 1, mesh._first_index, mesh._vertex_offset, 0);
 		}
 	}
 	vkCmdEndRenderPass(cmd);
@@ -201,7 +193,7 @@ void AOEngine::draw()
 		if (draw->render_pass_id == 1)
 		{
 			vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, draw->pipeline);
-			vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, draw->layout, 0, 1, &_descriptor_sets[1][i][frame_index], 0, nullptr);
+			bind_descriptor_set(cmd, draw->layout, _descriptor_sets[1][i][frame_index], _dynamic_slots[1][i]);
 			vkCmdDraw(cmd, 6, 1, 0, 0);
 		}
 	}
@@ -221,7 +213,7 @@ void AOEngine::draw()
 		if (draw->render_pass_id == 2)
 		{
 			vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, draw->pipeline);
-			vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, draw->layout, 0, 1, &_descriptor_sets[2][i][frame_index], 0, nullptr);
+			bind_descriptor_set(cmd, draw->layout, _descriptor_sets[2][i][frame_index], _dynamic_slots[2][i]);
 			vkCmdDraw(cmd, 6, 1, 0, 0);
 		}
 	}
@@ -244,7 +236,7 @@ void AOEngine::draw()
 		if (draw->render_pass_id == 3)
 		{
 			vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, draw->pipeline);
-			vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, draw->layout, 0, 1, &_descriptor_sets[3][i][frame_index], 0, nullptr);
+			bind_descriptor_set(cmd, draw->layout, _descriptor_sets[3][i][frame_index], _dynamic_slots[3][i]);
 			vkCmdDraw(cmd, 6, 1, 0, 0);
 		}
 	}
@@ -308,6 +300,11 @@ void AOEngine::init_framebuffers()
 
 void AOEngine::init_descriptors()
 {
+	_cam_slot = frame_slot("cam_data"_id);
+	_obj_slot = frame_slot("obj_data"_id);
+	_ao_slot = frame_slot("ao_data"_id);
+	_draw_mode_slot = frame_slot("draw_mode"_id);
+
 	for (int i = 0; i < NUM_MATS; i++)
 	{
 		auto mat = _material_system.get_material(_mat_ids[i]);
@@ -315,108 +312,89 @@ void AOEngine::init_descriptors()
 		for (size_t j = 0; j < mat.descriptors.size(); j++)
 		{
 			_descriptor_sets[i].push_back(allocate_descriptor_sets(mat.descriptors[j].layout, FRAME_OVERLAP));
-		}
-	}
-}
-
-void AOEngine::init_scene()
-{
-	// Create uniform/storage buffers
-	for (int i = 0; i < FRAME_OVERLAP; i++)
-	{
-		_uniform_buffers[i] = create_buffer(sizeof(CameraData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-		_storage_buffers[i] = create_buffer(sizeof(ObjectData), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-		_ao_uniform_buffers[i] = create_buffer(sizeof(AOData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-		_draw_mode_uniform_buffers[i] = create_buffer(sizeof(int), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-
-	}
 
-	_main_deletion_queue.push_function([=]() {
-		for (int i = 0; i < FRAME_OVERLAP; i++)
-		{
-			vmaDestroyBuffer(_allocator, _uniform_buffers[i]._buffer, _uniform_buffers[i]._allocation);
-			vmaDestroyBuffer(_allocator, _storage_buffers[i]._buffer, _storage_buffers[i]._allocation);
-			vmaDestroyBuffer(_allocator, _ao_uniform_buffers[i]._buffer, _ao_uniform_buffers[i]._allocation);
-			vmaDestroyBuffer(_allocator, _draw_mode_uniform_buffers[i]._buffer, _draw_mode_uniform_buffers[i]._allocation);
+			std::vector<uint32_t> slots;
+			for (NameId label : mat.descriptors[j].dynamic_ids)
+			{
+				slots.push_back(frame_slot(label));
+			}
+			_dynamic_slots[i].push_back(slots);
 		}
-	});
+	}
 }
 
 void AOEngine::write_descriptors()
 {
-	std::vector<std::vector<DescriptorInfo>> infos = {};
-
-	for (int n = 0; n < NUM_MATS; n++)
-	{
-		infos.push_back(_material_system.get_descriptor_infos(_mat_ids[n]));
-	}
-
 	int info_count = 0;
 
+	// Buffers are the frame data, at the offsets it was pushed at
+	VkDescriptorBufferInfo cam_info = frame_buffer_info(sizeof(CameraData));
+	VkDescriptorBufferInfo ao_info = frame_buffer_info(sizeof(AOData));
+	VkDescriptorBufferInfo draw_mode_info = frame_buffer_info(sizeof(int));
+	VkDescriptorBufferInfo obj_info = frame_buffer_info(sizeof(ObjectData));
+
 	for (int n = 0; n < NUM_MATS; n++)
 	{
-		for (int in = 0; in < infos[n].size(); in++)
+		const std::vector<DescriptorInfo> &infos = _material_system.get_descriptor_infos(_mat_ids[n]);
+		for (int in = 0; in < infos.size(); in++)
 		{
 			std::vector<VkWriteDescriptorSet> writes = {};
-			auto info = infos[n][in];
+			const DescriptorInfo &info = infos[in];
 			for (int i = 0; i < FRAME_OVERLAP; i++)
 			{
 				for (size_t j = 0; j < info.descriptor_names.size(); j++)
 				{
-					auto name = info.descriptor_names[j];
-					if (name.size() > 3 && name.substr(0, 3) == "UB:")
+					const std::string &name = info.descriptor_names[j];
+					NameId label = info.descriptor_ids[j];
+					if (name.size() > 3 && name.compare(0, 3, "UB:") == 0)
 					{
 						VkDescriptorBufferInfo *buffer_info;
-						auto label = name.substr(3, name.size()-3);
-						if (label == "cam_data")
+						if (label == "cam_data"_id)
 						{
-							buffer_info = &_uniform_buffers[i]._buffer_info;
+							buffer_info = &cam_info;
 						}
-						else if (label == "ao_data")
+						else if (label == "ao_data"_id)
 						{
-							buffer_info = &_ao_uniform_buffers[i]._buffer_info;
+							buffer_info = &ao_info;
 						}
-						else if (label == "draw_mode")
+						else if (label == "draw_mode"_id)
 						{
-							buffer_info = &_draw_mode_uniform_buffers[i]._buffer_info;
+							buffer_info = &draw_mode_info;
 						}
-						writes.push_back(infos::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, _descriptor_sets[n][in][i], buffer_info, j));
+						writes.push_back(infos::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, _descriptor_sets[n][in][i], buffer_info, j));
 					}
-					else if (name.size() > 3 && name.substr(0, 3) == "SB:")
+					else if (name.size() > 3 && name.compare(0, 3, "SB:") == 0)
 					{
 						VkDescriptorBufferInfo *buffer_info;
-						auto label = name.substr(3, name.size()-3);
-						if (label == "obj_data")
+						if (label == "obj_data"_id)
 						{
-							buffer_info = &_storage_buffers[i]._buffer_info;
+							buffer_info = &obj_info;
 						}
-						writes.push_back(infos::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, _descriptor_sets[n][in][i], buffer_info, j));
+						writes.push_back(infos::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, _descriptor_sets[n][in][i], buffer_info, j));
 					}
-					else if (name.size() > 4 && name.substr(0, 4) == "TEX:")
+					else if (name.size() > 4 && name.compare(0, 4, "TEX:") == 0)
 					{
 						VkDescriptorImageInfo *tex_info;
-						auto label = name.substr(4, name.size()-4);
 						tex_info = &_asset_system.get_texture(_asset_system.get_texture_id(label))._image_info;
 						writes.push_back(infos::write_descriptor_image(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, _descriptor_sets[n][in][i], tex_info, j));
 					}
-					else if (name.size() > 4 && name.substr(0, 4) == "ATT:")
+					else if (name.size() > 4 && name.compare(0, 4, "ATT:") == 0)
 					{
 						VkDescriptorImageInfo *tex_info;
-						auto label = name.substr(4, name.size()-4);
 
-						if (label == "depth")
+						if (label == "depth"_id)
 						{
 							tex_info = &_ao_depth_image._image_info;
 						}
-						else if (label == "ao")
+						else if (label == "ao"_id)
 						{
 							tex_info = &_ao_image._image_info;
 						}
-						else if (label == "blur")
+						else if (label == "blur"_id)
 						{
 							tex_info = &_blur_image._image_info;
 						}
-						else if (label == "color")
+						else if (label == "color"_id)
 						{
 							tex_info = &_color_image._image_info;
 						}
@@ -38,7 +38,6 @@ public:
 	void init_render_passes();
 	void init_framebuffers();
 	void init_descriptors();
-	void init_scene();
 	void write_descriptors();
 
 	virtual void resize_window(uint32_t w, uint32_t h);
@@ -49,7 +48,7 @@ public:
 	VkRenderPass _draw_pass;
 
 	size_t _mat_ids[NUM_MATS];
-	size_t _empire_mesh_id;
+	AssetHandle _empire_mesh;
 
 	VkFramebuffer _depth_framebuffer;
 	VkFramebuffer _ao_framebuffer;
@@ -59,12 +58,10 @@ public:
 	Texture _ao_depth_image, _ao_image, _blur_image, _color_image;
 
 	std::vector<std::vector<VkDescriptorSet>> _descriptor_sets[NUM_MATS];
-
-	Buffer _uniform_buffers[FRAME_OVERLAP];
-	Buffer _storage_buffers[FRAME_OVERLAP];
-
-	Buffer _ao_uniform_buffers[FRAME_OVERLAP];
-	Buffer _draw_mode_uniform_buffers[FRAME_OVERLAP];
+	// Slots of the frame data each set's dynamic descriptors read
+	std::vector<std::vector<uint32_t>> _dynamic_slots[NUM_MATS];
+	// Slots draw pushes frame data to
+	uint32_t _cam_slot, _obj_slot, _ao_slot, _draw_mode_slot;
 
 	AOData ao_data;
 	int _draw_mode;
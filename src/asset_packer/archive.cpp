@@ -0,0 +1,287 @@
+#include "archive.h"
+
+#include "asset_packer.h"
+
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static uint64_t align_up(uint64_t value, uint64_t alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+// Orders entries by name, then type
+static int compare_entry(const std::string &name_a, char type_a, const char *name_b, size_t length_b, char type_b)
+{
+	int result = name_a.compare(0, std::string::npos, name_b, length_b);
+
+	if (result != 0)
+	{
+		return result;
+	}
+
+	return (int)type_a - (int)type_b;
+}
+
+bool AssetPacker::read_asset_list(std::string filename, std::vector<AssetPacker::AssetListEntry> &entries)
+{
+	std::ifstream file;
+	file.open(filename);
+
+	if (!file.is_open())
+	{
+		return false;
+	}
+
+	std::string line;
+	while (std::getline(file, line))
+	{
+		size_t first = line.find(':');
+		size_t second = line.find(':', first + 1);
+
+		if (first != 1 || second == std::string::npos || second == first + 1 || second + 1 >= line.size())
+		{
+			continue;
+		}
+
+		AssetListEntry entry;
+		entry.type = line[0];
+		entry.file = line.substr(first + 1, second - first - 1);
+		entry.name = line.substr(second + 1);
+		entries.push_back(entry);
+	}
+
+	file.close();
+	return true;
+}
+
+bool AssetPacker::save_archive(std::string filename, std::string asset_list_name)
+{
+	std::vector<AssetListEntry> list;
+	if (!read_asset_list(asset_list_name, list))
+	{
+		std::cout << "Failed to open asset list: " << asset_list_name << "\n";
+		return false;
+	}
+
+	std::sort(list.begin(), list.end(), [](const AssetListEntry &a, const AssetListEntry &b) {
+		return compare_entry(a.name, a.type, b.name.data(), b.name.size(), b.type) < 0;
+	});
+
+	// Validate every asset before it goes into the archive
+	std::vector<AssetFile> files(list.size());
+	for (size_t i = 0; i < list.size(); i++)
+	{
+		if (i > 0 && list[i].name == list[i - 1].name && list[i].type == list[i - 1].type)
+		{
+			std::cout << "Duplicate asset " << list[i].name << " in " << asset_list_name << "\n";
+			return false;
+		}
+
+		if (!load_file(list[i].file, files[i]))
+		{
+			std::cout << "Failed to add " << list[i].file << " to archive\n";
+			return false;
+		}
+	}
+
+	ArchiveHeader header;
+	memcpy(header.magic, ARCHIVE_MAGIC, 4);
+	header.version = ARCHIVE_VERSION;
+	header.entry_count = (uint32_t)list.size();
+
+	std::vector<ArchiveEntry> entries(list.size());
+	std::string names;
+	for (size_t i = 0; i < list.size(); i++)
+	{
+		memset(&entries[i], 0, sizeof(ArchiveEntry));
+		entries[i].name_offset = (uint32_t)names.size();
+		entries[i].name_length = (uint32_t)list[i].name.size();
+		entries[i].type = list[i].type;
+		names += list[i].name;
+	}
+	header.names_size = (uint32_t)names.size();
+
+	uint64_t offset = align_up(sizeof(ArchiveHeader) + sizeof(ArchiveEntry) * entries.size() + names.size(), CHUNK_ALIGNMENT);
+	for (size_t i = 0; i < entries.size(); i++)
+	{
+		entries[i].offset = offset;
+		entries[i].size = files[i].size;
+		offset = align_up(offset + entries[i].size, CHUNK_ALIGNMENT);
+	}
+
+	header.file_size = offset;
+	header.toc_checksum = hash_data(entries.data(), sizeof(ArchiveEntry) * entries.size());
+	header.toc_checksum = hash_data(names.data(), names.size(), header.toc_checksum);
+
+	// Written next to the target and renamed over it, so readers never see
+	// a partial file and mappings of the old one stay valid
+	std::string temp_filename = filename + ".tmp";
+
+	std::ofstream s;
+	s.open(temp_filename, std::ios::binary | std::ios::out);
+
+	if (!s.is_open())
+	{
+		return false;
+	}
+
+	const char padding[CHUNK_ALIGNMENT] = {};
+
+	s.write((const char*)&header, sizeof(ArchiveHeader));
+	s.write((const char*)entries.data(), sizeof(ArchiveEntry) * entries.size());
+	s.write(names.data(), names.size());
+
+	uint64_t position = sizeof(ArchiveHeader) + sizeof(ArchiveEntry) * entries.size() + names.size();
+	for (size_t i = 0; i < entries.size(); i++)
+	{
+		s.write(padding, entries[i].offset - position);
+		s.write(files[i].data, files[i].size);
+		position = entries[i].offset + entries[i].size;
+	}
+	s.write(padding, header.file_size - position);
+
+	s.close();
+
+	return !s.fail() && std::rename(temp_filename.c_str(), filename.c_str()) == 0;
+}
+
+bool AssetPacker::open_archive(std::string filename, AssetPacker::Archive &archive)
+{
+	int fd = open(filename.c_str(), O_RDONLY);
+
+	if (fd < 0)
+	{
+		return false;
+	}
+
+	struct stat file_stat;
+	if (fstat(fd, &file_stat) != 0 || (size_t)file_stat.st_size < sizeof(ArchiveHeader))
+	{
+		std::cout << filename << " is too small to be an archive\n";
+		close(fd);
+		return false;
+	}
+
+	size_t size = file_stat.st_size;
+	void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (mapping == MAP_FAILED)
+	{
+		std::cout << "Failed to map " << filename << "\n";
+		return false;
+	}
+
+	archive.data = (const char*)mapping;
+	archive.size = size;
+	archive.header = (const ArchiveHeader*)archive.data;
+
+	const ArchiveHeader &header = *archive.header;
+	size_t toc_size = sizeof(ArchiveEntry) * (size_t)header.entry_count;
+
+	bool valid = memcmp(header.magic, ARCHIVE_MAGIC, 4) == 0 && header.version == ARCHIVE_VERSION;
+	if (!valid)
+	{
+		std::cout << filename << " is not a version " << ARCHIVE_VERSION << " archive, repack it\n";
+	}
+	else if (header.file_size != size)
+	{
+		std::cout << filename << " is truncated (" << size << " of " << header.file_size << " bytes)\n";
+		valid = false;
+	}
+	else if (toc_size + header.names_size > size - sizeof(ArchiveHeader))
+	{
+		std::cout << filename << " has a corrupt table of contents\n";
+		valid = false;
+	}
+
+	if (valid)
+	{
+		archive.entries = (const ArchiveEntry*)(archive.data + sizeof(ArchiveHeader));
+		archive.names = archive.data + sizeof(ArchiveHeader) + toc_size;
+
+		uint64_t checksum = hash_data(archive.entries, toc_size);
+		checksum = hash_data(archive.names, header.names_size, checksum);
+
+		if (checksum != header.toc_checksum)
+		{
+			std::cout << filename << " has a corrupt table of contents\n";
+			valid = false;
+		}
+	}
+
+	for (uint32_t i = 0; valid && i < header.entry_count; i++)
+	{
+		const ArchiveEntry &entry = archive.entries[i];
+		if ((uint64_t)entry.name_offset + entry.name_length > header.names_size || entry.offset > size || entry.size > size - entry.offset)
+		{
+			std::cout << filename << " has an entry outside the archive\n";
+			valid = false;
+		}
+	}
+
+	if (!valid)
+	{
+		close_archive(archive);
+		return false;
+	}
+
+	return true;
+}
+
+void AssetPacker::close_archive(AssetPacker::Archive &archive)
+{
+	if (archive.data != nullptr)
+	{
+		munmap((void*)archive.data, archive.size);
+	}
+
+	archive = Archive();
+}
+
+std::string AssetPacker::entry_name(const AssetPacker::Archive &archive, const AssetPacker::ArchiveEntry &entry)
+{
+	return std::string(archive.names + entry.name_offset, entry.name_length);
+}
+
+const AssetPacker::ArchiveEntry *AssetPacker::find_entry(const AssetPacker::Archive &archive, char type, const std::string &name)
+{
+	uint32_t low = 0;
+	uint32_t high = archive.header->entry_count;
+
+	while (low < high)
+	{
+		uint32_t middle = low + (high - low) / 2;
+		const ArchiveEntry &entry = archive.entries[middle];
+		int result = compare_entry(name, type, archive.names + entry.name_offset, entry.name_length, entry.type);
+
+		if (result == 0)
+		{
+			return &entry;
+		}
+		else if (result < 0)
+		{
+			high = middle;
+		}
+		else
+		{
+			low = middle + 1;
+		}
+	}
+
+	return nullptr;
+}
+
+bool AssetPacker::open_entry(const AssetPacker::Archive &archive, const AssetPacker::ArchiveEntry &entry, AssetPacker::AssetFile &file)
+{
+	return open_file_view(archive.data + entry.offset, entry.size, entry_name(archive, entry), file);
+}
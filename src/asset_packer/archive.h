@@ -0,0 +1,74 @@
+#pragma once
+
+#include "asset_file.h"
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+namespace AssetPacker
+{
+	// Archive layout:
+	//   ArchiveHeader
+	//   ArchiveEntry[entry_count], sorted by name then type
+	//   entry names, not null terminated
+	//   packed assets, each starting on a CHUNK_ALIGNMENT boundary
+	// Every asset is a complete packed file, so chunk data stays aligned
+	// inside the archive as well.
+	const char ARCHIVE_MAGIC[4] = {'V', 'K', 'A', 'R'};
+	const uint32_t ARCHIVE_VERSION = 1;
+
+	struct ArchiveHeader
+	{
+		char magic[4];
+		uint32_t version;
+		uint32_t entry_count;
+		uint32_t names_size;
+		uint64_t file_size;
+		uint64_t toc_checksum;
+	};
+
+	struct ArchiveEntry
+	{
+		uint32_t name_offset;
+		uint32_t name_length;
+		char type;
+		char padding[7];
+		uint64_t offset;
+		uint64_t size;
+	};
+
+	// One line of an asset list, formatted as type:file:name
+	struct AssetListEntry
+	{
+		char type;
+		std::string file;
+		std::string name;
+	};
+
+	bool read_asset_list(std::string filename, std::vector<AssetListEntry> &entries);
+
+	// Packs every file of an asset list into one archive
+	bool save_archive(std::string filename, std::string asset_list_name);
+
+	// A read-only memory mapping of an archive
+	struct Archive
+	{
+		const char *data = nullptr;
+		size_t size = 0;
+		const ArchiveHeader *header = nullptr;
+		const ArchiveEntry *entries = nullptr;
+		const char *names = nullptr;
+	};
+
+	bool open_archive(std::string filename, Archive &archive);
+	void close_archive(Archive &archive);
+
+	std::string entry_name(const Archive &archive, const ArchiveEntry &entry);
+
+	// Binary search of the table of contents, returns nullptr if missing
+	const ArchiveEntry *find_entry(const Archive &archive, char type, const std::string &name);
+
+	// Views an entry in place, without copying it out of the mapping
+	bool open_entry(const Archive &archive, const ArchiveEntry &entry, AssetFile &file);
+};
@@ -0,0 +1,428 @@
+#include "asset_file.h"
+
+#include "asset_packer.h"
+#include "../thread_pool.h"
+
+#include <fstream>
+#include <iostream>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+#include <lz4.h>
+#include <lz4hc.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static uint64_t align_up(uint64_t value, uint64_t alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+// Compresses size bytes with fast LZ4 at level 0, LZ4HC otherwise. Returns
+// the compressed size, 0 on failure, and leaves dst sized to the bound.
+static size_t compress(const char *src, size_t size, uint32_t level, std::vector<char> &dst)
+{
+	if (size == 0)
+	{
+		return 0;
+	}
+
+	int bound = LZ4_compressBound((int)size);
+	dst.resize(bound);
+
+	int compressed_size = 0;
+	if (level == 0)
+	{
+		compressed_size = LZ4_compress_default(src, dst.data(), (int)size, bound);
+	}
+	else
+	{
+		compressed_size = LZ4_compress_HC(src, dst.data(), (int)size, bound, (int)level);
+	}
+
+	return compressed_size > 0 ? (size_t)compressed_size : 0;
+}
+
+// Writes the block table and blocks of a CODEC_LZ4_BLOCKS chunk into stored
+// and returns the checksum of the table
+static uint64_t compress_blocks(const std::vector<char> &raw, uint32_t level, std::vector<char> &stored)
+{
+	size_t block_count = (raw.size() + AssetPacker::BLOCK_SIZE - 1) / AssetPacker::BLOCK_SIZE;
+	std::vector<AssetPacker::BlockHeader> blocks(block_count);
+
+	stored.assign(sizeof(AssetPacker::BlockHeader) * block_count, 0);
+	std::vector<char> compressed;
+
+	for (size_t b = 0; b < block_count; b++)
+	{
+		const char *src = raw.data() + b * AssetPacker::BLOCK_SIZE;
+		size_t size = std::min(AssetPacker::BLOCK_SIZE, raw.size() - b * AssetPacker::BLOCK_SIZE);
+		size_t compressed_size = compress(src, size, level, compressed);
+
+		// Blocks that do not shrink are stored as they are
+		if (compressed_size > 0 && compressed_size < size)
+		{
+			src = compressed.data();
+			size = compressed_size;
+			blocks[b].codec = AssetPacker::CODEC_LZ4;
+		}
+		else
+		{
+			blocks[b].codec = AssetPacker::CODEC_NONE;
+		}
+
+		blocks[b].size = (uint32_t)size;
+		blocks[b].checksum = AssetPacker::hash_data(src, size);
+		stored.insert(stored.end(), src, src + size);
+	}
+
+	memcpy(stored.data(), blocks.data(), sizeof(AssetPacker::BlockHeader) * block_count);
+	return AssetPacker::hash_data(blocks.data(), sizeof(AssetPacker::BlockHeader) * block_count);
+}
+
+void AssetPacker::add_chunk(AssetPacker::PackedFile &file, const char *tag, const void *data, size_t size)
+{
+	PackedChunk chunk;
+	memcpy(chunk.tag, tag, 4);
+	chunk.data.assign((const char*)data, (const char*)data + size);
+	file.chunks.push_back(std::move(chunk));
+}
+
+bool AssetPacker::save_file(std::string filename, const AssetPacker::PackedFile &file, const AssetPacker::Compression &compression)
+{
+	FileHeader header;
+	memcpy(header.magic, FILE_MAGIC, 4);
+	header.version = FILE_VERSION;
+	memcpy(header.type, file.type, 4);
+	header.chunk_count = (uint32_t)file.chunks.size();
+	header.codec = compression.codec;
+	header.level = compression.codec == CODEC_LZ4 ? std::min(std::max(compression.level, 0), MAX_LZ4HC_LEVEL) : 0;
+
+	std::vector<ChunkHeader> table(file.chunks.size());
+	std::vector<std::vector<char>> stored(file.chunks.size());
+	uint64_t offset = align_up(sizeof(FileHeader) + sizeof(ChunkHeader) * table.size(), CHUNK_ALIGNMENT);
+
+	for (size_t i = 0; i < file.chunks.size(); i++)
+	{
+		const std::vector<char> &raw = file.chunks[i].data;
+
+		if (compression.codec == CODEC_LZ4 && raw.size() > BLOCK_SIZE)
+		{
+			table[i].codec = CODEC_LZ4_BLOCKS;
+			table[i].checksum = compress_blocks(raw, header.level, stored[i]);
+		}
+		else
+		{
+			// Keep the chunk uncompressed if LZ4 does not make it smaller
+			size_t compressed_size = 0;
+			if (compression.codec == CODEC_LZ4)
+			{
+				compressed_size = compress(raw.data(), raw.size(), header.level, stored[i]);
+			}
+
+			if (compressed_size > 0 && compressed_size < raw.size())
+			{
+				stored[i].resize(compressed_size);
+				table[i].codec = CODEC_LZ4;
+			}
+			else
+			{
+				stored[i] = raw;
+				table[i].codec = CODEC_NONE;
+			}
+
+			table[i].checksum = hash_data(stored[i].data(), stored[i].size());
+		}
+
+		memcpy(table[i].tag, file.chunks[i].tag, 4);
+		table[i].offset = offset;
+		table[i].size = stored[i].size();
+		table[i].raw_size = raw.size();
+
+		offset = align_up(offset + table[i].size, CHUNK_ALIGNMENT);
+	}
+
+	header.file_size = offset;
+	header.table_checksum = hash_data(table.data(), sizeof(ChunkHeader) * table.size());
+
+	// Written next to the target and renamed over it, so a running engine
+	// watching the file never reads it half written
+	std::string temp_filename = filename + ".tmp";
+
+	std::ofstream s;
+	s.open(temp_filename, std::ios::binary | std::ios::out);
+
+	if (!s.is_open())
+	{
+		return false;
+	}
+
+	const char padding[CHUNK_ALIGNMENT] = {};
+
+	s.write((const char*)&header, sizeof(FileHeader));
+	s.write((const char*)table.data(), sizeof(ChunkHeader) * table.size());
+
+	uint64_t position = sizeof(FileHeader) + sizeof(ChunkHeader) * table.size();
+	for (size_t i = 0; i < table.size(); i++)
+	{
+		s.write(padding, table[i].offset - position);
+		s.write(stored[i].data(), stored[i].size());
+		position = table[i].offset + table[i].size;
+	}
+	s.write(padding, header.file_size - position);
+
+	s.close();
+
+	return !s.fail() && std::rename(temp_filename.c_str(), filename.c_str()) == 0;
+}
+
+bool AssetPacker::load_file(std::string filename, AssetPacker::AssetFile &file)
+{
+	int fd = open(filename.c_str(), O_RDONLY);
+
+	if (fd < 0)
+	{
+		return false;
+	}
+
+	struct stat file_stat;
+	if (fstat(fd, &file_stat) != 0 || (size_t)file_stat.st_size < sizeof(FileHeader))
+	{
+		std::cout << filename << " is too small to be a packed asset\n";
+		close(fd);
+		return false;
+	}
+
+	size_t size = file_stat.st_size;
+	void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (mapping == MAP_FAILED)
+	{
+		std::cout << "Failed to map " << filename << "\n";
+		return false;
+	}
+
+	// Chunks are read front to back
+	madvise(mapping, size, MADV_SEQUENTIAL);
+
+	file.mapping = std::shared_ptr<const char>((const char*)mapping, [size](const char *data) {
+		munmap((void*)data, size);
+	});
+
+	return open_file_view(file.mapping.get(), size, filename, file);
+}
+
+bool AssetPacker::open_file_view(const char *data, size_t size, std::string name, AssetPacker::AssetFile &file)
+{
+	file.data = data;
+	file.size = size;
+
+	if (size < sizeof(FileHeader))
+	{
+		std::cout << name << " is too small to be a packed asset\n";
+		return false;
+	}
+
+	memcpy(&file.header, data, sizeof(FileHeader));
+
+	if (memcmp(file.header.magic, FILE_MAGIC, 4) != 0 || file.header.version != FILE_VERSION)
+	{
+		std::cout << name << " is not a version " << FILE_VERSION << " packed asset, repack it\n";
+		return false;
+	}
+
+	if (file.header.file_size != size)
+	{
+		std::cout << name << " is truncated (" << size << " of " << file.header.file_size << " bytes)\n";
+		return false;
+	}
+
+	size_t table_size = sizeof(ChunkHeader) * (size_t)file.header.chunk_count;
+	if (table_size > size - sizeof(FileHeader))
+	{
+		std::cout << name << " has a corrupt chunk table\n";
+		return false;
+	}
+
+	file.chunks.resize(file.header.chunk_count);
+	memcpy(file.chunks.data(), data + sizeof(FileHeader), table_size);
+
+	if (hash_data(file.chunks.data(), table_size) != file.header.table_checksum)
+	{
+		std::cout << name << " has a corrupt chunk table\n";
+		return false;
+	}
+
+	for (auto &chunk : file.chunks)
+	{
+		if (chunk.offset > size || chunk.size > size - chunk.offset || chunk.codec > CODEC_LZ4_BLOCKS)
+		{
+			std::cout << name << " has a chunk outside the file\n";
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool AssetPacker::is_type(const AssetPacker::AssetFile &file, const char *type)
+{
+	return memcmp(file.header.type, type, 4) == 0;
+}
+
+const AssetPacker::ChunkHeader *AssetPacker::find_chunk(const AssetPacker::AssetFile &file, const char *tag, uint32_t n)
+{
+	for (auto &chunk : file.chunks)
+	{
+		if (memcmp(chunk.tag, tag, 4) == 0 && n-- == 0)
+		{
+			return &chunk;
+		}
+	}
+
+	return nullptr;
+}
+
+// Verifies and decodes one block, or a whole chunk stored without blocks
+static bool decode(const char *src, uint64_t size, uint32_t codec, uint64_t checksum, char *dst, uint64_t raw_size, const char *tag)
+{
+	if (AssetPacker::hash_data(src, size) != checksum)
+	{
+		std::cout << "Checksum mismatch in chunk " << std::string(tag, 4) << "\n";
+		return false;
+	}
+
+	if (codec == AssetPacker::CODEC_NONE)
+	{
+		if (size != raw_size)
+		{
+			return false;
+		}
+
+		memcpy(dst, src, size);
+		return true;
+	}
+
+	int decoded = LZ4_decompress_safe(src, dst, (int)size, (int)raw_size);
+
+	if (decoded < 0 || (uint64_t)decoded != raw_size)
+	{
+		std::cout << "Failed to decode chunk " << std::string(tag, 4) << "\n";
+		return false;
+	}
+
+	return true;
+}
+
+// Progress of a chunk whose blocks are decoded by several threads. Pool jobs
+// that start after every block is taken return without touching the chunk,
+// so read_chunk only waits for the blocks, never for the jobs.
+struct BlockDecode
+{
+	const char *tag;
+	std::vector<const char*> sources;
+	std::vector<AssetPacker::BlockHeader> blocks;
+	char *dst;
+	uint64_t raw_size;
+
+	std::atomic<size_t> next{0};
+	std::atomic<bool> failed{false};
+	size_t done = 0;
+	std::mutex mutex;
+	std::condition_variable condition;
+
+	void run()
+	{
+		size_t count = 0;
+
+		for (size_t b = next++; b < blocks.size(); b = next++)
+		{
+			uint64_t offset = b * AssetPacker::BLOCK_SIZE;
+			uint64_t size = std::min(AssetPacker::BLOCK_SIZE, raw_size - offset);
+
+			if (!decode(sources[b], blocks[b].size, blocks[b].codec, blocks[b].checksum, dst + offset, size, tag))
+			{
+				failed = true;
+			}
+
+			count++;
+		}
+
+		if (count > 0)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			done += count;
+			if (done == blocks.size())
+			{
+				condition.notify_all();
+			}
+		}
+	}
+};
+
+static bool read_blocks(const AssetPacker::AssetFile &file, const AssetPacker::ChunkHeader &chunk, char *dst, ThreadPool *pool)
+{
+	const char *src = file.data + chunk.offset;
+	auto state = std::make_shared<BlockDecode>();
+
+	size_t block_count = (chunk.raw_size + AssetPacker::BLOCK_SIZE - 1) / AssetPacker::BLOCK_SIZE;
+	uint64_t table_size = sizeof(AssetPacker::BlockHeader) * block_count;
+
+	if (block_count == 0 || table_size > chunk.size || AssetPacker::hash_data(src, table_size) != chunk.checksum)
+	{
+		std::cout << "Checksum mismatch in chunk " << std::string(chunk.tag, 4) << "\n";
+		return false;
+	}
+
+	state->tag = chunk.tag;
+	state->dst = dst;
+	state->raw_size = chunk.raw_size;
+	state->blocks.resize(block_count);
+	memcpy(state->blocks.data(), src, table_size);
+
+	uint64_t offset = table_size;
+	for (auto &block : state->blocks)
+	{
+		if (block.size > chunk.size - offset || (block.codec != AssetPacker::CODEC_NONE && block.codec != AssetPacker::CODEC_LZ4))
+		{
+			std::cout << "Chunk " << std::string(chunk.tag, 4) << " has a block outside the chunk\n";
+			return false;
+		}
+
+		state->sources.push_back(src + offset);
+		offset += block.size;
+	}
+
+	if (pool != nullptr)
+	{
+		size_t helpers = std::min(pool->size(), block_count - 1);
+		for (size_t i = 0; i < helpers; i++)
+		{
+			pool->submit([state]() { state->run(); });
+		}
+	}
+
+	state->run();
+
+	std::unique_lock<std::mutex> lock(state->mutex);
+	state->condition.wait(lock, [&state]() { return state->done == state->blocks.size(); });
+
+	return !state->failed;
+}
+
+bool AssetPacker::read_chunk(const AssetPacker::AssetFile &file, const AssetPacker::ChunkHeader &chunk, void *dst, ThreadPool *pool)
+{
+	if (chunk.codec == CODEC_LZ4_BLOCKS)
+	{
+		return read_blocks(file, chunk, (char*)dst, pool);
+	}
+
+	return decode(file.data + chunk.offset, chunk.size, chunk.codec, chunk.checksum, (char*)dst, chunk.raw_size, chunk.tag);
+}
@@ -0,0 +1,219 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+class ThreadPool;
+
+namespace AssetPacker
+{
+	// Packed asset layout:
+	//   FileHeader
+	//   ChunkHeader[chunk_count]
+	//   chunk data, each chunk starting on a CHUNK_ALIGNMENT boundary
+	// All offsets are from the start of the file. Compressed chunks larger
+	// than BLOCK_SIZE are split into blocks that decode independently:
+	//   BlockHeader[raw_size / BLOCK_SIZE, rounded up]
+	//   block data, back to back
+	// The chunk checksum then covers the block table and each block carries
+	// its own.
+	const char FILE_MAGIC[4] = {'V', 'K', 'A', 'S'};
+	const uint32_t FILE_VERSION = 3;
+	const uint64_t CHUNK_ALIGNMENT = 256;
+	const uint64_t BLOCK_SIZE = 256 * 1024;
+
+	enum ChunkCodec : uint32_t
+	{
+		CODEC_NONE = 0,
+		CODEC_LZ4 = 1,
+		CODEC_LZ4_BLOCKS = 2
+	};
+
+	const int MAX_LZ4HC_LEVEL = 12;
+
+	// How save_file compresses chunks. LZ4 and LZ4HC output decode the same
+	// way, the level only trades packing time for size. Chunks that do not
+	// get smaller are stored raw whatever the setting.
+	struct Compression
+	{
+		ChunkCodec codec = CODEC_LZ4;
+		// 0 uses LZ4's fast mode, 1 to MAX_LZ4HC_LEVEL use LZ4HC
+		int level = 0;
+	};
+
+	struct FileHeader
+	{
+		char magic[4];
+		uint32_t version;
+		char type[4];
+		uint32_t chunk_count;
+		// Compression the file was packed with
+		uint32_t codec;
+		uint32_t level;
+		uint64_t file_size;
+		uint64_t table_checksum;
+	};
+
+	struct ChunkHeader
+	{
+		char tag[4];
+		uint32_t codec;
+		uint64_t offset;
+		uint64_t size;
+		uint64_t raw_size;
+		uint64_t checksum;
+	};
+
+	// Every block holds BLOCK_SIZE bytes once decoded, except the last one.
+	// codec is CODEC_NONE or CODEC_LZ4.
+	struct BlockHeader
+	{
+		uint32_t size;
+		uint32_t codec;
+		uint64_t checksum;
+	};
+
+	// Contents of a texture's "INFO" chunk, the one read_info looks up.
+	// Followed by one "MIPS" chunk per level, largest first.
+	struct TextureInfo
+	{
+		uint32_t width;
+		uint32_t height;
+		uint32_t channels;
+		uint32_t format;
+		uint32_t mip_levels;
+	};
+
+	enum VertexLayout : uint32_t
+	{
+		// float32 position, normal, tangent and uv (44 bytes)
+		VERTEX_LAYOUT_FULL = 0,
+		// CompactVertex (20 bytes)
+		VERTEX_LAYOUT_COMPACT = 1
+	};
+
+	// Half float position (w = 1) and uv, 8-bit signed normalized normal
+	// and tangent (w = 0). Every attribute is expanded to float by the input
+	// assembler, so shaders do not change.
+	struct CompactVertex
+	{
+		uint16_t position[4];
+		int8_t normal[4];
+		int8_t tangent[4];
+		uint16_t uv[2];
+	};
+
+	// Axis aligned box and sphere around the vertices a range of indices
+	// uses, in mesh units
+	struct Bounds
+	{
+		float min[3];
+		float max[3];
+		float center[3];
+		float radius;
+	};
+
+	// Contents of the INFO chunk of a mesh ("MESH"). Followed by a "VERT"
+	// and an "INDX" chunk, and optionally "LODS" and "MLET" chunks.
+	struct MeshInfo
+	{
+		uint32_t vertex_count;
+		uint32_t index_count;
+		uint32_t vertex_size;
+		uint32_t vertex_layout;
+		// 2 when every index fits in 16 bits, otherwise 4
+		uint32_t index_size;
+		// Bounds of every vertex of the mesh
+		Bounds bounds;
+	};
+
+	const uint32_t MAX_MESH_LODS = 8;
+
+	// One entry of the optional "LODS" chunk of a mesh, finest level first.
+	// Every level is a range of the one index buffer and uses the same
+	// vertices. Without the chunk the whole index buffer is level 0.
+	struct MeshLod
+	{
+		uint32_t first_index;
+		uint32_t index_count;
+		// Estimated distance from the full detail surface, in mesh units
+		float error;
+		// Bounds of the vertices this level uses
+		Bounds bounds;
+	};
+
+	// One entry of the optional "MLET" chunk of a mesh. A meshlet is a
+	// contiguous range of the index buffer, so culled meshlets can be dropped
+	// by copying the ranges that remain.
+	struct Meshlet
+	{
+		// Bounding sphere
+		float center[3];
+		float radius;
+		// Every triangle faces away from a camera at position p if
+		// dot(normalize(cone_apex - p), cone_axis) >= cone_cutoff.
+		// cone_cutoff is 1 when the normals spread too far to ever cull.
+		float cone_apex[3];
+		float cone_cutoff;
+		float cone_axis[3];
+		uint32_t first_index;
+		uint32_t triangle_count;
+		uint32_t vertex_count;
+	};
+
+	// An asset being written by the packer. Chunks hold uncompressed data and
+	// are compressed by save_file.
+	struct PackedChunk
+	{
+		char tag[4];
+		std::vector<char> data;
+	};
+
+	struct PackedFile
+	{
+		char type[4];
+		std::vector<PackedChunk> chunks;
+	};
+
+	void add_chunk(PackedFile &file, const char *tag, const void *data, size_t size);
+	bool save_file(std::string filename, const PackedFile &file, const Compression &compression = Compression());
+
+	// An asset read back from disk. Headers are validated on load, chunk
+	// contents when they are read. data points either into mapping or into
+	// memory owned by someone else, such as a mapped archive.
+	struct AssetFile
+	{
+		FileHeader header;
+		std::vector<ChunkHeader> chunks;
+		const char *data = nullptr;
+		size_t size = 0;
+		// The mapped file, unmapped with the last copy
+		std::shared_ptr<const char> mapping;
+	};
+
+	// Maps the file rather than reading it, so chunks are decoded straight
+	// from the page cache
+	bool load_file(std::string filename, AssetFile &file);
+	// Parses an asset already in memory without copying it. The memory must
+	// outlive the AssetFile.
+	bool open_file_view(const char *data, size_t size, std::string name, AssetFile &file);
+	bool is_type(const AssetFile &file, const char *type);
+
+	// Returns the n-th chunk with the given tag, or nullptr
+	const ChunkHeader *find_chunk(const AssetFile &file, const char *tag, uint32_t n = 0);
+
+	// Verifies the chunk checksum and decodes exactly raw_size bytes into dst.
+	// Blocks of large chunks are shared out to the pool when one is given; the
+	// calling thread decodes blocks too and returns once all of them are done.
+	bool read_chunk(const AssetFile &file, const ChunkHeader &chunk, void *dst, ThreadPool *pool = nullptr);
+
+	template<typename T>
+	bool read_info(const AssetFile &file, T &info)
+	{
+		const ChunkHeader *chunk = find_chunk(file, "INFO");
+		return chunk != nullptr && chunk->raw_size == sizeof(T) && read_chunk(file, *chunk, &info);
+	}
+};
@@ -1,8 +1,10 @@
 #include "asset_packer.h"
+#include "block_compression.h"
+#include "mesh_optimizer.h"
+#include "vertex_table.h"
 
 #include <fstream>
-
-#include <lz4.h>
+#include <iostream>
 
 #ifndef STB_IMAGE_IMPLEMENTATION
 #define STB_IMAGE_IMPLEMENTATION
@@ -12,89 +14,216 @@
 #include <tinyobjloader/tiny_obj_loader.h>
 
 #include <vector>
-#include <unordered_map>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
 #include <glm/glm.hpp>
-#define GLM_ENABLE_EXPERIMENTAL
-#include <glm/gtx/hash.hpp>
+#include <glm/gtc/packing.hpp>
 
 #include "../inc.h"
 
-bool AssetPacker::load_file(std::string filename, AssetPacker::FileData &data)
+static float srgb_to_linear(float c)
+{
+	return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+}
+
+static float linear_to_srgb(float c)
+{
+	return c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+}
+
+// Halves a linear RGBA level with a box filter. Odd edges reuse the last
+// row/column so every destination texel averages exactly four samples.
+static std::vector<float> downsample(const std::vector<float> &src, uint32_t width, uint32_t height)
 {
-	std::ifstream s;
-	s.open(filename, std::ios::binary);
+	uint32_t dst_width = std::max(1u, width / 2);
+	uint32_t dst_height = std::max(1u, height / 2);
+	std::vector<float> dst(dst_width * dst_height * 4);
 
-	if (!s.is_open())
+	for (uint32_t y = 0; y < dst_height; y++)
 	{
-		return false;
+		uint32_t y0 = std::min(2 * y, height - 1);
+		uint32_t y1 = std::min(2 * y + 1, height - 1);
+
+		for (uint32_t x = 0; x < dst_width; x++)
+		{
+			uint32_t x0 = std::min(2 * x, width - 1);
+			uint32_t x1 = std::min(2 * x + 1, width - 1);
+
+			for (uint32_t c = 0; c < 4; c++)
+			{
+				dst[(y * dst_width + x) * 4 + c] = 0.25f * (src[(y0 * width + x0) * 4 + c] + src[(y0 * width + x1) * 4 + c] + src[(y1 * width + x0) * 4 + c] + src[(y1 * width + x1) * 4 + c]);
+			}
+		}
 	}
 
-	s.seekg(0, s.end);
-	data.size = (size_t)(s.tellg()) - (size_t)36;
-	s.seekg(0, s.beg);
-	data.data = new char[data.size];
+	return dst;
+}
 
-	s.read(data.type, 4);
-	s.read(data.metadata, 32);
-	s.read(data.data, data.size);
+uint32_t AssetPacker::mip_level_count(uint32_t width, uint32_t height)
+{
+	return (uint32_t)std::floor(std::log2(std::max(width, height))) + 1;
+}
 
-	s.close();
+size_t AssetPacker::level_size(uint32_t width, uint32_t height, VkFormat format)
+{
+	if (is_block_compressed(format))
+	{
+		return ((width + 3) / 4) * ((height + 3) / 4) * block_size(format);
+	}
 
-	return true;
+	return width * height * 4;
 }
 
-bool AssetPacker::save_file(std::string filename, const AssetPacker::FileData &data)
+size_t AssetPacker::texture_size(uint32_t width, uint32_t height, uint32_t mip_levels, VkFormat format)
 {
-	std::ofstream s;
-	s.open(filename, std::ios::binary | std::ios::out);
+	size_t size = 0;
 
-	if (!s.is_open())
+	for (uint32_t i = 0; i < mip_levels; i++)
 	{
-		return false;
+		size += level_size(std::max(1u, width >> i), std::max(1u, height >> i), format);
 	}
 
-	s.write(data.type, 4);
-	s.write(data.metadata, 32);
-	s.write(data.data, data.size);
+	return size;
+}
+
+// Builds the mip chain for an RGBA8 image and stores it in the given format.
+// Takes ownership of pixels, which must be freeable with stbi_image_free.
+static AssetPacker::PackedFile pack_pixels(uint8_t *pixels, int width, int height, int channels, VkFormat format)
+{
+	AssetPacker::PackedFile packed_texture;
+	packed_texture.type[0] = 'T';
+	packed_texture.type[1] = 'E';
+	packed_texture.type[2] = 'X';
+	packed_texture.type[3] = 'I';
+
+	uint32_t mip_levels = AssetPacker::mip_level_count(width, height);
+
+	AssetPacker::TextureInfo info;
+	info.width = width;
+	info.height = height;
+	info.channels = channels;
+	info.format = format;
+	info.mip_levels = mip_levels;
+	AssetPacker::add_chunk(packed_texture, "INFO", &info, sizeof(info));
+
+	// Filter in linear space, otherwise sRGB textures darken with every level
+	bool srgb = format == VK_FORMAT_R8G8B8A8_SRGB || format == VK_FORMAT_BC1_RGB_SRGB_BLOCK || format == VK_FORMAT_BC7_SRGB_BLOCK;
+	float to_linear[256];
+	for (int i = 0; i < 256; i++)
+	{
+		to_linear[i] = srgb ? srgb_to_linear(i / 255.0f) : i / 255.0f;
+	}
+
+	std::vector<float> level(width * height * 4);
+	for (size_t i = 0; i < level.size(); i++)
+	{
+		level[i] = (i % 4 == 3) ? pixels[i] / 255.0f : to_linear[pixels[i]];
+	}
+
+	// Levels are built as RGBA8 and then block compressed if needed
+	bool compressed = AssetPacker::is_block_compressed(format);
+	std::vector<uint8_t> rgba(pixels, pixels + width * height * 4);
+	std::vector<uint8_t> blocks;
+	stbi_image_free(pixels);
 
-	s.close();
+	uint32_t mip_width = width;
+	uint32_t mip_height = height;
+	for (uint32_t i = 0; i < mip_levels; i++)
+	{
+		// Each level is filtered from the unquantized level above it
+		if (i > 0)
+		{
+			level = downsample(level, mip_width, mip_height);
+			mip_width = std::max(1u, mip_width / 2);
+			mip_height = std::max(1u, mip_height / 2);
 
-	return true;
+			rgba.resize(level.size());
+			for (size_t j = 0; j < level.size(); j++)
+			{
+				float c = (j % 4 == 3 || !srgb) ? level[j] : linear_to_srgb(level[j]);
+				rgba[j] = (uint8_t)(std::min(std::max(c, 0.0f), 1.0f) * 255.0f + 0.5f);
+			}
+		}
+
+		if (compressed)
+		{
+			blocks.resize(AssetPacker::level_size(mip_width, mip_height, format));
+			AssetPacker::compress_image(rgba.data(), mip_width, mip_height, format, blocks.data());
+			AssetPacker::add_chunk(packed_texture, "MIPS", blocks.data(), blocks.size());
+		}
+		else
+		{
+			AssetPacker::add_chunk(packed_texture, "MIPS", rgba.data(), rgba.size());
+		}
+	}
+
+	return packed_texture;
 }
 
-void AssetPacker::close_file(AssetPacker::FileData &data)
+AssetPacker::PackedFile AssetPacker::pack_texture(std::string filename, VkFormat format)
 {
-	delete[] data.data;
+	int width, height, channels;
+	stbi_uc *pixels = stbi_load(filename.c_str(), &width, &height, &channels, STBI_rgb_alpha);
+
+	if (pixels == nullptr)
+	{
+		return AssetPacker::PackedFile();
+	}
+
+	return pack_pixels(pixels, width, height, channels, format);
 }
 
-AssetPacker::FileData AssetPacker::pack_texture(std::string filename, VkFormat format)
+AssetPacker::PackedFile AssetPacker::pack_orm(std::string ao_filename, std::string roughness_filename, std::string metallic_filename, VkFormat format)
 {
-	AssetPacker::FileData compressed_data;
-	compressed_data.type[0] = 'T';
-	compressed_data.type[1] = 'E';
-	compressed_data.type[2] = 'X';
-	compressed_data.type[3] = 'I';
+	std::string filenames[3] = {ao_filename, roughness_filename, metallic_filename};
+	stbi_uc *sources[3] = {};
+	int width[3], height[3], channels;
 
-	int width, height, channels;
-	stbi_uc *pixels = stbi_load(filename.c_str(), &width, &height, &channels, STBI_rgb_alpha);
+	bool loaded = true;
+	for (int i = 0; i < 3; i++)
+	{
+		sources[i] = stbi_load(filenames[i].c_str(), &width[i], &height[i], &channels, STBI_grey);
+
+		if (sources[i] == nullptr)
+		{
+			std::cout << "Failed to load " << filenames[i] << "\n";
+			loaded = false;
+		}
+		else if (width[i] != width[0] || height[i] != height[0])
+		{
+			std::cout << filenames[i] << " does not match the size of " << filenames[0] << "\n";
+			loaded = false;
+		}
+	}
 
-	char *pixel_ptr = (char*)pixels;
-	reinterpret_cast<uint32_t*>(compressed_data.metadata)[0] = width;
-	reinterpret_cast<uint32_t*>(compressed_data.metadata)[1] = height;
-	reinterpret_cast<uint32_t*>(compressed_data.metadata)[2] = channels;
-	reinterpret_cast<uint32_t*>(compressed_data.metadata)[3] = format;
-
-	int texture_size = width * height * 4;
-	int compress_bound = LZ4_compressBound(texture_size);
-	compressed_data.data = new char[compress_bound];
-	int compressed_size = LZ4_compress_default(pixel_ptr, compressed_data.data, texture_size, compress_bound);
-	char *final_buffer = new char[compressed_size];
-	memcpy(final_buffer, compressed_data.data, compressed_size);
-	delete[] compressed_data.data;
-	compressed_data.data = final_buffer;
-	compressed_data.size = compressed_size;
-
-	return compressed_data;
+	if (!loaded)
+	{
+		for (int i = 0; i < 3; i++)
+		{
+			stbi_image_free(sources[i]);
+		}
+		return AssetPacker::PackedFile();
+	}
+
+	// R = ambient occlusion, G = roughness, B = metallic
+	size_t pixel_count = width[0] * height[0];
+	stbi_uc *pixels = (stbi_uc*)STBI_MALLOC(pixel_count * 4);
+	for (size_t i = 0; i < pixel_count; i++)
+	{
+		pixels[i * 4 + 0] = sources[0][i];
+		pixels[i * 4 + 1] = sources[1][i];
+		pixels[i * 4 + 2] = sources[2][i];
+		pixels[i * 4 + 3] = 255;
+	}
+
+	for (int i = 0; i < 3; i++)
+	{
+		stbi_image_free(sources[i]);
+	}
+
+	return pack_pixels(pixels, width[0], height[0], 3, format);
 }
 
 struct Vertex
@@ -103,29 +232,45 @@ struct Vertex
 	glm::vec3 normal;
 	glm::vec3 tangent;
 	glm::vec2 uv;
-
-	bool operator==(const Vertex &other) const
-	{
-		return position == other.position && normal == other.normal && uv == other.uv;
-	}
 };
 
-namespace std
+// VertexTable hashes and compares vertices by their raw bits
+static_assert(sizeof(Vertex) == 11 * sizeof(float), "Vertex must have no padding");
+
+static int8_t snorm8(float value)
+{
+	return (int8_t)std::round(glm::clamp(value, -1.0f, 1.0f) * 127.0f);
+}
+
+static AssetPacker::CompactVertex compact_vertex(const Vertex &vertex)
 {
-    template<> struct hash<Vertex>
-    {
-	size_t operator()(Vertex const& vertex) const
+	AssetPacker::CompactVertex compact;
+
+	glm::vec3 normal = glm::normalize(vertex.normal);
+	// Tangents are not normalized when computed, and degenerate uvs leave them
+	// non finite
+	glm::vec3 tangent = vertex.tangent;
+	float length = glm::length(tangent);
+	tangent = std::isfinite(length) && length > 0.0f ? tangent / length : glm::vec3(0.0f);
+
+	for (int c = 0; c < 3; c++)
 	{
-	    return ((hash<glm::vec3>()(vertex.position) ^
-		   (hash<glm::vec3>()(vertex.normal) << 1)) >> 1) ^
-		   (hash<glm::vec2>()(vertex.uv) << 1);
+		compact.position[c] = glm::packHalf1x16(vertex.position[c]);
+		compact.normal[c] = snorm8(normal[c]);
+		compact.tangent[c] = snorm8(tangent[c]);
 	}
-    };
+	compact.position[3] = glm::packHalf1x16(1.0f);
+	compact.normal[3] = 0;
+	compact.tangent[3] = 0;
+	compact.uv[0] = glm::packHalf1x16(vertex.uv.x);
+	compact.uv[1] = glm::packHalf1x16(vertex.uv.y);
+
+	return compact;
 }
 
-AssetPacker::FileData AssetPacker::pack_mesh(std::string filename)
+AssetPacker::PackedFile AssetPacker::pack_mesh(std::string filename, const AssetPacker::MeshOptions &options)
 {
-	AssetPacker::FileData packed_mesh;
+	AssetPacker::PackedFile packed_mesh;
 
 	tinyobj::attrib_t attrib;
 	std::vector<tinyobj::shape_t> shapes;
@@ -134,11 +279,21 @@ AssetPacker::FileData AssetPacker::pack_mesh(std::string filename)
 	std::string warn;
 	std::string err;
 
-	tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, filename.c_str(), nullptr);
+	if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, filename.c_str(), nullptr))
+	{
+		return packed_mesh;
+	}
+
+	size_t index_count = 0;
+	for (auto &shape : shapes)
+	{
+		index_count += shape.mesh.indices.size();
+	}
 
-	std::unordered_map<Vertex, uint32_t> unique_vertices{};
 	std::vector<Vertex> vertices{};
 	std::vector<uint32_t> indices{};
+	indices.reserve(index_count);
+	AssetPacker::VertexTable<Vertex> unique_vertices(vertices, attrib.vertices.size() / 3);
 
 	for (size_t s = 0; s < shapes.size(); s++)
 	{
@@ -155,7 +310,8 @@ AssetPacker::FileData AssetPacker::pack_mesh(std::string filename)
 			tinyobj::real_t ux = attrib.texcoords[2 * idx.texcoord_index + 0];
 			tinyobj::real_t uy = attrib.texcoords[2 * idx.texcoord_index + 1];
 
-			Vertex vert;
+			// Value initialized so the unset tangent does not affect deduplication
+			Vertex vert{};
 			vert.position.x = vx;
 			vert.position.y = vy;
 			vert.position.z = vz;
@@ -165,13 +321,7 @@ AssetPacker::FileData AssetPacker::pack_mesh(std::string filename)
 			vert.uv.x = ux;
 			vert.uv.y = 1-uy;
 
-			if (unique_vertices.count(vert) == 0)
-			{
-				unique_vertices[vert] = (uint32_t)vertices.size();
-				vertices.push_back(vert);
-			}
-
-			indices.push_back(unique_vertices[vert]);
+			indices.push_back(unique_vertices.insert(vert));
 		}
 	}
 
@@ -194,30 +344,172 @@ AssetPacker::FileData AssetPacker::pack_mesh(std::string filename)
 		vertices[indices[i]].tangent = tan;
 	}
 
-	reinterpret_cast<uint32_t*>(packed_mesh.metadata)[0] = vertices.size();
-	reinterpret_cast<uint32_t*>(packed_mesh.metadata)[1] = indices.size();
+	if (indices.empty())
+	{
+		std::cout << filename << " has no triangles\n";
+		return packed_mesh;
+	}
+
+	// Reorder triangles for the post-transform cache, then for overdraw, then
+	// store vertices in the order the new index buffer fetches them
+	VertexCacheStats before = analyze_vertex_cache(indices, vertices.size());
+
+	optimize_vertex_cache(indices, vertices.size());
+	optimize_overdraw(indices, &vertices[0].position.x, sizeof(Vertex), vertices.size());
+
+	std::vector<uint32_t> remap;
+	size_t used_vertices = optimize_vertex_fetch(indices, vertices.size(), remap);
+
+	std::vector<Vertex> fetch_ordered(used_vertices);
+	for (size_t v = 0; v < vertices.size(); v++)
+	{
+		if (remap[v] != ~0u)
+		{
+			fetch_ordered[remap[v]] = vertices[v];
+		}
+	}
+	vertices.swap(fetch_ordered);
+
+	// Everything computed from positions from here on, such as bounds, has
+	// to hold for the half floats that compact vertices store
+	if (options.layout == VERTEX_LAYOUT_COMPACT)
+	{
+		for (auto &vertex : vertices)
+		{
+			for (int c = 0; c < 3; c++)
+			{
+				vertex.position[c] = glm::unpackHalf1x16(glm::packHalf1x16(vertex.position[c]));
+			}
+		}
+	}
+
+	VertexCacheStats after = analyze_vertex_cache(indices, vertices.size());
+
+	std::vector<Meshlet> meshlets;
+	if (options.meshlets)
+	{
+		meshlets = build_meshlets(indices, &vertices[0].position.x, sizeof(Vertex), vertices.size());
+	}
+
+	// Each level halves the one before it, until the simplifier stalls or
+	// the mesh gets too small to be worth another level
+	std::vector<MeshLod> lods = {{0, (uint32_t)indices.size(), 0.0f}};
+	if (options.lods)
+	{
+		std::vector<uint32_t> level = indices;
+		float error = 0.0f;
+
+		while (lods.size() < MAX_MESH_LODS && level.size() / 3 >= 128)
+		{
+			float level_error;
+			std::vector<uint32_t> next = simplify(level, &vertices[0].position.x, sizeof(Vertex), vertices.size(), level.size() / 2, level_error);
+
+			if (next.empty() || next.size() > level.size() * 9 / 10)
+			{
+				break;
+			}
+
+			optimize_vertex_cache(next, vertices.size());
+
+			// Every level is simplified from the previous one, so errors add up
+			error += level_error;
+			lods.push_back({(uint32_t)indices.size(), (uint32_t)next.size(), error});
+			indices.insert(indices.end(), next.begin(), next.end());
+			level.swap(next);
+		}
+	}
+
+	for (auto &lod : lods)
+	{
+		lod.bounds = compute_bounds(indices, lod.first_index, lod.index_count, &vertices[0].position.x, sizeof(Vertex), vertices.size());
+	}
+
+	// Printed as one line so output from parallel jobs does not interleave
+	char stats[512];
+	snprintf(stats, sizeof(stats), "%s: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f, %zu LODs, %zu meshlets\n", filename.c_str(), before.acmr, after.acmr, before.atvr, after.atvr, lods.size(), meshlets.size());
+	std::cout << stats;
 
 	packed_mesh.type[0] = 'M';
 	packed_mesh.type[1] = 'E';
 	packed_mesh.type[2] = 'S';
 	packed_mesh.type[3] = 'H';
 
-	packed_mesh.size = sizeof(Vertex) * vertices.size() + sizeof(uint32_t) * indices.size();
-	packed_mesh.data = new char[packed_mesh.size];
+	AssetPacker::MeshInfo info;
+	info.vertex_count = vertices.size();
+	info.index_count = indices.size();
+	info.vertex_layout = options.layout;
+	info.index_size = vertices.size() <= 65536 ? sizeof(uint16_t) : sizeof(uint32_t);
+	// Level 0 uses every vertex
+	info.bounds = lods[0].bounds;
+
+	if (options.layout == VERTEX_LAYOUT_COMPACT)
+	{
+		std::vector<CompactVertex> compact(vertices.size());
+		for (size_t i = 0; i < vertices.size(); i++)
+		{
+			compact[i] = compact_vertex(vertices[i]);
+		}
 
-	memcpy(packed_mesh.data, vertices.data(), sizeof(Vertex) * vertices.size());
-	memcpy(packed_mesh.data + sizeof(Vertex) * vertices.size(), indices.data(), sizeof(uint32_t) * indices.size());
+		info.vertex_size = sizeof(CompactVertex);
+		AssetPacker::add_chunk(packed_mesh, "INFO", &info, sizeof(info));
+		AssetPacker::add_chunk(packed_mesh, "VERT", compact.data(), sizeof(CompactVertex) * compact.size());
+	}
+	else
+	{
+		info.vertex_size = sizeof(Vertex);
+		AssetPacker::add_chunk(packed_mesh, "INFO", &info, sizeof(info));
+		AssetPacker::add_chunk(packed_mesh, "VERT", vertices.data(), sizeof(Vertex) * vertices.size());
+	}
+	if (info.index_size == sizeof(uint16_t))
+	{
+		std::vector<uint16_t> short_indices(indices.begin(), indices.end());
+		AssetPacker::add_chunk(packed_mesh, "INDX", short_indices.data(), sizeof(uint16_t) * short_indices.size());
+	}
+	else
+	{
+		AssetPacker::add_chunk(packed_mesh, "INDX", indices.data(), sizeof(uint32_t) * indices.size());
+	}
 
-	AssetPacker::FileData compressed_data;
-	int compress_bound = LZ4_compressBound(packed_mesh.size);
-	compressed_data.data = new char[compress_bound];
-	int compressed_size = LZ4_compress_default(packed_mesh.data, compressed_data.data, packed_mesh.size, compress_bound);
+	if (options.lods)
+	{
+		AssetPacker::add_chunk(packed_mesh, "LODS", lods.data(), sizeof(MeshLod) * lods.size());
+	}
 
-	AssetPacker::close_file(packed_mesh);
-	packed_mesh.data = new char[compressed_size];
-	memcpy(packed_mesh.data, compressed_data.data, compressed_size);
-	packed_mesh.size = compressed_size;
-	AssetPacker::close_file(compressed_data);
+	if (options.meshlets)
+	{
+		AssetPacker::add_chunk(packed_mesh, "MLET", meshlets.data(), sizeof(Meshlet) * meshlets.size());
+	}
 
 	return packed_mesh;
 }
+
+uint64_t AssetPacker::hash_data(const void *data, size_t size, uint64_t seed)
+{
+	const uint64_t prime = 0x100000001b3ULL;
+	const char *bytes = (const char*)data;
+	uint64_t hash = 0xcbf29ce484222325ULL ^ seed;
+
+	// Hash 8 bytes at a time, then the remaining tail one byte at a time
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8)
+	{
+		uint64_t word;
+		memcpy(&word, bytes + i, 8);
+		hash ^= word;
+		hash *= prime;
+		hash ^= hash >> 29;
+	}
+
+	for (; i < size; i++)
+	{
+		hash ^= (uint8_t)bytes[i];
+		hash *= prime;
+	}
+
+	// Final avalanche so nearby inputs give unrelated hashes
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdULL;
+	hash ^= hash >> 33;
+
+	return hash;
+}
@@ -1,23 +1,37 @@
 #pragma once
 
 #include <string>
+#include <cstdint>
 
 #include <vulkan/vulkan.h>
 
+#include "asset_file.h"
+
 namespace AssetPacker
 {
-	struct FileData
+	// Bump whenever the packed output changes so cached outputs get rebuilt
+	const uint32_t PACKER_VERSION = 13;
+
+	// Textures store their full mip chain, largest level first, either as
+	// RGBA8 or as BC blocks depending on format. Packing fails with no chunks.
+	PackedFile pack_texture(std::string filename, VkFormat format);
+	// Packs three greyscale maps into one texture, R = ao, G = roughness, B = metallic
+	PackedFile pack_orm(std::string ao_filename, std::string roughness_filename, std::string metallic_filename, VkFormat format);
+	struct MeshOptions
 	{
-		char type[4];
-		char metadata[32];
-		char *data;
-		size_t size;
+		VertexLayout layout = VERTEX_LAYOUT_FULL;
+		// Write a "MLET" chunk of culling clusters for the full detail level
+		bool meshlets = false;
+		// Append simplified levels to the index buffer and write a "LODS" chunk
+		bool lods = false;
 	};
 
-	bool load_file(std::string filename, FileData &data);
-	bool save_file(std::string filename, const FileData &data);
-	void close_file(FileData &data);
+	PackedFile pack_mesh(std::string filename, const MeshOptions &options);
+
+	uint32_t mip_level_count(uint32_t width, uint32_t height);
+	size_t level_size(uint32_t width, uint32_t height, VkFormat format);
+	size_t texture_size(uint32_t width, uint32_t height, uint32_t mip_levels, VkFormat format);
 
-	FileData pack_texture(std::string filename, VkFormat format);
-	FileData pack_mesh(std::string filename);
+	// 64-bit FNV-1a style hash, used to detect changed sources
+	uint64_t hash_data(const void *data, size_t size, uint64_t seed = 0);
 };
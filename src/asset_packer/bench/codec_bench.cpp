@@ -0,0 +1,238 @@
+// Repacks the assets of an asset list with each compression setting and
+// reports the compression ratio, the packing time, the decode throughput and
+// the time to open the archive and decode every chunk of it, which is what
+// AssetSystem::init spends on the CPU before uploading. Decoding is measured
+// on one thread and with the blocks of large chunks spread over a pool.
+// Usage: codec_bench [-r repeats] [-j threads] [asset_list]
+
+#include "../archive.h"
+#include "../../thread_pool.h"
+
+#include <iostream>
+#include <filesystem>
+#include <fstream>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+struct Setting
+{
+	const char *name;
+	AssetPacker::Compression compression;
+};
+
+struct SourceAsset
+{
+	AssetPacker::AssetListEntry entry;
+	AssetPacker::PackedFile file;
+};
+
+static double milliseconds_since(std::chrono::steady_clock::time_point start)
+{
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count();
+}
+
+// Decodes a packed asset back into the chunks it was saved from
+static bool unpack(const AssetPacker::AssetFile &asset, AssetPacker::PackedFile &file)
+{
+	memcpy(file.type, asset.header.type, 4);
+
+	for (auto &chunk : asset.chunks)
+	{
+		std::vector<char> raw(chunk.raw_size);
+		if (!AssetPacker::read_chunk(asset, chunk, raw.data()))
+		{
+			return false;
+		}
+
+		AssetPacker::add_chunk(file, chunk.tag, raw.data(), raw.size());
+	}
+
+	return true;
+}
+
+// Reads every chunk of every entry, returns the number of bytes decoded or 0 on failure
+static uint64_t decode_archive(const AssetPacker::Archive &archive, std::vector<char> &buffer, ThreadPool *pool)
+{
+	uint64_t decoded = 0;
+
+	for (uint32_t i = 0; i < archive.header->entry_count; i++)
+	{
+		AssetPacker::AssetFile asset;
+		if (!AssetPacker::open_entry(archive, archive.entries[i], asset))
+		{
+			return 0;
+		}
+
+		for (auto &chunk : asset.chunks)
+		{
+			if (buffer.size() < chunk.raw_size)
+			{
+				buffer.resize(chunk.raw_size);
+			}
+
+			if (!AssetPacker::read_chunk(asset, chunk, buffer.data(), pool))
+			{
+				return 0;
+			}
+
+			decoded += chunk.raw_size;
+		}
+	}
+
+	return decoded;
+}
+
+int main(int argc, char **argv)
+{
+	std::string asset_list_name = "../assets/deferred/asset_list";
+	int repeats = 5;
+	uint32_t thread_count = 0;
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+
+		if (arg == "-r" && i + 1 < argc)
+		{
+			repeats = std::max(1, std::stoi(argv[++i]));
+		}
+		else if (arg == "-j" && i + 1 < argc)
+		{
+			thread_count = std::stoi(argv[++i]);
+		}
+		else
+		{
+			asset_list_name = arg;
+		}
+	}
+
+	std::vector<AssetPacker::AssetListEntry> entries;
+	if (!AssetPacker::read_asset_list(asset_list_name, entries))
+	{
+		std::cout << "Failed to read asset list: " << asset_list_name << "\n";
+		return 1;
+	}
+
+	std::vector<SourceAsset> sources;
+	uint64_t raw_size = 0;
+
+	for (auto &entry : entries)
+	{
+		if (entry.type == 'a')
+		{
+			continue;
+		}
+
+		SourceAsset source;
+		source.entry = entry;
+
+		AssetPacker::AssetFile asset;
+		if (!AssetPacker::load_file(entry.file, asset) || !unpack(asset, source.file))
+		{
+			std::cout << "Skipping " << entry.file << ", run the asset packer first\n";
+			continue;
+		}
+
+		for (auto &chunk : source.file.chunks)
+		{
+			raw_size += chunk.data.size();
+		}
+
+		sources.push_back(std::move(source));
+	}
+
+	if (sources.empty())
+	{
+		std::cout << "No assets to pack\n";
+		return 1;
+	}
+
+	std::filesystem::path dir = std::filesystem::temp_directory_path() / "codec_bench";
+	std::filesystem::create_directories(dir);
+
+	const Setting settings[] = {
+		{"RAW", {AssetPacker::CODEC_NONE, 0}},
+		{"LZ4", {AssetPacker::CODEC_LZ4, 0}},
+		{"LZ4HC4", {AssetPacker::CODEC_LZ4, 4}},
+		{"LZ4HC9", {AssetPacker::CODEC_LZ4, 9}},
+		{"LZ4HC12", {AssetPacker::CODEC_LZ4, 12}}
+	};
+
+	ThreadPool pool(thread_count);
+
+	printf("%zu assets, %.2f MB decoded, %zu threads\n", sources.size(), raw_size / (1024.0 * 1024.0), pool.size());
+	printf("%-8s %12s %8s %10s %12s %12s %10s\n", "codec", "archive MB", "ratio", "pack ms", "decode MB/s", "pool MB/s", "init ms");
+
+	for (auto &setting : settings)
+	{
+		std::string list_name = (dir / "asset_list").string();
+		std::string archive_name = (dir / (std::string(setting.name) + ".ar")).string();
+
+		auto pack_start = std::chrono::steady_clock::now();
+
+		std::ofstream list(list_name);
+		bool packed = list.is_open();
+
+		for (size_t i = 0; i < sources.size() && packed; i++)
+		{
+			std::string file = (dir / (std::to_string(i) + "." + sources[i].entry.type)).string();
+			packed = AssetPacker::save_file(file, sources[i].file, setting.compression);
+			list << sources[i].entry.type << ":" << file << ":" << sources[i].entry.name << "\n";
+		}
+
+		list.close();
+		packed = packed && AssetPacker::save_archive(archive_name, list_name);
+		double pack_ms = milliseconds_since(pack_start);
+
+		if (!packed)
+		{
+			std::cout << "Failed to pack with " << setting.name << "\n";
+			continue;
+		}
+
+		// The first run opens the archive like AssetSystem::init does, with
+		// the file still in the page cache from packing. The rest only decode.
+		std::vector<char> buffer;
+		AssetPacker::Archive archive;
+
+		auto init_start = std::chrono::steady_clock::now();
+		bool opened = AssetPacker::open_archive(archive_name, archive);
+		uint64_t decoded = opened ? decode_archive(archive, buffer, &pool) : 0;
+		double init_ms = milliseconds_since(init_start);
+
+		if (decoded != raw_size)
+		{
+			std::cout << "Failed to decode the " << setting.name << " archive\n";
+			if (opened)
+			{
+				AssetPacker::close_archive(archive);
+			}
+			continue;
+		}
+
+		double decode_ms = 1e30;
+		double pool_ms = 1e30;
+		for (int r = 0; r < repeats; r++)
+		{
+			auto start = std::chrono::steady_clock::now();
+			decode_archive(archive, buffer, nullptr);
+			decode_ms = std::min(decode_ms, milliseconds_since(start));
+
+			start = std::chrono::steady_clock::now();
+			decode_archive(archive, buffer, &pool);
+			pool_ms = std::min(pool_ms, milliseconds_since(start));
+		}
+
+		printf("%-8s %12.2f %7.2fx %10.1f %12.0f %12.0f %10.2f\n", setting.name, archive.size / (1024.0 * 1024.0), (double)raw_size / archive.size,
+			pack_ms, raw_size / (decode_ms * 1000.0), raw_size / (pool_ms * 1000.0), init_ms);
+
+		AssetPacker::close_archive(archive);
+	}
+
+	std::filesystem::remove_all(dir);
+
+	return 0;
+}
@@ -0,0 +1,200 @@
+// Compares vertex deduplication through std::unordered_map, as pack_mesh
+// used to do it, with VertexTable on OBJ files.
+// Usage: vertex_dedup_bench [-r repeats] [file.obj...]
+
+#include "../vertex_table.h"
+
+#include <tinyobjloader/tiny_obj_loader.h>
+
+#include <glm/glm.hpp>
+#define GLM_ENABLE_EXPERIMENTAL
+#include <glm/gtx/hash.hpp>
+
+#include <iostream>
+#include <unordered_map>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+// Same layout as the vertex pack_mesh builds
+struct Vertex
+{
+	glm::vec3 position;
+	glm::vec3 normal;
+	glm::vec3 tangent;
+	glm::vec2 uv;
+
+	bool operator==(const Vertex &other) const
+	{
+		return position == other.position && normal == other.normal && uv == other.uv;
+	}
+};
+
+static_assert(sizeof(Vertex) == 11 * sizeof(float), "VertexTable needs Vertex without padding");
+
+namespace std
+{
+	template<> struct hash<Vertex>
+	{
+		size_t operator()(Vertex const& vertex) const
+		{
+			return ((hash<glm::vec3>()(vertex.position) ^
+				(hash<glm::vec3>()(vertex.normal) << 1)) >> 1) ^
+				(hash<glm::vec2>()(vertex.uv) << 1);
+		}
+	};
+}
+
+static double milliseconds_since(std::chrono::steady_clock::time_point start)
+{
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count();
+}
+
+static bool load_corners(const std::string &filename, std::vector<Vertex> &corners)
+{
+	tinyobj::attrib_t attrib;
+	std::vector<tinyobj::shape_t> shapes;
+	std::vector<tinyobj::material_t> materials;
+	std::string warn;
+	std::string err;
+
+	if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, filename.c_str(), nullptr))
+	{
+		return false;
+	}
+
+	for (auto &shape : shapes)
+	{
+		for (auto idx : shape.mesh.indices)
+		{
+			Vertex vert{};
+
+			for (int c = 0; c < 3; c++)
+			{
+				vert.position[c] = attrib.vertices[3 * idx.vertex_index + c];
+				if (idx.normal_index >= 0)
+				{
+					vert.normal[c] = attrib.normals[3 * idx.normal_index + c];
+				}
+			}
+
+			if (idx.texcoord_index >= 0)
+			{
+				vert.uv.x = attrib.texcoords[2 * idx.texcoord_index + 0];
+				vert.uv.y = 1 - attrib.texcoords[2 * idx.texcoord_index + 1];
+			}
+
+			corners.push_back(vert);
+		}
+	}
+
+	return true;
+}
+
+static size_t dedup_unordered_map(const std::vector<Vertex> &corners, std::vector<uint32_t> &indices)
+{
+	std::unordered_map<Vertex, uint32_t> unique_vertices{};
+	std::vector<Vertex> vertices{};
+
+	for (auto &vert : corners)
+	{
+		if (unique_vertices.count(vert) == 0)
+		{
+			unique_vertices[vert] = (uint32_t)vertices.size();
+			vertices.push_back(vert);
+		}
+
+		indices.push_back(unique_vertices[vert]);
+	}
+
+	return vertices.size();
+}
+
+static size_t dedup_vertex_table(const std::vector<Vertex> &corners, size_t expected_count, std::vector<uint32_t> &indices)
+{
+	std::vector<Vertex> vertices{};
+	AssetPacker::VertexTable<Vertex> unique_vertices(vertices, expected_count);
+
+	for (auto &vert : corners)
+	{
+		indices.push_back(unique_vertices.insert(vert));
+	}
+
+	return vertices.size();
+}
+
+int main(int argc, char **argv)
+{
+	std::vector<std::string> files;
+	int repeats = 5;
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+
+		if (arg == "-r" && i + 1 < argc)
+		{
+			repeats = std::max(1, std::stoi(argv[++i]));
+		}
+		else
+		{
+			files.push_back(arg);
+		}
+	}
+
+	if (files.empty())
+	{
+		files = {"../assets/sphere.obj", "../assets/monkey_smooth.obj", "../assets/light.obj", "../assets/cheese.obj", "../assets/vikingroom.obj", "../assets/lost_empire.obj"};
+	}
+
+	printf("%-32s %10s %10s %12s %12s %9s\n", "file", "corners", "unique", "map ms", "table ms", "speedup");
+
+	for (auto &file : files)
+	{
+		std::vector<Vertex> corners;
+
+		auto load_start = std::chrono::steady_clock::now();
+		if (!load_corners(file, corners))
+		{
+			std::cout << "Failed to load " << file << "\n";
+			continue;
+		}
+		double load_ms = milliseconds_since(load_start);
+
+		double map_ms = 1e30;
+		double table_ms = 1e30;
+		size_t map_unique = 0;
+		size_t table_unique = 0;
+
+		// Best of several runs, the index vectors are reserved up front so
+		// only the deduplication is measured
+		for (int r = 0; r < repeats; r++)
+		{
+			std::vector<uint32_t> indices;
+			indices.reserve(corners.size());
+
+			auto start = std::chrono::steady_clock::now();
+			map_unique = dedup_unordered_map(corners, indices);
+			map_ms = std::min(map_ms, milliseconds_since(start));
+
+			indices.clear();
+			start = std::chrono::steady_clock::now();
+			table_unique = dedup_vertex_table(corners, corners.size() / 3, indices);
+			table_ms = std::min(table_ms, milliseconds_since(start));
+		}
+
+		printf("%-32s %10zu %10zu %12.2f %12.2f %8.1fx\n", file.c_str(), corners.size(), table_unique, map_ms, table_ms, map_ms / table_ms);
+
+		// Bitwise and float comparison only disagree on -0.0 and NaN
+		if (map_unique != table_unique)
+		{
+			printf("  unordered_map found %zu unique vertices\n", map_unique);
+		}
+
+		printf("  obj load %.2f ms, table %.1f M corners/s\n", load_ms, corners.size() / (table_ms * 1000.0));
+	}
+
+	return 0;
+}
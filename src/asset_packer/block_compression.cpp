@@ -0,0 +1,589 @@
+#include "block_compression.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// Index weights for 4 bit BC7 indices, out of 64
+static const int bc7_weights[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+bool AssetPacker::is_block_compressed(VkFormat format)
+{
+	return block_size(format) != 0;
+}
+
+uint32_t AssetPacker::block_size(VkFormat format)
+{
+	switch (format)
+	{
+	case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+	case VK_FORMAT_BC4_UNORM_BLOCK:
+		return 8;
+	case VK_FORMAT_BC5_UNORM_BLOCK:
+	case VK_FORMAT_BC7_UNORM_BLOCK:
+	case VK_FORMAT_BC7_SRGB_BLOCK:
+		return 16;
+	default:
+		return 0;
+	}
+}
+
+void AssetPacker::compress_image(const uint8_t *rgba, uint32_t width, uint32_t height, VkFormat format, uint8_t *out)
+{
+	uint32_t blocks_x = (width + 3) / 4;
+	uint32_t blocks_y = (height + 3) / 4;
+	uint32_t size = block_size(format);
+
+	uint8_t block[64];
+	uint8_t red[16];
+
+	for (uint32_t by = 0; by < blocks_y; by++)
+	{
+		for (uint32_t bx = 0; bx < blocks_x; bx++)
+		{
+			// Gather the 4x4 block, clamping to the image edge
+			for (uint32_t y = 0; y < 4; y++)
+			{
+				uint32_t py = std::min(by * 4 + y, height - 1);
+				for (uint32_t x = 0; x < 4; x++)
+				{
+					uint32_t px = std::min(bx * 4 + x, width - 1);
+					memcpy(&block[(y * 4 + x) * 4], &rgba[(py * width + px) * 4], 4);
+					red[y * 4 + x] = block[(y * 4 + x) * 4];
+				}
+			}
+
+			uint8_t *dst = out + (by * blocks_x + bx) * size;
+
+			switch (format)
+			{
+			case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+			case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+				compress_bc1_block(block, dst);
+				break;
+			case VK_FORMAT_BC4_UNORM_BLOCK:
+				compress_bc4_block(red, dst);
+				break;
+			case VK_FORMAT_BC5_UNORM_BLOCK:
+				compress_bc5_block(block, dst);
+				break;
+			case VK_FORMAT_BC7_UNORM_BLOCK:
+			case VK_FORMAT_BC7_SRGB_BLOCK:
+				compress_bc7_block(block, dst);
+				break;
+			default:
+				break;
+			}
+		}
+	}
+}
+
+// Finds the principal axis of the block's colours with a few power iterations
+// over the covariance matrix. Only the first `channels` components are used.
+static void principal_axis(const float pixels[16][4], int channels, float mean[4], float axis[4])
+{
+	for (int c = 0; c < 4; c++)
+	{
+		mean[c] = 0.0f;
+		for (int i = 0; i < 16; i++)
+		{
+			mean[c] += pixels[i][c];
+		}
+		mean[c] /= 16.0f;
+	}
+
+	float covariance[4][4] = {};
+	for (int i = 0; i < 16; i++)
+	{
+		for (int a = 0; a < channels; a++)
+		{
+			for (int b = 0; b < channels; b++)
+			{
+				covariance[a][b] += (pixels[i][a] - mean[a]) * (pixels[i][b] - mean[b]);
+			}
+		}
+	}
+
+	for (int c = 0; c < 4; c++)
+	{
+		axis[c] = c < channels ? 1.0f : 0.0f;
+	}
+
+	for (int iteration = 0; iteration < 8; iteration++)
+	{
+		float next[4] = {};
+		for (int a = 0; a < channels; a++)
+		{
+			for (int b = 0; b < channels; b++)
+			{
+				next[a] += covariance[a][b] * axis[b];
+			}
+		}
+
+		float length = 0.0f;
+		for (int c = 0; c < channels; c++)
+		{
+			length = std::max(length, std::abs(next[c]));
+		}
+
+		// Flat block, any axis will do
+		if (length < 1e-6f)
+		{
+			break;
+		}
+
+		for (int c = 0; c < channels; c++)
+		{
+			axis[c] = next[c] / length;
+		}
+	}
+}
+
+// Projects the block onto its principal axis and returns the extreme points
+static void fit_endpoints(const float pixels[16][4], int channels, float e0[4], float e1[4])
+{
+	float mean[4], axis[4];
+	principal_axis(pixels, channels, mean, axis);
+
+	float min_t = 0.0f;
+	float max_t = 0.0f;
+	for (int i = 0; i < 16; i++)
+	{
+		float t = 0.0f;
+		for (int c = 0; c < channels; c++)
+		{
+			t += (pixels[i][c] - mean[c]) * axis[c];
+		}
+		min_t = std::min(min_t, t);
+		max_t = std::max(max_t, t);
+	}
+
+	float length = 0.0f;
+	for (int c = 0; c < channels; c++)
+	{
+		length += axis[c] * axis[c];
+	}
+	length = std::max(length, 1e-6f);
+
+	for (int c = 0; c < 4; c++)
+	{
+		e0[c] = std::min(std::max(mean[c] + axis[c] * min_t / length, 0.0f), 255.0f);
+		e1[c] = std::min(std::max(mean[c] + axis[c] * max_t / length, 0.0f), 255.0f);
+	}
+}
+
+// Least squares endpoints for a fixed set of interpolation weights in [0, 1]
+static bool refine_endpoints(const float pixels[16][4], const float weights[16], int channels, float e0[4], float e1[4])
+{
+	float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+	float ap[4] = {}, bp[4] = {};
+
+	for (int i = 0; i < 16; i++)
+	{
+		float a = 1.0f - weights[i];
+		float b = weights[i];
+		aa += a * a;
+		ab += a * b;
+		bb += b * b;
+
+		for (int c = 0; c < channels; c++)
+		{
+			ap[c] += a * pixels[i][c];
+			bp[c] += b * pixels[i][c];
+		}
+	}
+
+	float determinant = aa * bb - ab * ab;
+	if (std::abs(determinant) < 1e-6f)
+	{
+		return false;
+	}
+
+	for (int c = 0; c < channels; c++)
+	{
+		e0[c] = std::min(std::max((ap[c] * bb - bp[c] * ab) / determinant, 0.0f), 255.0f);
+		e1[c] = std::min(std::max((bp[c] * aa - ap[c] * ab) / determinant, 0.0f), 255.0f);
+	}
+
+	return true;
+}
+
+static uint16_t pack_565(const float color[4])
+{
+	uint16_t r = (uint16_t)(color[0] * 31.0f / 255.0f + 0.5f);
+	uint16_t g = (uint16_t)(color[1] * 63.0f / 255.0f + 0.5f);
+	uint16_t b = (uint16_t)(color[2] * 31.0f / 255.0f + 0.5f);
+	return (r << 11) | (g << 5) | b;
+}
+
+static void unpack_565(uint16_t packed, int color[3])
+{
+	int r = (packed >> 11) & 31;
+	int g = (packed >> 5) & 63;
+	int b = packed & 31;
+	color[0] = (r << 3) | (r >> 2);
+	color[1] = (g << 2) | (g >> 4);
+	color[2] = (b << 3) | (b >> 2);
+}
+
+// Encodes a BC1 block in four colour mode from the given endpoints and
+// returns its squared error. indices receives the chosen palette entries.
+static int encode_bc1(const float pixels[16][4], const float e0[4], const float e1[4], uint8_t out[8], uint8_t indices[16])
+{
+	uint16_t c0 = pack_565(e0);
+	uint16_t c1 = pack_565(e1);
+
+	// Four colour mode needs c0 > c1. Equal endpoints give a flat block, so
+	// any index is fine there.
+	if (c0 < c1)
+	{
+		std::swap(c0, c1);
+	}
+
+	int palette[4][3];
+	unpack_565(c0, palette[0]);
+	unpack_565(c1, palette[1]);
+	for (int c = 0; c < 3; c++)
+	{
+		palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+		palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+	}
+
+	int total_error = 0;
+	uint32_t bits = 0;
+	for (int i = 0; i < 16; i++)
+	{
+		int best = 0;
+		int best_error = INT32_MAX;
+		for (int p = 0; p < (c0 == c1 ? 1 : 4); p++)
+		{
+			int error = 0;
+			for (int c = 0; c < 3; c++)
+			{
+				int d = (int)pixels[i][c] - palette[p][c];
+				error += d * d;
+			}
+
+			if (error < best_error)
+			{
+				best_error = error;
+				best = p;
+			}
+		}
+
+		indices[i] = best;
+		total_error += best_error;
+		bits |= best << (2 * i);
+	}
+
+	out[0] = c0 & 0xff;
+	out[1] = c0 >> 8;
+	out[2] = c1 & 0xff;
+	out[3] = c1 >> 8;
+	memcpy(out + 4, &bits, 4);
+
+	return total_error;
+}
+
+void AssetPacker::compress_bc1_block(const uint8_t rgba[64], uint8_t out[8])
+{
+	float pixels[16][4];
+	for (int i = 0; i < 16; i++)
+	{
+		for (int c = 0; c < 4; c++)
+		{
+			pixels[i][c] = rgba[i * 4 + c];
+		}
+	}
+
+	float e0[4], e1[4];
+	fit_endpoints(pixels, 3, e0, e1);
+
+	uint8_t indices[16];
+	int best_error = encode_bc1(pixels, e0, e1, out, indices);
+
+	// Palette position of each index, 0 at c0 and 1 at c1
+	const float weights[4] = {0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f};
+
+	for (int iteration = 0; iteration < 2 && best_error > 0; iteration++)
+	{
+		// Indices are relative to the endpoints as stored, which encode_bc1
+		// may have swapped, so the solve gives c0 and c1 in stored order
+		float w[16];
+		for (int i = 0; i < 16; i++)
+		{
+			w[i] = weights[indices[i]];
+		}
+
+		if (!refine_endpoints(pixels, w, 3, e0, e1))
+		{
+			break;
+		}
+
+		uint8_t block[8];
+		uint8_t new_indices[16];
+		int error = encode_bc1(pixels, e0, e1, block, new_indices);
+
+		if (error >= best_error)
+		{
+			break;
+		}
+
+		best_error = error;
+		memcpy(out, block, 8);
+		memcpy(indices, new_indices, 16);
+	}
+}
+
+// Encodes a BC4 block in eight value mode and returns its squared error
+static int encode_bc4(const uint8_t values[16], int e0, int e1, uint8_t out[8])
+{
+	int palette[8];
+	palette[0] = e0;
+	palette[1] = e1;
+	for (int k = 2; k < 8; k++)
+	{
+		palette[k] = ((8 - k) * e0 + (k - 1) * e1) / 7;
+	}
+
+	int total_error = 0;
+	uint64_t bits = 0;
+	for (int i = 0; i < 16; i++)
+	{
+		int best = 0;
+		int best_error = INT32_MAX;
+		for (int p = 0; p < (e0 == e1 ? 1 : 8); p++)
+		{
+			int d = (int)values[i] - palette[p];
+			if (d * d < best_error)
+			{
+				best_error = d * d;
+				best = p;
+			}
+		}
+
+		total_error += best_error;
+		bits |= (uint64_t)best << (3 * i);
+	}
+
+	out[0] = (uint8_t)e0;
+	out[1] = (uint8_t)e1;
+	for (int i = 0; i < 6; i++)
+	{
+		out[2 + i] = (bits >> (8 * i)) & 0xff;
+	}
+
+	return total_error;
+}
+
+void AssetPacker::compress_bc4_block(const uint8_t values[16], uint8_t out[8])
+{
+	int min_value = 255;
+	int max_value = 0;
+	for (int i = 0; i < 16; i++)
+	{
+		min_value = std::min(min_value, (int)values[i]);
+		max_value = std::max(max_value, (int)values[i]);
+	}
+
+	int best_error = encode_bc4(values, max_value, min_value, out);
+
+	// Insetting the endpoints slightly often lines the palette up better
+	for (int d0 = 0; d0 < 4 && best_error > 0; d0++)
+	{
+		for (int d1 = 0; d1 < 4; d1++)
+		{
+			int e0 = max_value - d0;
+			int e1 = min_value + d1;
+
+			if ((d0 == 0 && d1 == 0) || e0 <= e1)
+			{
+				continue;
+			}
+
+			uint8_t block[8];
+			int error = encode_bc4(values, e0, e1, block);
+
+			if (error < best_error)
+			{
+				best_error = error;
+				memcpy(out, block, 8);
+			}
+		}
+	}
+}
+
+void AssetPacker::compress_bc5_block(const uint8_t rgba[64], uint8_t out[16])
+{
+	uint8_t red[16], green[16];
+	for (int i = 0; i < 16; i++)
+	{
+		red[i] = rgba[i * 4 + 0];
+		green[i] = rgba[i * 4 + 1];
+	}
+
+	compress_bc4_block(red, out);
+	compress_bc4_block(green, out + 8);
+}
+
+// Writes `count` bits of value into a 128 bit block, least significant first
+static void write_bits(uint8_t out[16], int &position, uint32_t value, int count)
+{
+	for (int i = 0; i < count; i++, position++)
+	{
+		if (value & (1u << i))
+		{
+			out[position / 8] |= 1 << (position % 8);
+		}
+	}
+}
+
+struct Bc7Mode6
+{
+	uint8_t endpoints[2][4];
+	uint8_t pbits[2];
+	uint8_t indices[16];
+	int error;
+};
+
+// Quantizes endpoints to 7 bits plus the given p-bits, picks the closest
+// index for every pixel and returns the result with its squared error
+static Bc7Mode6 encode_bc7_mode6(const float pixels[16][4], const float e0[4], const float e1[4], int p0, int p1)
+{
+	Bc7Mode6 result;
+	result.pbits[0] = p0;
+	result.pbits[1] = p1;
+
+	int expanded[2][4];
+	for (int c = 0; c < 4; c++)
+	{
+		result.endpoints[0][c] = (uint8_t)std::min(std::max((int)std::lround((e0[c] - p0) / 2.0f), 0), 127);
+		result.endpoints[1][c] = (uint8_t)std::min(std::max((int)std::lround((e1[c] - p1) / 2.0f), 0), 127);
+		expanded[0][c] = (result.endpoints[0][c] << 1) | p0;
+		expanded[1][c] = (result.endpoints[1][c] << 1) | p1;
+	}
+
+	int palette[16][4];
+	for (int k = 0; k < 16; k++)
+	{
+		for (int c = 0; c < 4; c++)
+		{
+			palette[k][c] = ((64 - bc7_weights[k]) * expanded[0][c] + bc7_weights[k] * expanded[1][c] + 32) >> 6;
+		}
+	}
+
+	result.error = 0;
+	for (int i = 0; i < 16; i++)
+	{
+		int best = 0;
+		int best_error = INT32_MAX;
+		for (int k = 0; k < 16; k++)
+		{
+			int error = 0;
+			for (int c = 0; c < 4; c++)
+			{
+				int d = (int)pixels[i][c] - palette[k][c];
+				error += d * d;
+			}
+
+			if (error < best_error)
+			{
+				best_error = error;
+				best = k;
+			}
+		}
+
+		result.indices[i] = best;
+		result.error += best_error;
+	}
+
+	return result;
+}
+
+static Bc7Mode6 best_bc7_mode6(const float pixels[16][4], const float e0[4], const float e1[4])
+{
+	Bc7Mode6 best = encode_bc7_mode6(pixels, e0, e1, 0, 0);
+
+	for (int p = 1; p < 4; p++)
+	{
+		Bc7Mode6 candidate = encode_bc7_mode6(pixels, e0, e1, p & 1, p >> 1);
+		if (candidate.error < best.error)
+		{
+			best = candidate;
+		}
+	}
+
+	return best;
+}
+
+// Only mode 6 (one subset, RGBA endpoints with p-bits, 4 bit indices) is
+// used. It handles smooth colour and alpha well and keeps the encoder simple.
+void AssetPacker::compress_bc7_block(const uint8_t rgba[64], uint8_t out[16])
+{
+	float pixels[16][4];
+	for (int i = 0; i < 16; i++)
+	{
+		for (int c = 0; c < 4; c++)
+		{
+			pixels[i][c] = rgba[i * 4 + c];
+		}
+	}
+
+	float e0[4], e1[4];
+	fit_endpoints(pixels, 4, e0, e1);
+
+	Bc7Mode6 best = best_bc7_mode6(pixels, e0, e1);
+
+	for (int iteration = 0; iteration < 2 && best.error > 0; iteration++)
+	{
+		float weights[16];
+		for (int i = 0; i < 16; i++)
+		{
+			weights[i] = bc7_weights[best.indices[i]] / 64.0f;
+		}
+
+		if (!refine_endpoints(pixels, weights, 4, e0, e1))
+		{
+			break;
+		}
+
+		Bc7Mode6 candidate = best_bc7_mode6(pixels, e0, e1);
+		if (candidate.error >= best.error)
+		{
+			break;
+		}
+
+		best = candidate;
+	}
+
+	// The first index is stored with an implicit zero high bit, so swap
+	// the endpoints if it needs the top half of the palette
+	if (best.indices[0] >= 8)
+	{
+		std::swap(best.endpoints[0], best.endpoints[1]);
+		std::swap(best.pbits[0], best.pbits[1]);
+		for (int i = 0; i < 16; i++)
+		{
+			best.indices[i] = 15 - best.indices[i];
+		}
+	}
+
+	memset(out, 0, 16);
+	int position = 0;
+
+	write_bits(out, position, 1 << 6, 7);
+	for (int c = 0; c < 4; c++)
+	{
+		write_bits(out, position, best.endpoints[0][c], 7);
+		write_bits(out, position, best.endpoints[1][c], 7);
+	}
+	write_bits(out, position, best.pbits[0], 1);
+	write_bits(out, position, best.pbits[1], 1);
+
+	write_bits(out, position, best.indices[0], 3);
+	for (int i = 1; i < 16; i++)
+	{
+		write_bits(out, position, best.indices[i], 4);
+	}
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+#include <vulkan/vulkan.h>
+
+namespace AssetPacker
+{
+	bool is_block_compressed(VkFormat format);
+
+	// Bytes per 4x4 block, or 0 for formats that are not block compressed
+	uint32_t block_size(VkFormat format);
+
+	// Compresses one RGBA8 image into BC blocks, row by row. Images that are not
+	// a multiple of 4 in size are padded by repeating the edge texels.
+	// BC1 encodes RGB, BC4 encodes R, BC5 encodes RG and BC7 encodes RGBA.
+	void compress_image(const uint8_t *rgba, uint32_t width, uint32_t height, VkFormat format, uint8_t *out);
+
+	void compress_bc1_block(const uint8_t rgba[64], uint8_t out[8]);
+	void compress_bc4_block(const uint8_t values[16], uint8_t out[8]);
+	void compress_bc5_block(const uint8_t rgba[64], uint8_t out[16]);
+	void compress_bc7_block(const uint8_t rgba[64], uint8_t out[16]);
+};
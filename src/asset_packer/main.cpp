@@ -1,118 +1,276 @@
 #include "asset_packer.h"
+#include "manifest.h"
+#include "archive.h"
+
+#include "../thread_pool.h"
 
 #include <iostream>
+#include <chrono>
+#include <filesystem>
+#include <algorithm>
+#include <cstdlib>
+
+enum JobStatus
+{
+	JOB_PACKED,
+	JOB_UP_TO_DATE,
+	JOB_FAILED
+};
+
+struct JobResult
+{
+	JobStatus status;
+	AssetPacker::CacheEntry entry;
+};
+
+// Picks the texture format from the job options, RGBA8 when no BC format is given
+static VkFormat texture_format(const AssetPacker::PackJob &job)
+{
+	bool srgb = AssetPacker::has_option(job, "SRGB");
 
-#include <lz4.h>
+	if (AssetPacker::has_option(job, "BC1"))
+	{
+		return srgb ? VK_FORMAT_BC1_RGB_SRGB_BLOCK : VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+	}
+	else if (AssetPacker::has_option(job, "BC4"))
+	{
+		return VK_FORMAT_BC4_UNORM_BLOCK;
+	}
+	else if (AssetPacker::has_option(job, "BC5"))
+	{
+		return VK_FORMAT_BC5_UNORM_BLOCK;
+	}
+	else if (AssetPacker::has_option(job, "BC7"))
+	{
+		return srgb ? VK_FORMAT_BC7_SRGB_BLOCK : VK_FORMAT_BC7_UNORM_BLOCK;
+	}
 
-int main()
+	return srgb ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8B8A8_UNORM;
+}
+
+static AssetPacker::MeshOptions mesh_options(const AssetPacker::PackJob &job)
 {
-	AssetPacker::FileData data = AssetPacker::pack_mesh("../assets/sphere.obj");
-	AssetPacker::save_file("../assets/sphere.m", data);
-	AssetPacker::close_file(data);
-	data = AssetPacker::pack_mesh("../assets/monkey_smooth.obj");
-	AssetPacker::save_file("../assets/monkey_smooth.m", data);
-	AssetPacker::close_file(data);
-	data = AssetPacker::pack_mesh("../assets/lost_empire.obj");
-	AssetPacker::save_file("../assets/lost_empire.m", data);
-	AssetPacker::close_file(data);
-
-	data = AssetPacker::pack_texture("../assets/lost_empire-RGBA.png", VK_FORMAT_R8G8B8A8_SRGB);
-	AssetPacker::save_file("../assets/lost_empire.t", data);
-	AssetPacker::close_file(data);
-
-	data = AssetPacker::pack_texture("../assets/concrete/degraded-concrete_albedo.png", VK_FORMAT_R8G8B8A8_SRGB);
-	AssetPacker::save_file("../assets/concrete/degraded-concrete_albedo.t", data);
-	AssetPacker::close_file(data);
-	data = AssetPacker::pack_texture("../assets/concrete/degraded-concrete_roughness.png", VK_FORMAT_R8G8B8A8_UNORM);
-	AssetPacker::save_file("../assets/concrete/degraded-concrete_roughness.t", data);
-	AssetPacker::close_file(data);
-	data = AssetPacker::pack_texture("../assets/concrete/degraded-concrete_normal-dx.png", VK_FORMAT_R8G8B8A8_SRGB);
-	AssetPacker::save_file("../assets/concrete/degraded-concrete_normal-dx.t", data);
-	AssetPacker::close_file(data);
-	data = AssetPacker::pack_texture("../assets/concrete/degraded-concrete_metallic.png", VK_FORMAT_R8G8B8A8_UNORM);
-	AssetPacker::save_file("../assets/concrete/degraded-concrete_metallic.t", data);
-	AssetPacker::close_file(data);
-	data = AssetPacker::pack_texture("../assets/concrete/degraded-concrete_ao.png", VK_FORMAT_R8G8B8A8_UNORM);
-	AssetPacker::save_file("../assets/concrete/degraded-concrete_ao.t", data);
-	AssetPacker::close_file(data);
-
-	data = AssetPacker::pack_texture("../assets/alien/alien-carniverous-plant_albedo.png", VK_FORMAT_R8G8B8A8_SRGB);
-	AssetPacker::save_file("../assets/alien/alien_albedo.t", data);
-	AssetPacker::close_file(data);
-	data = AssetPacker::pack_texture("../assets/alien/alien-carniverous-plant_normal-dx.png", VK_FORMAT_R8G8B8A8_UNORM);
-	AssetPacker::save_file("../assets/alien/alien_normal.t", data);
-	AssetPacker::close_file(data);
-	data = AssetPacker::pack_texture("../assets/alien/alien-carniverous-plant_metallic.png", VK_FORMAT_R8G8B8A8_SRGB);
-	AssetPacker::save_file("../assets/alien/alien_metal.t", data);
-	AssetPacker::close_file(data);
-	data = AssetPacker::pack_texture("../assets/alien/alien-carniverous-plant_roughness.png", VK_FORMAT_R8G8B8A8_UNORM);
-	AssetPacker::save_file("../assets/alien/alien_roughness.t", data);
-	AssetPacker::close_file(data);
-	data = AssetPacker::pack_texture("../assets/alien/alien-carniverous-plant_ao.png", VK_FORMAT_R8G8B8A8_UNORM);
-	AssetPacker::save_file("../assets/alien/alien_ao.t", data);
-	AssetPacker::close_file(data);
-
-	data = AssetPacker::pack_texture("../assets/dent/dented-metal_albedo.png", VK_FORMAT_R8G8B8A8_SRGB);
-	AssetPacker::save_file("../assets/dent/dented-metal_albedo.t", data);
-	AssetPacker::close_file(data);
-	data = AssetPacker::pack_texture("../assets/dent/dented-metal_roughness.png", VK_FORMAT_R8G8B8A8_UNORM);
-	AssetPacker::save_file("../assets/dent/dented-metal_roughness.t", data);
-	AssetPacker::close_file(data);
-	data = AssetPacker::pack_texture("../assets/dent/dented-metal_normal-dx.png", VK_FORMAT_R8G8B8A8_SRGB);
-	AssetPacker::save_file("../assets/dent/dented-metal_normal-dx.t", data);
-	AssetPacker::close_file(data);
-	data = AssetPacker::pack_texture("../assets/dent/dented-metal_metallic.png", VK_FORMAT_R8G8B8A8_UNORM);
-	AssetPacker::save_file("../assets/dent/dented-metal_metallic.t", data);
-	AssetPacker::close_file(data);
-	data = AssetPacker::pack_texture("../assets/dent/dented-metal_ao.png", VK_FORMAT_R8G8B8A8_UNORM);
-	AssetPacker::save_file("../assets/dent/dented-metal_ao.t", data);
-	AssetPacker::close_file(data);
-
-	data = AssetPacker::pack_texture("../assets/iron/rustediron2_basecolor.png", VK_FORMAT_R8G8B8A8_SRGB);
-	AssetPacker::save_file("../assets/iron/rustediron2_basecolor.t", data);
-	AssetPacker::close_file(data);
-	data = AssetPacker::pack_texture("../assets/iron/rustediron2_roughness.png", VK_FORMAT_R8G8B8A8_UNORM);
-	AssetPacker::save_file("../assets/iron/rustediron2_roughness.t", data);
-	AssetPacker::close_file(data);
-	data = AssetPacker::pack_texture("../assets/iron/rustediron2_normal.png", VK_FORMAT_R8G8B8A8_SRGB);
-	AssetPacker::save_file("../assets/iron/rustediron2_normal.t", data);
-	AssetPacker::close_file(data);
-	data = AssetPacker::pack_texture("../assets/iron/rustediron2_metallic.png", VK_FORMAT_R8G8B8A8_UNORM);
-	AssetPacker::save_file("../assets/iron/rustediron2_metallic.t", data);
-	AssetPacker::close_file(data);
-	data = AssetPacker::pack_texture("../assets/iron/rustediron2_ao.png", VK_FORMAT_R8G8B8A8_SRGB);
-	AssetPacker::save_file("../assets/iron/rustediron2_ao.t", data);
-	AssetPacker::close_file(data);
-
-	data = AssetPacker::pack_texture("../assets/stone/slimy-slippery-rock1_albedo.png", VK_FORMAT_R8G8B8A8_SRGB);
-	AssetPacker::save_file("../assets/stone/slimy-slippery-rock1_albedo.t", data);
-	AssetPacker::close_file(data);
-	data = AssetPacker::pack_texture("../assets/stone/slimy-slippery-rock1_roughness.png", VK_FORMAT_R8G8B8A8_UNORM);
-	AssetPacker::save_file("../assets/stone/slimy-slippery-rock1_roughness.t", data);
-	AssetPacker::close_file(data);
-	data = AssetPacker::pack_texture("../assets/stone/slimy-slippery-rock1_normal-dx.png", VK_FORMAT_R8G8B8A8_SRGB);
-	AssetPacker::save_file("../assets/stone/slimy-slippery-rock1_normal-dx.t", data);
-	AssetPacker::close_file(data);
-	data = AssetPacker::pack_texture("../assets/stone/slimy-slippery-rock1_metallic.psd", VK_FORMAT_R8G8B8A8_UNORM);
-	AssetPacker::save_file("../assets/stone/slimy-slippery-rock1_metallic.t", data);
-	AssetPacker::close_file(data);
-	data = AssetPacker::pack_texture("../assets/stone/slimy-slippery-rock1_ao.png", VK_FORMAT_R8G8B8A8_UNORM);
-	AssetPacker::save_file("../assets/stone/slimy-slippery-rock1_ao.t", data);
-	AssetPacker::close_file(data);
-
-	data = AssetPacker::pack_texture("../assets/cheese/cheese_albedo.png", VK_FORMAT_R8G8B8A8_SRGB);
-	AssetPacker::save_file("../assets/cheese/cheese_albedo.t", data);
-	AssetPacker::close_file(data);
-	data = AssetPacker::pack_texture("../assets/cheese/cheese_roughness.png", VK_FORMAT_R8G8B8A8_UNORM);
-	AssetPacker::save_file("../assets/cheese/cheese_roughness.t", data);
-	AssetPacker::close_file(data);
-	data = AssetPacker::pack_texture("../assets/cheese/cheese_normal.png", VK_FORMAT_R8G8B8A8_SRGB);
-	AssetPacker::save_file("../assets/cheese/cheese_normal.t", data);
-	AssetPacker::close_file(data);
-	data = AssetPacker::pack_texture("../assets/cheese/cheese_metallic.png", VK_FORMAT_R8G8B8A8_UNORM);
-	AssetPacker::save_file("../assets/cheese/cheese_metallic.t", data);
-	AssetPacker::close_file(data);
-	data = AssetPacker::pack_texture("../assets/cheese/cheese_ao.png", VK_FORMAT_R8G8B8A8_UNORM);
-	AssetPacker::save_file("../assets/cheese/cheese_ao.t", data);
-	AssetPacker::close_file(data);
+	AssetPacker::MeshOptions options;
+	options.layout = AssetPacker::has_option(job, "COMPACT") ? AssetPacker::VERTEX_LAYOUT_COMPACT : AssetPacker::VERTEX_LAYOUT_FULL;
+	options.meshlets = AssetPacker::has_option(job, "MESHLETS");
+	options.lods = AssetPacker::has_option(job, "LODS");
+	return options;
+}
+
+// RAW stores chunks as they are, which suits BC textures that LZ4 barely
+// shrinks. LZ4HC packs slower and smaller at the default level 9 or at the
+// level that follows it, LZ4HC1 to LZ4HC12. Anything else uses fast LZ4.
+static AssetPacker::Compression compression(const AssetPacker::PackJob &job)
+{
+	AssetPacker::Compression compression;
+
+	for (auto &option : job.options)
+	{
+		if (option == "RAW")
+		{
+			compression.codec = AssetPacker::CODEC_NONE;
+		}
+		else if (option.compare(0, 5, "LZ4HC") == 0)
+		{
+			compression.codec = AssetPacker::CODEC_LZ4;
+			compression.level = 9;
+
+			if (option.size() > 5)
+			{
+				compression.level = std::min(std::max(atoi(option.c_str() + 5), 1), AssetPacker::MAX_LZ4HC_LEVEL);
+			}
+		}
+	}
+
+	return compression;
+}
+
+static bool pack_job(const AssetPacker::PackJob &job)
+{
+	AssetPacker::PackedFile data;
+
+	if (job.type == 'm')
+	{
+		data = AssetPacker::pack_mesh(job.sources[0], mesh_options(job));
+	}
+	else if (job.type == 't')
+	{
+		data = AssetPacker::pack_texture(job.sources[0], texture_format(job));
+	}
+	else if (job.type == 'o')
+	{
+		if (job.sources.size() != 3)
+		{
+			std::cout << "ORM texture " << job.output << " needs ao, roughness and metallic sources\n";
+			return false;
+		}
+
+		data = AssetPacker::pack_orm(job.sources[0], job.sources[1], job.sources[2], texture_format(job));
+	}
+	else if (job.type == 'a')
+	{
+		return AssetPacker::save_archive(job.output, job.sources[0]);
+	}
+	else
+	{
+		std::cout << "Unknown asset type '" << job.type << "' for " << job.output << "\n";
+		return false;
+	}
+
+	if (data.chunks.empty())
+	{
+		return false;
+	}
+
+	return AssetPacker::save_file(job.output, data, compression(job));
+}
+
+static JobResult run_job(const AssetPacker::PackJob &job, const AssetPacker::CacheEntry *cached, bool force)
+{
+	JobResult result;
+	result.entry.settings_hash = AssetPacker::settings_hash(job);
+	result.entry.stat_hash = AssetPacker::stat_hash(job);
+
+	bool up_to_date = !force && cached != nullptr && std::filesystem::exists(job.output) && cached->settings_hash == result.entry.settings_hash;
+
+	// Cheap check first: if sizes and times are unchanged the sources are not read at all
+	if (up_to_date && result.entry.stat_hash != 0 && cached->stat_hash == result.entry.stat_hash)
+	{
+		result.entry.content_hash = cached->content_hash;
+		result.status = JOB_UP_TO_DATE;
+		return result;
+	}
+
+	result.entry.content_hash = AssetPacker::content_hash(job);
+
+	// Sources were touched but their contents are the same
+	if (up_to_date && result.entry.content_hash != 0 && cached->content_hash == result.entry.content_hash)
+	{
+		result.status = JOB_UP_TO_DATE;
+		return result;
+	}
+
+	result.status = pack_job(job) ? JOB_PACKED : JOB_FAILED;
+	return result;
+}
+
+int main(int argc, char **argv)
+{
+	std::string manifest_name = "../assets/asset_manifest";
+	bool force = false;
+	uint32_t thread_count = 0;
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+
+		if (arg == "-f")
+		{
+			force = true;
+		}
+		else if (arg == "-j" && i + 1 < argc)
+		{
+			thread_count = std::stoi(argv[++i]);
+		}
+		else
+		{
+			manifest_name = arg;
+		}
+	}
+
+	auto start = std::chrono::steady_clock::now();
+
+	std::vector<AssetPacker::PackJob> jobs;
+	if (!AssetPacker::read_manifest(manifest_name, jobs))
+	{
+		std::cout << "Failed to open asset manifest: " << manifest_name << "\n";
+		return 1;
+	}
+
+	std::string cache_name = manifest_name + ".cache";
+	AssetPacker::BuildCache cache;
+	AssetPacker::read_cache(cache_name, cache);
+
+	std::vector<std::future<JobResult>> results(jobs.size());
+
+	{
+		ThreadPool pool(thread_count);
+
+		// Archives bundle other outputs, so they are built once everything
+		// else is done and depend on the files they contain
+		for (int archive_pass = 0; archive_pass < 2; archive_pass++)
+		{
+			for (size_t i = 0; i < jobs.size(); i++)
+			{
+				AssetPacker::PackJob &job = jobs[i];
+
+				if ((job.type == 'a') != (archive_pass == 1))
+				{
+					continue;
+				}
+
+				if (job.type == 'a')
+				{
+					std::vector<AssetPacker::AssetListEntry> entries;
+					AssetPacker::read_asset_list(job.sources[0], entries);
+					for (auto &entry : entries)
+					{
+						job.sources.push_back(entry.file);
+					}
+				}
+
+				const AssetPacker::CacheEntry *cached = cache.count(job.output) != 0 ? &cache.at(job.output) : nullptr;
+				results[i] = pool.submit([&job, cached, force]() {
+					return run_job(job, cached, force);
+				});
+			}
+
+			for (auto &result : results)
+			{
+				if (result.valid())
+				{
+					result.wait();
+				}
+			}
+		}
+	}
+
+	int packed = 0;
+	int up_to_date = 0;
+	int failed = 0;
+
+	for (size_t i = 0; i < jobs.size(); i++)
+	{
+		JobResult result = results[i].get();
+
+		if (result.status == JOB_FAILED)
+		{
+			std::cout << "Failed to pack " << jobs[i].output << "\n";
+			cache.erase(jobs[i].output);
+			failed++;
+			continue;
+		}
+
+		if (result.status == JOB_PACKED)
+		{
+			std::cout << "Packed " << jobs[i].output << "\n";
+			packed++;
+		}
+		else
+		{
+			up_to_date++;
+		}
+
+		cache[jobs[i].output] = result.entry;
+	}
+
+	if (!AssetPacker::write_cache(cache_name, cache))
+	{
+		std::cout << "Failed to write asset cache: " << cache_name << "\n";
+	}
+
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	std::cout << packed << " packed, " << up_to_date << " up to date, " << failed << " failed in " << elapsed.count() << "s\n";
+
+	return failed == 0 ? 0 : 1;
 }
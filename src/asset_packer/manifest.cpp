@@ -0,0 +1,202 @@
+#include "manifest.h"
+
+#include "asset_packer.h"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <filesystem>
+
+static std::vector<std::string> split(const std::string &line, char delimiter)
+{
+	std::vector<std::string> parts;
+	std::string part;
+	std::stringstream stream(line);
+
+	while (std::getline(stream, part, delimiter))
+	{
+		parts.push_back(part);
+	}
+
+	return parts;
+}
+
+bool AssetPacker::read_manifest(std::string filename, std::vector<AssetPacker::PackJob> &jobs)
+{
+	std::ifstream file;
+	file.open(filename);
+
+	if (!file.is_open())
+	{
+		return false;
+	}
+
+	std::string line;
+	int line_number = 0;
+	while (std::getline(file, line))
+	{
+		line_number++;
+
+		// Skip empty lines and comments
+		if (line.size() == 0 || line[0] == '#')
+		{
+			continue;
+		}
+
+		auto parts = split(line, ':');
+
+		if (parts.size() < 3 || parts[0].size() != 1 || parts[1].size() == 0 || parts[2].size() == 0)
+		{
+			std::cout << filename << ":" << line_number << ": Malformed manifest line, skipping\n";
+			continue;
+		}
+
+		PackJob job;
+		job.type = parts[0][0];
+		job.sources = split(parts[1], ',');
+		job.output = parts[2];
+		job.options.assign(parts.begin() + 3, parts.end());
+		jobs.push_back(job);
+	}
+
+	file.close();
+	return true;
+}
+
+bool AssetPacker::read_cache(std::string filename, AssetPacker::BuildCache &cache)
+{
+	std::ifstream file;
+	file.open(filename);
+
+	if (!file.is_open())
+	{
+		return false;
+	}
+
+	std::string line;
+	while (std::getline(file, line))
+	{
+		std::stringstream stream(line);
+		CacheEntry entry;
+		std::string output;
+
+		stream >> std::hex >> entry.settings_hash >> entry.content_hash >> entry.stat_hash;
+		stream.get();
+		std::getline(stream, output);
+
+		if (stream.fail() || output.size() == 0)
+		{
+			continue;
+		}
+
+		cache[output] = entry;
+	}
+
+	file.close();
+	return true;
+}
+
+bool AssetPacker::write_cache(std::string filename, const AssetPacker::BuildCache &cache)
+{
+	std::ofstream file;
+	file.open(filename);
+
+	if (!file.is_open())
+	{
+		return false;
+	}
+
+	file << std::hex;
+	for (auto &entry : cache)
+	{
+		file << entry.second.settings_hash << " " << entry.second.content_hash << " " << entry.second.stat_hash << " " << entry.first << "\n";
+	}
+
+	file.close();
+	return true;
+}
+
+bool AssetPacker::has_option(const AssetPacker::PackJob &job, std::string option)
+{
+	for (auto &o : job.options)
+	{
+		if (o == option)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+uint64_t AssetPacker::settings_hash(const AssetPacker::PackJob &job)
+{
+	uint64_t hash = hash_data(&PACKER_VERSION, sizeof(PACKER_VERSION));
+	hash = hash_data(&job.type, 1, hash);
+
+	// Lengths go in first, or {"A", "BC"} and {"AB", "C"} would hash the same
+	for (auto &option : job.options)
+	{
+		uint64_t length = option.size();
+		hash = hash_data(&length, sizeof(length), hash);
+		hash = hash_data(option.data(), option.size(), hash);
+	}
+
+	return hash;
+}
+
+uint64_t AssetPacker::stat_hash(const AssetPacker::PackJob &job)
+{
+	uint64_t hash = 0;
+
+	for (auto &source : job.sources)
+	{
+		std::error_code error;
+		uint64_t size = std::filesystem::file_size(source, error);
+
+		if (error)
+		{
+			return 0;
+		}
+
+		int64_t time = std::filesystem::last_write_time(source, error).time_since_epoch().count();
+
+		if (error)
+		{
+			return 0;
+		}
+
+		hash = hash_data(&size, sizeof(size), hash);
+		hash = hash_data(&time, sizeof(time), hash);
+	}
+
+	return hash;
+}
+
+uint64_t AssetPacker::content_hash(const AssetPacker::PackJob &job)
+{
+	const size_t block_size = 1 << 20;
+	std::vector<char> block(block_size);
+	uint64_t hash = 0;
+
+	for (auto &source : job.sources)
+	{
+		std::ifstream file;
+		file.open(source, std::ios::binary);
+
+		if (!file.is_open())
+		{
+			return 0;
+		}
+
+		while (file)
+		{
+			file.read(block.data(), block_size);
+			hash = hash_data(block.data(), file.gcount(), hash);
+		}
+
+		file.close();
+	}
+
+	return hash;
+}
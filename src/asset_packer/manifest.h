@@ -0,0 +1,46 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+namespace AssetPacker
+{
+	// A single line of the asset manifest, formatted as
+	// type:source[,source...]:output[:option...]
+	// Type is 'm' for meshes, 't' for textures, 'o' for ORM textures
+	// packed from ao, roughness and metallic sources and 'a' for archives
+	// built from an asset list.
+	struct PackJob
+	{
+		char type;
+		std::vector<std::string> sources;
+		std::string output;
+		std::vector<std::string> options;
+	};
+
+	// What an output was built from the last time it was packed.
+	// stat_hash covers source sizes and modification times, so
+	// untouched sources can be skipped without reading them.
+	struct CacheEntry
+	{
+		uint64_t settings_hash;
+		uint64_t content_hash;
+		uint64_t stat_hash;
+	};
+
+	typedef std::unordered_map<std::string, CacheEntry> BuildCache;
+
+	bool read_manifest(std::string filename, std::vector<PackJob> &jobs);
+	bool read_cache(std::string filename, BuildCache &cache);
+	bool write_cache(std::string filename, const BuildCache &cache);
+
+	bool has_option(const PackJob &job, std::string option);
+
+	// Hash of the packer version, asset type and options
+	uint64_t settings_hash(const PackJob &job);
+	// Both return 0 if any source is missing
+	uint64_t stat_hash(const PackJob &job);
+	uint64_t content_hash(const PackJob &job);
+};
@@ -0,0 +1,1014 @@
+#include "mesh_optimizer.h"
+
+#include <algorithm>
+#include <cmath>
+
+AssetPacker::VertexCacheStats AssetPacker::analyze_vertex_cache(const std::vector<uint32_t> &indices, size_t vertex_count, uint32_t cache_size)
+{
+	VertexCacheStats stats = {0.0f, 0.0f};
+
+	if (indices.size() < 3 || vertex_count == 0)
+	{
+		return stats;
+	}
+
+	// A vertex is in the cache if it was added within the last cache_size misses
+	std::vector<uint32_t> added(vertex_count, 0);
+	uint32_t misses = 0;
+
+	for (uint32_t index : indices)
+	{
+		if (added[index] == 0 || misses - added[index] >= cache_size)
+		{
+			misses++;
+			added[index] = misses;
+		}
+	}
+
+	stats.acmr = (float)misses / (indices.size() / 3);
+	stats.atvr = (float)misses / vertex_count;
+
+	return stats;
+}
+
+// Scoring from Tom Forsyth's "Linear-Speed Vertex Cache Optimisation"
+const int SCORE_CACHE_SIZE = 32;
+const int SCORE_MAX_VALENCE = 32;
+const float CACHE_DECAY_POWER = 1.5f;
+const float LAST_TRIANGLE_SCORE = 0.75f;
+const float VALENCE_BOOST_SCALE = 2.0f;
+const float VALENCE_BOOST_POWER = 0.5f;
+
+struct ScoreTable
+{
+	float cache[SCORE_CACHE_SIZE];
+	float valence[SCORE_MAX_VALENCE + 1];
+
+	ScoreTable()
+	{
+		for (int i = 0; i < SCORE_CACHE_SIZE; i++)
+		{
+			// The last triangle's vertices get a fixed score so the next
+			// triangle does not simply reuse them in the same order
+			if (i < 3)
+			{
+				cache[i] = LAST_TRIANGLE_SCORE;
+			}
+			else
+			{
+				cache[i] = std::pow(1.0f - (float)(i - 3) / (SCORE_CACHE_SIZE - 3), CACHE_DECAY_POWER);
+			}
+		}
+
+		valence[0] = 0.0f;
+		for (int i = 1; i <= SCORE_MAX_VALENCE; i++)
+		{
+			// Favour vertices with few triangles left, so they get finished
+			valence[i] = VALENCE_BOOST_SCALE * std::pow((float)i, -VALENCE_BOOST_POWER);
+		}
+	}
+
+	float score(int cache_position, uint32_t live_triangles) const
+	{
+		if (live_triangles == 0)
+		{
+			return -1.0f;
+		}
+
+		float result = cache_position >= 0 ? cache[cache_position] : 0.0f;
+		return result + valence[std::min(live_triangles, (uint32_t)SCORE_MAX_VALENCE)];
+	}
+};
+
+void AssetPacker::optimize_vertex_cache(std::vector<uint32_t> &indices, size_t vertex_count)
+{
+	static const ScoreTable scores;
+
+	size_t triangle_count = indices.size() / 3;
+
+	if (triangle_count == 0)
+	{
+		return;
+	}
+
+	// Triangles using each vertex. The first live_triangles[v] entries of a
+	// vertex's range are the triangles it still has to emit.
+	std::vector<uint32_t> live_triangles(vertex_count, 0);
+	for (uint32_t index : indices)
+	{
+		live_triangles[index]++;
+	}
+
+	std::vector<uint32_t> offsets(vertex_count + 1, 0);
+	for (size_t v = 0; v < vertex_count; v++)
+	{
+		offsets[v + 1] = offsets[v] + live_triangles[v];
+	}
+
+	std::vector<uint32_t> adjacency(indices.size());
+	std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+	for (size_t i = 0; i < indices.size(); i++)
+	{
+		adjacency[fill[indices[i]]++] = (uint32_t)(i / 3);
+	}
+
+	std::vector<int> cache_position(vertex_count, -1);
+	std::vector<float> vertex_score(vertex_count);
+	for (size_t v = 0; v < vertex_count; v++)
+	{
+		vertex_score[v] = scores.score(-1, live_triangles[v]);
+	}
+
+	std::vector<float> triangle_score(triangle_count);
+	for (size_t t = 0; t < triangle_count; t++)
+	{
+		triangle_score[t] = vertex_score[indices[t * 3]] + vertex_score[indices[t * 3 + 1]] + vertex_score[indices[t * 3 + 2]];
+	}
+
+	std::vector<bool> emitted(triangle_count, false);
+	std::vector<uint32_t> result;
+	result.reserve(indices.size());
+
+	uint32_t cache[SCORE_CACHE_SIZE + 3];
+	uint32_t cache_count = 0;
+	size_t input_cursor = 0;
+
+	int64_t best = std::max_element(triangle_score.begin(), triangle_score.end()) - triangle_score.begin();
+
+	while (result.size() < indices.size())
+	{
+		// Dead end, continue with the next triangle in input order
+		if (best < 0)
+		{
+			while (emitted[input_cursor])
+			{
+				input_cursor++;
+			}
+			best = input_cursor;
+		}
+
+		const uint32_t *triangle = &indices[best * 3];
+		result.insert(result.end(), triangle, triangle + 3);
+		emitted[best] = true;
+
+		// Remove the triangle from its vertices' live lists
+		for (int k = 0; k < 3; k++)
+		{
+			uint32_t v = triangle[k];
+			uint32_t *list = &adjacency[offsets[v]];
+			uint32_t count = live_triangles[v];
+
+			for (uint32_t i = 0; i < count; i++)
+			{
+				if (list[i] == best)
+				{
+					std::swap(list[i], list[count - 1]);
+					break;
+				}
+			}
+
+			live_triangles[v]--;
+		}
+
+		// The triangle's vertices move to the front of the LRU cache
+		uint32_t new_cache[SCORE_CACHE_SIZE + 3];
+		uint32_t new_count = 0;
+		for (int k = 0; k < 3; k++)
+		{
+			new_cache[new_count++] = triangle[k];
+		}
+		for (uint32_t i = 0; i < cache_count; i++)
+		{
+			uint32_t v = cache[i];
+			if (v != triangle[0] && v != triangle[1] && v != triangle[2])
+			{
+				new_cache[new_count++] = v;
+			}
+		}
+
+		// Vertices pushed out of the cache lose their cache score
+		for (uint32_t i = SCORE_CACHE_SIZE; i < new_count; i++)
+		{
+			cache_position[new_cache[i]] = -1;
+			vertex_score[new_cache[i]] = scores.score(-1, live_triangles[new_cache[i]]);
+		}
+
+		cache_count = std::min(new_count, (uint32_t)SCORE_CACHE_SIZE);
+		std::copy(new_cache, new_cache + cache_count, cache);
+
+		for (uint32_t i = 0; i < cache_count; i++)
+		{
+			cache_position[cache[i]] = i;
+			vertex_score[cache[i]] = scores.score(i, live_triangles[cache[i]]);
+		}
+
+		// Only triangles touching the cache changed score, pick the best of them
+		best = -1;
+		float best_score = -1.0f;
+		for (uint32_t i = 0; i < new_count; i++)
+		{
+			uint32_t v = new_cache[i];
+			for (uint32_t j = 0; j < live_triangles[v]; j++)
+			{
+				uint32_t t = adjacency[offsets[v] + j];
+				float score = vertex_score[indices[t * 3]] + vertex_score[indices[t * 3 + 1]] + vertex_score[indices[t * 3 + 2]];
+				triangle_score[t] = score;
+
+				if (score > best_score)
+				{
+					best_score = score;
+					best = t;
+				}
+			}
+		}
+	}
+
+	indices.swap(result);
+}
+
+struct Cluster
+{
+	size_t first_triangle;
+	size_t triangle_count;
+	float sort_key;
+};
+
+void AssetPacker::optimize_overdraw(std::vector<uint32_t> &indices, const float *positions, size_t stride, size_t vertex_count)
+{
+	const uint32_t cache_size = 16;
+	// Allowed ACMR increase from splitting the cache optimized order
+	const float threshold = 1.05f;
+
+	size_t triangle_count = indices.size() / 3;
+
+	if (triangle_count < 2)
+	{
+		return;
+	}
+
+	auto position = [&](uint32_t v) {
+		return (const float*)((const char*)positions + v * stride);
+	};
+
+	// Hard boundaries are triangles where the simulated cache misses all three
+	// vertices, reordering there costs nothing
+	std::vector<size_t> boundaries;
+	{
+		std::vector<uint32_t> added(vertex_count, 0);
+		uint32_t misses = 0;
+
+		for (size_t t = 0; t < triangle_count; t++)
+		{
+			int triangle_misses = 0;
+			for (int k = 0; k < 3; k++)
+			{
+				uint32_t v = indices[t * 3 + k];
+				if (added[v] == 0 || misses - added[v] >= cache_size)
+				{
+					misses++;
+					added[v] = misses;
+					triangle_misses++;
+				}
+			}
+
+			if (t == 0 || triangle_misses == 3)
+			{
+				boundaries.push_back(t);
+			}
+		}
+	}
+	boundaries.push_back(triangle_count);
+
+	// Soft boundaries split hard clusters wherever the part so far, simulated
+	// with a cold cache, stays within the threshold of the whole cluster
+	std::vector<Cluster> clusters;
+	{
+		std::vector<uint32_t> added(vertex_count, 0);
+		uint32_t misses = 0;
+
+		for (size_t b = 0; b + 1 < boundaries.size(); b++)
+		{
+			size_t start = boundaries[b];
+			size_t end = boundaries[b + 1];
+
+			// ACMR of the whole cluster from a cold cache. Moving misses past
+			// every entry empties the cache without touching added.
+			misses += cache_size + 1;
+			uint32_t first_miss = misses;
+			for (size_t i = start * 3; i < end * 3; i++)
+			{
+				uint32_t v = indices[i];
+				if (added[v] == 0 || misses - added[v] >= cache_size)
+				{
+					misses++;
+					added[v] = misses;
+				}
+			}
+			float cluster_acmr = (float)(misses - first_miss) / (end - start);
+
+			size_t cluster_start = start;
+			uint32_t cluster_misses = 0;
+			misses += cache_size + 1;
+
+			for (size_t t = start; t < end; t++)
+			{
+				for (int k = 0; k < 3; k++)
+				{
+					uint32_t v = indices[t * 3 + k];
+					if (added[v] == 0 || misses - added[v] >= cache_size)
+					{
+						misses++;
+						cluster_misses++;
+						added[v] = misses;
+					}
+				}
+
+				size_t cluster_triangles = t + 1 - cluster_start;
+				if (t + 1 < end && cluster_triangles >= 8 && (float)cluster_misses / cluster_triangles <= threshold * cluster_acmr)
+				{
+					clusters.push_back({cluster_start, cluster_triangles, 0.0f});
+					cluster_start = t + 1;
+					cluster_misses = 0;
+					misses += cache_size + 1;
+				}
+			}
+
+			clusters.push_back({cluster_start, end - cluster_start, 0.0f});
+		}
+	}
+
+	// Area weighted centroid of the whole mesh
+	float mesh_center[3] = {0.0f, 0.0f, 0.0f};
+	float mesh_area = 0.0f;
+	std::vector<float> triangle_data(triangle_count * 7);
+
+	for (size_t t = 0; t < triangle_count; t++)
+	{
+		const float *p0 = position(indices[t * 3]);
+		const float *p1 = position(indices[t * 3 + 1]);
+		const float *p2 = position(indices[t * 3 + 2]);
+
+		float e1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+		float e2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+		float normal[3] = {e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0]};
+		float area = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+
+		float *data = &triangle_data[t * 7];
+		for (int c = 0; c < 3; c++)
+		{
+			data[c] = (p0[c] + p1[c] + p2[c]) / 3.0f;
+			data[3 + c] = normal[c];
+			mesh_center[c] += data[c] * area;
+		}
+		data[6] = area;
+		mesh_area += area;
+	}
+
+	for (int c = 0; c < 3; c++)
+	{
+		mesh_center[c] /= std::max(mesh_area, 1e-12f);
+	}
+
+	// Clusters further out along their own normal are more likely to occlude
+	for (auto &cluster : clusters)
+	{
+		float center[3] = {0.0f, 0.0f, 0.0f};
+		float normal[3] = {0.0f, 0.0f, 0.0f};
+		float area = 0.0f;
+
+		for (size_t t = cluster.first_triangle; t < cluster.first_triangle + cluster.triangle_count; t++)
+		{
+			const float *data = &triangle_data[t * 7];
+			for (int c = 0; c < 3; c++)
+			{
+				center[c] += data[c] * data[6];
+				normal[c] += data[3 + c];
+			}
+			area += data[6];
+		}
+
+		float length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+		cluster.sort_key = 0.0f;
+		for (int c = 0; c < 3; c++)
+		{
+			center[c] /= std::max(area, 1e-12f);
+			cluster.sort_key += (center[c] - mesh_center[c]) * normal[c] / std::max(length, 1e-12f);
+		}
+	}
+
+	std::stable_sort(clusters.begin(), clusters.end(), [](const Cluster &a, const Cluster &b) {
+		return a.sort_key > b.sort_key;
+	});
+
+	std::vector<uint32_t> result;
+	result.reserve(indices.size());
+	for (auto &cluster : clusters)
+	{
+		result.insert(result.end(), indices.begin() + cluster.first_triangle * 3, indices.begin() + (cluster.first_triangle + cluster.triangle_count) * 3);
+	}
+
+	indices.swap(result);
+}
+
+size_t AssetPacker::optimize_vertex_fetch(std::vector<uint32_t> &indices, size_t vertex_count, std::vector<uint32_t> &remap)
+{
+	remap.assign(vertex_count, ~0u);
+	uint32_t next = 0;
+
+	for (auto &index : indices)
+	{
+		if (remap[index] == ~0u)
+		{
+			remap[index] = next++;
+		}
+
+		index = remap[index];
+	}
+
+	return next;
+}
+
+static float dot3(const float *a, const float *b)
+{
+	return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+static float distance3(const float *a, const float *b)
+{
+	float d[3] = {a[0] - b[0], a[1] - b[1], a[2] - b[2]};
+	return std::sqrt(dot3(d, d));
+}
+
+// Ritter's bounding sphere: start from the most distant pair of axis
+// extremes, then grow the sphere to take in any point left outside
+static void bounding_sphere(const std::vector<const float*> &points, float center[3], float &radius)
+{
+	size_t min_point[3] = {0, 0, 0};
+	size_t max_point[3] = {0, 0, 0};
+
+	for (size_t i = 0; i < points.size(); i++)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			min_point[c] = points[i][c] < points[min_point[c]][c] ? i : min_point[c];
+			max_point[c] = points[i][c] > points[max_point[c]][c] ? i : max_point[c];
+		}
+	}
+
+	int axis = 0;
+	for (int c = 1; c < 3; c++)
+	{
+		if (distance3(points[min_point[c]], points[max_point[c]]) > distance3(points[min_point[axis]], points[max_point[axis]]))
+		{
+			axis = c;
+		}
+	}
+
+	const float *a = points[min_point[axis]];
+	const float *b = points[max_point[axis]];
+	for (int c = 0; c < 3; c++)
+	{
+		center[c] = (a[c] + b[c]) * 0.5f;
+	}
+	radius = distance3(a, b) * 0.5f;
+
+	for (const float *p : points)
+	{
+		float d = distance3(p, center);
+
+		if (d > radius)
+		{
+			float shift = (d - radius) * 0.5f / d;
+			for (int c = 0; c < 3; c++)
+			{
+				center[c] += (p[c] - center[c]) * shift;
+			}
+			radius = (radius + d) * 0.5f;
+		}
+	}
+}
+
+AssetPacker::Bounds AssetPacker::compute_bounds(const std::vector<uint32_t> &indices, size_t first_index, size_t index_count, const float *positions, size_t stride, size_t vertex_count)
+{
+	auto position = [&](uint32_t v) {
+		return (const float*)((const char*)positions + v * stride);
+	};
+
+	Bounds bounds = {};
+
+	std::vector<bool> used(vertex_count, false);
+	std::vector<const float*> points;
+
+	for (size_t i = first_index; i < first_index + index_count; i++)
+	{
+		if (!used[indices[i]])
+		{
+			used[indices[i]] = true;
+			points.push_back(position(indices[i]));
+		}
+	}
+
+	if (points.empty())
+	{
+		return bounds;
+	}
+
+	for (int c = 0; c < 3; c++)
+	{
+		bounds.min[c] = points[0][c];
+		bounds.max[c] = points[0][c];
+	}
+
+	for (const float *p : points)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			bounds.min[c] = std::min(bounds.min[c], p[c]);
+			bounds.max[c] = std::max(bounds.max[c], p[c]);
+		}
+	}
+
+	bounding_sphere(points, bounds.center, bounds.radius);
+
+	// Ritter's sphere can be loose on boxy meshes, where the sphere around
+	// the box center does better
+	float box_center[3];
+	for (int c = 0; c < 3; c++)
+	{
+		box_center[c] = (bounds.min[c] + bounds.max[c]) * 0.5f;
+	}
+
+	float box_radius = 0.0f;
+	for (const float *p : points)
+	{
+		box_radius = std::max(box_radius, distance3(p, box_center));
+	}
+
+	if (box_radius < bounds.radius)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			bounds.center[c] = box_center[c];
+		}
+		bounds.radius = box_radius;
+	}
+
+	return bounds;
+}
+
+static void compute_meshlet_bounds(AssetPacker::Meshlet &meshlet, const std::vector<uint32_t> &indices, const std::vector<const float*> &points, const float *positions, size_t stride)
+{
+	auto position = [&](uint32_t v) {
+		return (const float*)((const char*)positions + v * stride);
+	};
+
+	bounding_sphere(points, meshlet.center, meshlet.radius);
+
+	// Normal cone around the average triangle normal. planes holds the
+	// normal and a point of every triangle.
+	std::vector<float> planes;
+	float axis[3] = {0.0f, 0.0f, 0.0f};
+
+	for (uint32_t t = 0; t < meshlet.triangle_count; t++)
+	{
+		const float *p0 = position(indices[meshlet.first_index + t * 3]);
+		const float *p1 = position(indices[meshlet.first_index + t * 3 + 1]);
+		const float *p2 = position(indices[meshlet.first_index + t * 3 + 2]);
+
+		float e1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+		float e2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+		float normal[3] = {e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0]};
+		float length = std::sqrt(dot3(normal, normal));
+
+		// Degenerate triangles are never visible, so they do not widen the cone
+		if (length == 0.0f)
+		{
+			continue;
+		}
+
+		for (int c = 0; c < 3; c++)
+		{
+			normal[c] /= length;
+			axis[c] += normal[c];
+			planes.push_back(normal[c]);
+		}
+		planes.insert(planes.end(), p0, p0 + 3);
+	}
+
+	float axis_length = std::sqrt(dot3(axis, axis));
+	for (int c = 0; c < 3; c++)
+	{
+		meshlet.cone_axis[c] = axis_length > 0.0f ? axis[c] / axis_length : 0.0f;
+		meshlet.cone_apex[c] = meshlet.center[c];
+	}
+	meshlet.cone_cutoff = 1.0f;
+
+	float min_dot = 1.0f;
+	for (size_t i = 0; i < planes.size(); i += 6)
+	{
+		min_dot = std::min(min_dot, dot3(&planes[i], meshlet.cone_axis));
+	}
+
+	// Wider than about 84 degrees the cone culls almost nothing
+	if (planes.empty() || min_dot <= 0.1f)
+	{
+		return;
+	}
+
+	// Move the apex back along the axis until it is behind every triangle's
+	// plane, so the test holds for every point of the meshlet
+	float max_t = 0.0f;
+	for (size_t i = 0; i < planes.size(); i += 6)
+	{
+		const float *normal = &planes[i];
+		const float *p0 = &planes[i + 3];
+		float to_center[3] = {meshlet.center[0] - p0[0], meshlet.center[1] - p0[1], meshlet.center[2] - p0[2]};
+
+		max_t = std::max(max_t, dot3(to_center, normal) / dot3(meshlet.cone_axis, normal));
+	}
+
+	for (int c = 0; c < 3; c++)
+	{
+		meshlet.cone_apex[c] = meshlet.center[c] - meshlet.cone_axis[c] * max_t;
+	}
+	meshlet.cone_cutoff = std::sqrt(1.0f - min_dot * min_dot);
+}
+
+std::vector<AssetPacker::Meshlet> AssetPacker::build_meshlets(const std::vector<uint32_t> &indices, const float *positions, size_t stride, size_t vertex_count, uint32_t max_vertices, uint32_t max_triangles)
+{
+	std::vector<Meshlet> meshlets;
+	// Last meshlet each vertex was added to
+	std::vector<uint32_t> vertex_meshlet(vertex_count, ~0u);
+	std::vector<const float*> points;
+
+	Meshlet meshlet = {};
+
+	auto finish = [&]() {
+		if (meshlet.triangle_count > 0)
+		{
+			compute_meshlet_bounds(meshlet, indices, points, positions, stride);
+			meshlets.push_back(meshlet);
+		}
+	};
+
+	for (size_t i = 0; i + 2 < indices.size(); i += 3)
+	{
+		uint32_t id = (uint32_t)meshlets.size();
+		uint32_t new_vertices = 0;
+		for (int k = 0; k < 3; k++)
+		{
+			// Counts a vertex repeated within the triangle twice, which only
+			// matters for degenerate triangles
+			new_vertices += vertex_meshlet[indices[i + k]] != id;
+		}
+
+		if (meshlet.vertex_count + new_vertices > max_vertices || meshlet.triangle_count + 1 > max_triangles)
+		{
+			finish();
+			meshlet = {};
+			meshlet.first_index = (uint32_t)i;
+			points.clear();
+			id = (uint32_t)meshlets.size();
+		}
+
+		for (int k = 0; k < 3; k++)
+		{
+			uint32_t v = indices[i + k];
+			if (vertex_meshlet[v] != id)
+			{
+				vertex_meshlet[v] = id;
+				meshlet.vertex_count++;
+				points.push_back((const float*)((const char*)positions + v * stride));
+			}
+		}
+
+		meshlet.triangle_count++;
+	}
+
+	finish();
+
+	return meshlets;
+}
+
+// Symmetric 4x4 error quadric, the summed squared distance to a set of
+// planes. weight counts the planes so the error can be averaged.
+struct Quadric
+{
+	double a00, a11, a22, a01, a02, a12;
+	double b0, b1, b2;
+	double c;
+	double weight;
+
+	void add_plane(const double n[3], double d)
+	{
+		a00 += n[0] * n[0];
+		a11 += n[1] * n[1];
+		a22 += n[2] * n[2];
+		a01 += n[0] * n[1];
+		a02 += n[0] * n[2];
+		a12 += n[1] * n[2];
+		b0 += n[0] * d;
+		b1 += n[1] * d;
+		b2 += n[2] * d;
+		c += d * d;
+		weight += 1.0;
+	}
+
+	void add(const Quadric &q)
+	{
+		a00 += q.a00;
+		a11 += q.a11;
+		a22 += q.a22;
+		a01 += q.a01;
+		a02 += q.a02;
+		a12 += q.a12;
+		b0 += q.b0;
+		b1 += q.b1;
+		b2 += q.b2;
+		c += q.c;
+		weight += q.weight;
+	}
+
+	// Mean squared distance of p to the planes
+	double evaluate(const float *p) const
+	{
+		double x = p[0];
+		double y = p[1];
+		double z = p[2];
+		double result = a00 * x * x + a11 * y * y + a22 * z * z + 2.0 * (a01 * x * y + a02 * x * z + a12 * y * z) + 2.0 * (b0 * x + b1 * y + b2 * z) + c;
+		return weight > 0.0 ? std::max(result, 0.0) / weight : 0.0;
+	}
+};
+
+struct Collapse
+{
+	uint32_t from;
+	uint32_t to;
+	double cost;
+};
+
+// Unnormalized normal of the triangle a, b, c
+static void triangle_normal(const float *a, const float *b, const float *c, double normal[3])
+{
+	double e1[3] = {(double)b[0] - a[0], (double)b[1] - a[1], (double)b[2] - a[2]};
+	double e2[3] = {(double)c[0] - a[0], (double)c[1] - a[1], (double)c[2] - a[2]};
+	normal[0] = e1[1] * e2[2] - e1[2] * e2[1];
+	normal[1] = e1[2] * e2[0] - e1[0] * e2[2];
+	normal[2] = e1[0] * e2[1] - e1[1] * e2[0];
+}
+
+std::vector<uint32_t> AssetPacker::simplify(const std::vector<uint32_t> &source, const float *positions, size_t stride, size_t vertex_count, size_t target_index_count, float &error)
+{
+	auto position = [&](uint32_t v) {
+		return (const float*)((const char*)positions + v * stride);
+	};
+
+	std::vector<uint32_t> indices = source;
+	error = 0.0f;
+
+	// Vertices sharing a position (uv or normal seams) share a canonical index
+	std::vector<uint32_t> canonical(vertex_count);
+	{
+		std::vector<uint32_t> order(vertex_count);
+		for (uint32_t v = 0; v < vertex_count; v++)
+		{
+			order[v] = v;
+		}
+
+		auto less = [&](uint32_t a, uint32_t b) {
+			return std::lexicographical_compare(position(a), position(a) + 3, position(b), position(b) + 3);
+		};
+		std::sort(order.begin(), order.end(), less);
+
+		for (size_t i = 0; i < order.size(); i++)
+		{
+			bool same = i > 0 && !less(order[i - 1], order[i]);
+			canonical[order[i]] = same ? canonical[order[i - 1]] : order[i];
+		}
+	}
+
+	// Only vertices inside a single attribute region of a closed surface are
+	// collapsed. Seams and open or non-manifold borders stay where they are,
+	// which keeps uv seams and silhouettes of open meshes intact.
+	std::vector<bool> locked(vertex_count, false);
+	{
+		std::vector<uint32_t> wedges(vertex_count, 0);
+		for (uint32_t v = 0; v < vertex_count; v++)
+		{
+			wedges[canonical[v]]++;
+		}
+
+		std::vector<uint64_t> edges;
+		for (size_t i = 0; i + 2 < indices.size(); i += 3)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				uint64_t a = canonical[indices[i + k]];
+				uint64_t b = canonical[indices[i + (k + 1) % 3]];
+				edges.push_back(std::min(a, b) << 32 | std::max(a, b));
+			}
+		}
+		std::sort(edges.begin(), edges.end());
+
+		std::vector<bool> border(vertex_count, false);
+		for (size_t i = 0; i < edges.size();)
+		{
+			size_t j = i;
+			while (j < edges.size() && edges[j] == edges[i])
+			{
+				j++;
+			}
+
+			if (j - i != 2)
+			{
+				border[edges[i] >> 32] = true;
+				border[edges[i] & 0xffffffff] = true;
+			}
+			i = j;
+		}
+
+		for (uint32_t v = 0; v < vertex_count; v++)
+		{
+			locked[v] = wedges[canonical[v]] > 1 || border[canonical[v]];
+		}
+	}
+
+	std::vector<Quadric> quadrics(vertex_count, Quadric{});
+	for (size_t i = 0; i + 2 < indices.size(); i += 3)
+	{
+		double normal[3];
+		triangle_normal(position(indices[i]), position(indices[i + 1]), position(indices[i + 2]), normal);
+		double length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+
+		if (length == 0.0)
+		{
+			continue;
+		}
+
+		for (int c = 0; c < 3; c++)
+		{
+			normal[c] /= length;
+		}
+
+		const float *p = position(indices[i]);
+		double d = -(normal[0] * p[0] + normal[1] * p[1] + normal[2] * p[2]);
+
+		for (int k = 0; k < 3; k++)
+		{
+			quadrics[indices[i + k]].add_plane(normal, d);
+		}
+	}
+
+	std::vector<uint32_t> remap(vertex_count);
+	std::vector<bool> touched(vertex_count);
+	std::vector<uint32_t> offsets(vertex_count + 1);
+	std::vector<uint32_t> adjacency;
+	std::vector<Collapse> collapses;
+
+	// Each pass collapses a set of edges that do not share a neighbourhood,
+	// cheapest first, then rebuilds the triangle list
+	while (indices.size() > target_index_count)
+	{
+		std::fill(offsets.begin(), offsets.end(), 0);
+		for (uint32_t index : indices)
+		{
+			offsets[index + 1]++;
+		}
+		for (size_t v = 0; v < vertex_count; v++)
+		{
+			offsets[v + 1] += offsets[v];
+		}
+
+		adjacency.resize(indices.size());
+		std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+		for (size_t i = 0; i < indices.size(); i++)
+		{
+			adjacency[fill[indices[i]]++] = (uint32_t)(i / 3);
+		}
+
+		collapses.clear();
+		for (size_t i = 0; i + 2 < indices.size(); i += 3)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				uint32_t a = indices[i + k];
+				uint32_t b = indices[i + (k + 1) % 3];
+
+				// Each interior edge is seen from both triangles, so one
+				// direction per triangle covers both
+				if (!locked[a])
+				{
+					Quadric q = quadrics[a];
+					q.add(quadrics[b]);
+					collapses.push_back({a, b, q.evaluate(position(b))});
+				}
+			}
+		}
+
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse &a, const Collapse &b) {
+			return a.cost < b.cost;
+		});
+
+		for (uint32_t v = 0; v < vertex_count; v++)
+		{
+			remap[v] = v;
+		}
+		std::fill(touched.begin(), touched.end(), false);
+
+		// A collapse removes the two triangles around its edge
+		size_t triangles_left = indices.size() / 3;
+		size_t target_triangles = target_index_count / 3;
+		size_t collapsed = 0;
+
+		for (const Collapse &collapse : collapses)
+		{
+			if (triangles_left <= target_triangles)
+			{
+				break;
+			}
+
+			uint32_t from = collapse.from;
+			uint32_t to = collapse.to;
+
+			if (touched[from] || touched[to])
+			{
+				continue;
+			}
+
+			// Reject collapses that fold a remaining triangle over
+			bool flips = false;
+			for (uint32_t j = offsets[from]; j < offsets[from + 1] && !flips; j++)
+			{
+				const uint32_t *triangle = &indices[adjacency[j] * 3];
+
+				if (triangle[0] == to || triangle[1] == to || triangle[2] == to)
+				{
+					continue;
+				}
+
+				const float *before[3];
+				const float *after[3];
+				for (int k = 0; k < 3; k++)
+				{
+					before[k] = position(triangle[k]);
+					after[k] = triangle[k] == from ? position(to) : before[k];
+				}
+
+				double n0[3];
+				double n1[3];
+				triangle_normal(before[0], before[1], before[2], n0);
+				triangle_normal(after[0], after[1], after[2], n1);
+
+				double d = n0[0] * n1[0] + n0[1] * n1[1] + n0[2] * n1[2];
+				double l0 = n0[0] * n0[0] + n0[1] * n0[1] + n0[2] * n0[2];
+				double l1 = n1[0] * n1[0] + n1[1] * n1[1] + n1[2] * n1[2];
+				flips = d <= 0.2 * std::sqrt(l0 * l1);
+			}
+
+			if (flips)
+			{
+				continue;
+			}
+
+			remap[from] = to;
+			quadrics[to].add(quadrics[from]);
+			error = std::max(error, (float)std::sqrt(collapse.cost));
+
+			// Neighbouring triangles change shape, so later collapses in this
+			// pass stay out of the neighbourhood
+			for (uint32_t j = offsets[from]; j < offsets[from + 1]; j++)
+			{
+				const uint32_t *triangle = &indices[adjacency[j] * 3];
+				touched[triangle[0]] = true;
+				touched[triangle[1]] = true;
+				touched[triangle[2]] = true;
+			}
+
+			triangles_left -= 2;
+			collapsed++;
+		}
+
+		if (collapsed == 0)
+		{
+			break;
+		}
+
+		size_t write = 0;
+		for (size_t i = 0; i + 2 < indices.size(); i += 3)
+		{
+			uint32_t a = remap[indices[i]];
+			uint32_t b = remap[indices[i + 1]];
+			uint32_t c = remap[indices[i + 2]];
+
+			if (a != b && b != c && a != c)
+			{
+				indices[write++] = a;
+				indices[write++] = b;
+				indices[write++] = c;
+			}
+		}
+		indices.resize(write);
+	}
+
+	return indices;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "asset_file.h"
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace AssetPacker
+{
+	struct VertexCacheStats
+	{
+		// Average cache miss ratio, transformed vertices per triangle (0.5 - 3)
+		float acmr;
+		// Average transform to vertex ratio, 1 is ideal
+		float atvr;
+	};
+
+	// Simulates a FIFO post-transform cache of the given size
+	VertexCacheStats analyze_vertex_cache(const std::vector<uint32_t> &indices, size_t vertex_count, uint32_t cache_size = 16);
+
+	// Reorders triangles for post-transform cache locality (Forsyth's algorithm)
+	void optimize_vertex_cache(std::vector<uint32_t> &indices, size_t vertex_count);
+
+	// Reorders clusters of cache optimized triangles so outward facing ones
+	// are drawn first, which lets early depth testing reject more of the rest.
+	// positions points at the first position, stride is in bytes.
+	void optimize_overdraw(std::vector<uint32_t> &indices, const float *positions, size_t stride, size_t vertex_count);
+
+	// Returns the new index of every vertex so vertices are stored in the
+	// order they are first used. Unused vertices map to ~0u. Indices are
+	// rewritten in place; returns the number of vertices still in use.
+	size_t optimize_vertex_fetch(std::vector<uint32_t> &indices, size_t vertex_count, std::vector<uint32_t> &remap);
+
+	// Splits the index buffer, in order, into meshlets of at most max_vertices
+	// unique vertices and max_triangles triangles, with culling bounds.
+	// Best run after optimize_vertex_cache so neighbouring triangles share a
+	// meshlet.
+	std::vector<Meshlet> build_meshlets(const std::vector<uint32_t> &indices, const float *positions, size_t stride, size_t vertex_count, uint32_t max_vertices = 64, uint32_t max_triangles = 124);
+
+	// Bounds of the vertices used by index_count indices starting at
+	// first_index. The sphere is the smaller of Ritter's sphere and the one
+	// centered on the box.
+	Bounds compute_bounds(const std::vector<uint32_t> &indices, size_t first_index, size_t index_count, const float *positions, size_t stride, size_t vertex_count);
+
+	// Quadric error edge collapse towards target_index_count indices. The
+	// result indexes the same vertices. error receives the largest quadric
+	// error of any collapse, as an RMS distance in position units. Stops early
+	// when nothing more can be collapsed.
+	std::vector<uint32_t> simplify(const std::vector<uint32_t> &indices, const float *positions, size_t stride, size_t vertex_count, size_t target_index_count, float &error);
+};
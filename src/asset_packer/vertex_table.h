@@ -0,0 +1,90 @@
+#pragma once
+
+#include "asset_packer.h"
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+
+namespace AssetPacker
+{
+	// Open addressing hash set used to deduplicate vertices. Vertices are
+	// hashed and compared by their raw bits, so T must have no padding and
+	// attributes that should not count must be zeroed. Unique vertices are appended to the
+	// vector given to the constructor, which must start out empty; the table
+	// itself only stores their indices.
+	template<typename T>
+	class VertexTable
+	{
+	public:
+		VertexTable(std::vector<T> &vertices, size_t expected_count = 0) : _vertices(vertices)
+		{
+			size_t capacity = 64;
+			while (capacity < expected_count * 2)
+			{
+				capacity *= 2;
+			}
+
+			_slots.assign(capacity, EMPTY);
+			_vertices.reserve(expected_count);
+		}
+
+		// Returns the index of the vertex, adding it if it is new
+		uint32_t insert(const T &vertex)
+		{
+			// Keep the load factor at or below one half
+			if ((_vertices.size() + 1) * 2 > _slots.size())
+			{
+				grow();
+			}
+
+			size_t mask = _slots.size() - 1;
+			size_t slot = hash_data(&vertex, sizeof(T)) & mask;
+
+			// Triangular probing visits every slot of a power of two table
+			for (size_t probe = 1; ; probe++)
+			{
+				uint32_t index = _slots[slot];
+
+				if (index == EMPTY)
+				{
+					index = (uint32_t)_vertices.size();
+					_slots[slot] = index;
+					_vertices.push_back(vertex);
+					return index;
+				}
+
+				if (memcmp(&_vertices[index], &vertex, sizeof(T)) == 0)
+				{
+					return index;
+				}
+
+				slot = (slot + probe) & mask;
+			}
+		}
+
+	private:
+		static constexpr uint32_t EMPTY = ~0u;
+
+		void grow()
+		{
+			_slots.assign(_slots.size() * 2, EMPTY);
+			size_t mask = _slots.size() - 1;
+
+			for (uint32_t index = 0; index < _vertices.size(); index++)
+			{
+				size_t slot = hash_data(&_vertices[index], sizeof(T)) & mask;
+
+				for (size_t probe = 1; _slots[slot] != EMPTY; probe++)
+				{
+					slot = (slot + probe) & mask;
+				}
+
+				_slots[slot] = index;
+			}
+		}
+
+		std::vector<T> &_vertices;
+		std::vector<uint32_t> _slots;
+	};
+};
@@ -3,13 +3,58 @@
 #include "asset_packer/asset_packer.h"
 
 #include "base_engine.h"
+#include "profiler.h"
 
 #include <iostream>
 #include <fstream>
-#include <lz4.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <set>
+
+#include <sys/inotify.h>
+#include <unistd.h>
+
+// Bytes of an image holding mip_levels levels
+static VkDeviceSize texture_size(uint32_t width, uint32_t height, VkFormat format, uint32_t mip_levels)
+{
+	VkDeviceSize size = 0;
+	for (uint32_t i = 0; i < mip_levels; i++)
+	{
+		size += AssetPacker::level_size(std::max(1u, width >> i), std::max(1u, height >> i), format);
+	}
+	return size;
+}
 
 void AssetSystem::init(std::string asset_list_name, BaseEngine *engine)
 {
+	ProfileScope profile("init", "AssetSystem::init");
+
+	load_start = std::chrono::steady_clock::now();
+	vkGetPhysicalDeviceMemoryProperties(engine->_chosen_gpu, &memory_properties);
+
+	pool = std::make_unique<ThreadPool>();
+	uploader = engine;
+	stopping = false;
+
+	if (hot_reload)
+	{
+		watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (watch_fd < 0)
+		{
+			std::cout << "Failed to start watching asset files, hot reload is off\n";
+		}
+	}
+
+	placeholder_mesh._lods = {{0, 0, 0.0f, {}}};
+
+	char *white = new char[4];
+	memset(white, 0xff, 4);
+	placeholder_texture.width = 1;
+	placeholder_texture.height = 1;
+	engine->upload_texture(placeholder_texture, white, VK_FORMAT_R8G8B8A8_UNORM, 1);
+
 	std::ifstream read_f;
 	read_f.open(asset_list_name);
 
@@ -46,154 +91,1168 @@ void AssetSystem::init(std::string asset_list_name, BaseEngine *engine)
 			continue;
 		}
 
-		if (type == "m")
+		if (type == "m" || type == "t")
+		{
+			load_async(type[0], name, file);
+		}
+
+		// Archives hold many assets, each registered under its own name
+		else if (type == "a")
 		{
-			if (m_id_map.count(name) != 0)
+			AssetPacker::Archive archive;
+			ProfileScope open_profile("io", file);
+
+			if (!AssetPacker::open_archive(file, archive))
 			{
-				std::cout << "Name conflict with mesh: " << name << "\nUsing first instance encountered.\n";
+				std::cout << "Failed to open archive: " << file << "\n";
 				continue;
 			}
 
-			Mesh m = load_mesh(file.c_str());
+			for (uint32_t i = 0; i < archive.header->entry_count; i++)
+			{
+				const AssetPacker::ArchiveEntry &entry = archive.entries[i];
+				auto asset_file = std::make_shared<AssetPacker::AssetFile>();
+
+				if (!AssetPacker::open_entry(archive, entry, *asset_file))
+				{
+					continue;
+				}
 
-			if (m._indices.size() == 0)
+				queue_load(entry.type, AssetPacker::entry_name(archive, entry), file, asset_file);
+			}
+
+			if (watch_fd >= 0)
 			{
-				continue;
+				watched_archives[watch(file)] = archives.size();
 			}
 
-			engine->upload_mesh(m);
+			archives.push_back(archive);
+			archive_files.push_back(file);
+		}
+	}
+
+	read_f.close();
+
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - load_start;
+	std::cout << "Queued " << meshes.size() << " meshes and " << textures.size() << " textures in " << elapsed.count() << " ms\n";
+}
+
+void AssetSystem::destroy(BaseEngine *engine)
+{
+	// Loading jobs read from the archives, so they go first
+	stopping = true;
+	pool.reset();
+
+	for (auto &load : loads)
+	{
+		engine->destroy_staging_buffer(load->staging);
+	}
+	loads.clear();
+	streams.clear();
+	pending_levels.clear();
+
+	// Slots still loading or that failed share the placeholder's resources
+	for (size_t i = 0; i < meshes.size(); i++)
+	{
+		if (mesh_states[i] == ASSET_READY)
+		{
+			engine->destroy_mesh(meshes[i]);
+		}
+	}
+
+	for (size_t i = 0; i < textures.size(); i++)
+	{
+		if (texture_states[i] == ASSET_READY)
+		{
+			engine->destroy_texture(textures[i]);
+		}
+	}
+
+	engine->destroy_texture(placeholder_texture);
+
+	meshes.clear();
+	textures.clear();
+	mesh_states.clear();
+	texture_states.clear();
+
+	for (auto &archive : archives)
+	{
+		AssetPacker::close_archive(archive);
+	}
+	archives.clear();
+	archive_files.clear();
+
+	for (auto &archive : retired_archives)
+	{
+		AssetPacker::close_archive(archive);
+	}
+	retired_archives.clear();
+
+	if (watch_fd >= 0)
+	{
+		close(watch_fd);
+		watch_fd = -1;
+	}
+	watch_dirs.clear();
+	watched_files.clear();
+	watched_archives.clear();
+}
+
+AssetHandle AssetSystem::load_async(char type, const std::string &name, const std::string &file)
+{
+	// Repeat requests return the first handle, which is already watched
+	std::unordered_map<NameId, size_t, NameIdHash> &ids = type == 'm' ? mesh_ids : texture_ids;
+	bool requested = ids.count(NameId(name)) != 0;
+
+	AssetHandle handle = queue_load(type, name, file, nullptr);
+
+	if (watch_fd >= 0 && handle.type != 0 && !requested)
+	{
+		watched_files[watch(file)].push_back({handle, name});
+	}
+
+	return handle;
+}
+
+AssetHandle AssetSystem::queue_load(char type, const std::string &name, const std::string &filename, std::shared_ptr<AssetPacker::AssetFile> file)
+{
+	AssetHandle handle;
+
+	if (type != 'm' && type != 't')
+	{
+		std::cout << "Unknown asset type '" << type << "' for " << name << "\n";
+		return handle;
+	}
+
+	const char *type_name = type == 'm' ? "mesh" : "texture";
+	std::unordered_map<NameId, size_t, NameIdHash> &ids = type == 'm' ? mesh_ids : texture_ids;
+	std::vector<size_t> &free_slots = type == 'm' ? free_meshes : free_textures;
+
+	NameId name_id(name);
+	auto it = ids.find(name_id);
+	if (it != ids.end())
+	{
+		AssetHandle existing = slot_handle(type, it->second);
+
+		// Ids are only hashes, two names must never share one
+		if (residency(existing).name != name)
+		{
+			std::cout << "Hash collision between " << type_name << " " << name << " and " << residency(existing).name << ", " << name << " is not loaded\n";
+			return handle;
+		}
+
+		std::cout << "Name conflict with " << type_name << ": " << name << "\nUsing first instance encountered.\n";
+		return existing;
+	}
+
+	handle.type = type;
+
+	if (!free_slots.empty())
+	{
+		handle.id = free_slots.back();
+		free_slots.pop_back();
+	}
+	else if (type == 'm')
+	{
+		handle.id = meshes.size();
+		meshes.push_back(placeholder_mesh);
+		mesh_states.push_back(ASSET_UNLOADED);
+		mesh_residency.push_back({});
+	}
+	else
+	{
+		handle.id = textures.size();
+		textures.push_back(placeholder_texture);
+		texture_states.push_back(ASSET_UNLOADED);
+		texture_residency.push_back({});
+	}
+
+	if (type == 'm')
+	{
+		meshes[handle.id] = placeholder_mesh;
+		mesh_states[handle.id] = ASSET_LOADING;
+	}
+	else
+	{
+		textures[handle.id] = placeholder_texture;
+		texture_states[handle.id] = ASSET_LOADING;
+	}
+
+	ids[name_id] = handle.id;
+
+	Residency &r = residency(handle);
+	handle.generation = r.generation;
+	r.name = name;
+	r.filename = filename;
+	r.file = file;
+
+	start_load(handle, name, filename, file, false);
+
+	return handle;
+}
+
+void AssetSystem::start_load(AssetHandle handle, const std::string &name, const std::string &filename, std::shared_ptr<AssetPacker::AssetFile> file, bool reload, uint32_t bias)
+{
+	auto load = std::make_shared<PendingLoad>();
+	load->handle = handle;
+	load->name = name;
+	load->filename = filename;
+	load->file = file;
+	load->reload = reload;
+	load->bias = bias;
+	load->decoded = pool->submit([this, load]() {
+		return decode(*load);
+	});
+
+	loads.push_back(load);
+}
+
+// Runs on the pool
+bool AssetSystem::decode(PendingLoad &load)
+{
+	if (stopping)
+	{
+		return false;
+	}
+
+	// Loose files are read here, archive entries are already mapped
+	if (load.file == nullptr)
+	{
+		ProfileScope profile("io", load.name);
+		load.file = std::make_shared<AssetPacker::AssetFile>();
 
-			m_id_map[name] = meshes.size();
-			meshes.push_back(m);
+		if (!AssetPacker::load_file(load.filename, *load.file))
+		{
+			std::cout << "Failed to load " << (load.handle.type == 'm' ? "mesh" : "texture") << ": " << load.filename << "\n";
+			return false;
 		}
+	}
+
+	if (load.handle.type == 'm')
+	{
+		load.mesh = load_mesh(*load.file, load.name, load.staging, load.vertex_size);
+		load.size = load.staging.size;
+		return load.staging.data != nullptr;
+	}
+
+	load.first_level = load.bias;
+	if (!load_texture(*load.file, load.name, load.format, load.width, load.height, load.mip_levels, load.first_level, stream_textures && load.bias == 0, load.staging))
+	{
+		return false;
+	}
+
+	// A trimmed texture is an image of the remaining levels only
+	if (load.bias > 0)
+	{
+		if (load.bias >= load.mip_levels)
+		{
+			std::cout << "Texture " << load.name << " has too few mip levels to trim\n";
+			uploader->destroy_staging_buffer(load.staging);
+			load.staging = {};
+			return false;
+		}
+
+		load.width = std::max(1, load.width >> load.bias);
+		load.height = std::max(1, load.height >> load.bias);
+		load.mip_levels -= load.bias;
+		load.first_level = 0;
+	}
+
+	for (uint32_t i = load.first_level; i < load.mip_levels; i++)
+	{
+		load.size += AssetPacker::level_size(std::max(1, load.width >> i), std::max(1, load.height >> i), load.format);
+	}
+
+	return true;
+}
+
+// Uploads a decoded asset over its placeholder. Returns true for textures.
+bool AssetSystem::finish_load(PendingLoad &load, BaseEngine *engine)
+{
+	bool decoded = load.decoded.get();
+	size_t id = load.handle.id;
+
+	// The asset was unloaded while it decoded
+	if (!valid(load.handle))
+	{
+		engine->destroy_staging_buffer(load.staging);
+		return false;
+	}
+
+	Residency &r = residency(load.handle);
+	r.reloading = false;
+	r.trim_savings = 0;
+
+	// A failed reload leaves the asset as it was, unless it was evicted
+	if (load.handle.type == 'm')
+	{
+		if (!decoded)
+		{
+			if (!load.reload || mesh_states[id] == ASSET_EVICTED)
+			{
+				mesh_states[id] = ASSET_FAILED;
+			}
+			return false;
+		}
+
+		// Uploaded before the old mesh is retired, which keeps drawing until
+		// the new one is in
+		ProfileScope profile("upload", load.name);
+		if (!engine->upload_mesh(load.mesh, load.staging, load.vertex_size))
+		{
+			if (!load.reload || mesh_states[id] == ASSET_EVICTED)
+			{
+				mesh_states[id] = ASSET_FAILED;
+			}
+			return false;
+		}
+
+		engine->profile_upload(load.name, load.staging.size);
+		retire(load.handle, engine);
+
+		r.size = load.staging.size;
+		meshes[id] = std::move(load.mesh);
+		mesh_states[id] = ASSET_READY;
+		return false;
+	}
+
+	if (!decoded)
+	{
+		if (!load.reload || texture_states[id] == ASSET_EVICTED)
+		{
+			texture_states[id] = ASSET_FAILED;
+		}
+		return false;
+	}
+
+	retire(load.handle, engine);
+
+	ProfileScope profile("upload", load.name);
+	Texture t;
+	t.width = load.width;
+	t.height = load.height;
+	engine->upload_texture(t, load.staging, load.format, load.mip_levels, load.first_level);
+	engine->profile_upload(load.name, load.staging.size);
+
+	textures[id] = t;
+	texture_states[id] = ASSET_READY;
+	r.size = texture_size(t.width, t.height, t._format, t._mip_levels);
+	r.bias = load.bias;
+
+	if (load.first_level > 0)
+	{
+		TextureStream stream;
+		stream.texture_id = id;
+		stream.serial = next_stream_serial++;
+		stream.name = load.name;
+		stream.file = load.file;
+		stream.resident_level = load.first_level;
+		stream.levels.resize(load.first_level);
+		queue_stream(stream);
+		streams.push_back(std::move(stream));
+	}
+
+	return true;
+}
+
+void AssetSystem::unload(AssetHandle handle, BaseEngine *engine)
+{
+	if (!valid(handle))
+	{
+		return;
+	}
+
+	retire(handle, engine);
+
+	Residency &r = residency(handle);
+	if (handle.type == 'm')
+	{
+		mesh_ids.erase(NameId(r.name));
+		meshes[handle.id] = placeholder_mesh;
+		mesh_states[handle.id] = ASSET_UNLOADED;
+		free_meshes.push_back(handle.id);
+	}
+	else
+	{
+		texture_ids.erase(NameId(r.name));
+		textures[handle.id] = placeholder_texture;
+		texture_states[handle.id] = ASSET_UNLOADED;
+		free_textures.push_back(handle.id);
+	}
+
+	// A load still decoding sees the new generation and is dropped
+	uint32_t generation = r.generation + 1;
+	r = {};
+	r.generation = generation;
+}
+
+bool AssetSystem::valid(AssetHandle handle)
+{
+	if (handle.type == 'm' && handle.id < mesh_states.size())
+	{
+		return mesh_residency[handle.id].generation == handle.generation && mesh_states[handle.id] != ASSET_UNLOADED;
+	}
+	else if (handle.type == 't' && handle.id < texture_states.size())
+	{
+		return texture_residency[handle.id].generation == handle.generation && texture_states[handle.id] != ASSET_UNLOADED;
+	}
+
+	return false;
+}
+
+bool AssetSystem::ready(AssetHandle handle)
+{
+	if (!valid(handle))
+	{
+		return false;
+	}
+
+	return (handle.type == 'm' ? mesh_states[handle.id] : texture_states[handle.id]) == ASSET_READY;
+}
+
+void AssetSystem::acquire(AssetHandle handle)
+{
+	if (valid(handle))
+	{
+		residency(handle).refs++;
+	}
+}
+
+void AssetSystem::release(AssetHandle handle)
+{
+	if (!valid(handle))
+	{
+		return;
+	}
+
+	Residency &r = residency(handle);
+	if (r.refs > 0)
+	{
+		r.refs--;
+	}
+}
+
+void AssetSystem::touch(AssetHandle handle)
+{
+	if (valid(handle))
+	{
+		residency(handle).last_used = frame;
+	}
+}
+
+AssetSystem::Residency &AssetSystem::residency(AssetHandle handle)
+{
+	return handle.type == 'm' ? mesh_residency[handle.id] : texture_residency[handle.id];
+}
+
+AssetHandle AssetSystem::slot_handle(char type, size_t id)
+{
+	return {type, id, type == 'm' ? mesh_residency[id].generation : texture_residency[id].generation};
+}
+
+void AssetSystem::reload(AssetHandle handle, uint32_t bias)
+{
+	Residency &r = residency(handle);
+	r.reloading = true;
+	start_load(handle, r.name, r.filename, r.file, true, bias);
+}
+
+void AssetSystem::retire(AssetHandle handle, BaseEngine *engine)
+{
+	size_t id = handle.id;
+
+	// Frames in flight may still use the old resources
+	if (handle.type == 'm')
+	{
+		if (mesh_states[id] != ASSET_READY)
+		{
+			return;
+		}
+
+		Mesh old_mesh;
+		old_mesh._vertex_range = meshes[id]._vertex_range;
+		old_mesh._index_range = meshes[id]._index_range;
+		engine->destroy_later([=]() {
+			engine->destroy_mesh(old_mesh);
+		});
+		return;
+	}
+
+	if (texture_states[id] != ASSET_READY)
+	{
+		return;
+	}
+
+	// Levels still streaming belong to the old image
+	streams.erase(std::remove_if(streams.begin(), streams.end(), [=](const TextureStream &stream) {
+		return stream.texture_id == id;
+	}), streams.end());
+
+	Texture old_texture = textures[id];
+	VkDeviceSize size = texture_residency[id].size;
+	retiring_size += size;
+	engine->destroy_later([=]() {
+		engine->destroy_texture(old_texture);
+		retiring_size -= size;
+	});
+}
+
+bool AssetSystem::update_residency(BaseEngine *engine)
+{
+	VmaBudget budgets[VK_MAX_MEMORY_HEAPS];
+	vmaGetBudget(engine->_allocator, budgets);
+
+	VkDeviceSize usage = 0;
+	for (uint32_t i = 0; i < memory_properties.memoryHeapCount; i++)
+	{
+		if (memory_properties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+		{
+			usage += budgets[i].usage;
+		}
+	}
+
+	// Old copies are as good as freed, and so is what trims still loading
+	// will free, or they would be made up for twice
+	vram_usage = usage - std::min(usage, retiring_size);
+	VkDeviceSize expected_usage = vram_usage;
+	for (auto &r : texture_residency)
+	{
+		expected_usage -= std::min(expected_usage, r.trim_savings);
+	}
 
-		else if (type == "t")
+	if (vram_budget != 0 && expected_usage > vram_budget)
+	{
+		return free_memory(expected_usage - vram_budget, engine);
+	}
+
+	// Textures drawn since the last call come back, evicted ones first, as
+	// long as they fit below the restore limit
+	VkDeviceSize limit = vram_budget / 100 * RESTORE_BUDGET_PERCENT;
+	for (int pass = 0; pass < 2; pass++)
+	{
+		for (size_t id = 0; id < textures.size(); id++)
 		{
-			if (t_id_map.count(name) != 0)
+			Residency &r = texture_residency[id];
+			if (r.reloading || r.last_used + 1 < frame)
 			{
-				std::cout << "Name conflict with texture: " << name << "\nUsing first instance encountered.\n";
 				continue;
 			}
 
-			VkFormat f;
-			int w, h;
-			auto pixels = load_texture(file.c_str(), f, w, h);
-			
-			if (pixels == nullptr)
+			// Each level left out is about a quarter of the size
+			VkDeviceSize extra;
+			uint32_t bias;
+			if (pass == 0 && texture_states[id] == ASSET_EVICTED)
+			{
+				extra = r.size;
+				bias = r.bias;
+			}
+			else if (pass == 1 && texture_states[id] == ASSET_READY && r.bias > 0)
+			{
+				extra = (r.size << (2 * r.bias)) - r.size;
+				bias = 0;
+			}
+			else
 			{
 				continue;
 			}
 
-			Texture t;
-			t.width = w;
-			t.height = h;
-			engine->upload_texture(t, pixels, f);
+			if (vram_budget != 0 && expected_usage + extra >= limit)
+			{
+				continue;
+			}
 
-			t_id_map[name] = textures.size();
-			textures.push_back(t);
-		}	
+			reload(slot_handle('t', id), bias);
+			expected_usage += extra;
+		}
 	}
 
-	read_f.close();
+	return false;
+}
+
+bool AssetSystem::free_memory(VkDeviceSize excess, BaseEngine *engine)
+{
+	VkDeviceSize over = excess;
+	uint32_t trimmed_count = 0;
+	uint32_t evicted_count = 0;
+
+	// Least recently drawn first
+	std::vector<size_t> texture_order;
+	for (size_t i = 0; i < textures.size(); i++)
+	{
+		if (texture_states[i] == ASSET_READY && !texture_residency[i].reloading)
+		{
+			texture_order.push_back(i);
+		}
+	}
+
+	std::sort(texture_order.begin(), texture_order.end(), [&](size_t a, size_t b) {
+		return texture_residency[a].last_used < texture_residency[b].last_used;
+	});
+
+	// Dropping textures to the levels streaming keeps resident leaves
+	// everything drawable, so that goes first. The memory is only freed
+	// once the trimmed copy is loaded.
+	for (size_t i = 0; i < texture_order.size() && excess > 0; i++)
+	{
+		size_t id = texture_order[i];
+		const Texture &t = textures[id];
+		Residency &r = texture_residency[id];
+
+		uint32_t levels = 0;
+		while (levels + 1 < t._mip_levels && std::max(t.width >> levels, t.height >> levels) > STREAM_RESIDENT_SIZE)
+		{
+			levels++;
+		}
+
+		if (levels == 0)
+		{
+			continue;
+		}
+
+		VkDeviceSize trimmed_size = texture_size(std::max(1u, t.width >> levels), std::max(1u, t.height >> levels), t._format, t._mip_levels - levels);
+		VkDeviceSize savings = r.size - std::min(r.size, trimmed_size);
+		excess -= std::min(excess, savings);
+		reload(slot_handle('t', id), r.bias + levels);
+		r.trim_savings = savings;
+		trimmed_count++;
+	}
+
+	// Then textures nobody holds are evicted
+	for (size_t i = 0; i < texture_order.size() && excess > 0; i++)
+	{
+		size_t id = texture_order[i];
+		Residency &r = texture_residency[id];
+
+		if (r.refs > 0 || r.reloading)
+		{
+			continue;
+		}
+
+		retire(slot_handle('t', id), engine);
+		textures[id] = placeholder_texture;
+		texture_states[id] = ASSET_EVICTED;
+		excess -= std::min(excess, r.size);
+		evicted_count++;
+	}
+
+	// Meshes are not evicted, they live in the engine's mesh buffers whose
+	// memory stays allocated either way
+
+	if (trimmed_count > 0 || evicted_count > 0)
+	{
+		std::cout << "Over the video memory budget by " << over / (1024 * 1024) << " MB, trimming " << trimmed_count << " textures and evicting " << evicted_count << " more\n";
+	}
+
+	return evicted_count > 0;
 }
 
-void AssetSystem::destroy()
+bool AssetSystem::wait(AssetHandle handle, BaseEngine *engine)
 {
-	
+	for (size_t i = 0; i < loads.size(); i++)
+	{
+		const AssetHandle &pending = loads[i]->handle;
+		if (pending.type == handle.type && pending.id == handle.id && pending.generation == handle.generation)
+		{
+			std::shared_ptr<PendingLoad> load = loads[i];
+			loads.erase(loads.begin() + i);
+			finish_load(*load, engine);
+			break;
+		}
+	}
+
+	return ready(handle);
 }
 
-void AssetSystem::update_assets(std::string filename)
+void AssetSystem::wait_all(BaseEngine *engine)
 {
+	for (auto &load : loads)
+	{
+		finish_load(*load, engine);
+	}
+	loads.clear();
+}
 
+// Smallest on top, coarser first between levels of the same size
+bool AssetSystem::stream_level_after(const StreamLevel &a, const StreamLevel &b)
+{
+	if (a.size != b.size)
+	{
+		return a.size > b.size;
+	}
+	return a.level < b.level;
 }
 
-size_t AssetSystem::get_mesh_id(std::string mesh_name)
+void AssetSystem::queue_stream(TextureStream &stream)
 {
-	if (m_id_map.count(mesh_name) != 0)
+	const Texture &t = textures[stream.texture_id];
+
+	for (uint32_t level = 0; level < stream.resident_level; level++)
 	{
-		return m_id_map[mesh_name];
+		size_t size = AssetPacker::level_size(std::max(1u, t.width >> level), std::max(1u, t.height >> level), t._format);
+		pending_levels.push_back({stream.serial, level, size});
+		std::push_heap(pending_levels.begin(), pending_levels.end(), stream_level_after);
 	}
-	else
+}
+
+void AssetSystem::start_stream_levels()
+{
+	ThreadPool *workers = pool.get();
+
+	while (!pending_levels.empty() && running_levels < 2 * workers->size())
+	{
+		std::pop_heap(pending_levels.begin(), pending_levels.end(), stream_level_after);
+		StreamLevel pending = pending_levels.back();
+		pending_levels.pop_back();
+
+		// Streams are dropped when their texture is reloaded or unloaded
+		auto stream = std::find_if(streams.begin(), streams.end(), [&](const TextureStream &s) {
+			return s.serial == pending.stream_serial;
+		});
+		if (stream == streams.end() || stream->levels.empty() || pending.level >= stream->resident_level)
+		{
+			continue;
+		}
+
+		std::shared_ptr<AssetPacker::AssetFile> file = stream->file;
+		uint32_t level = pending.level;
+		size_t size = pending.size;
+
+		running_levels++;
+		stream->levels[level] = pool->submit([this, file, level, size, workers]() {
+			std::vector<char> pixels;
+
+			if (!stopping)
+			{
+				const AssetPacker::ChunkHeader *chunk = AssetPacker::find_chunk(*file, "MIPS", level);
+				if (chunk != nullptr && chunk->raw_size == size)
+				{
+					pixels.resize(size);
+					if (!AssetPacker::read_chunk(*file, *chunk, pixels.data(), workers))
+					{
+						pixels.clear();
+					}
+				}
+			}
+
+			running_levels--;
+			return pixels;
+		});
+	}
+}
+
+bool AssetSystem::update_loading(BaseEngine *engine)
+{
+	frame++;
+
+	bool changed = false;
+	size_t uploaded = 0;
+
+	// Assets in the order they were requested, as far as they have decoded
+	size_t remaining_loads = loads.size();
+	for (size_t i = 0; i < loads.size() && uploaded < UPLOAD_BUDGET;)
+	{
+		if (loads[i]->decoded.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+		{
+			i++;
+			continue;
+		}
+
+		std::shared_ptr<PendingLoad> load = loads[i];
+		loads.erase(loads.begin() + i);
+
+		uploaded += load->size;
+		changed = finish_load(*load, engine) || changed;
+	}
+
+	size_t remaining_streams = streams.size();
+	start_stream_levels();
+	for (auto &stream : streams)
+	{
+		// Levels go in finest last, each only once the coarser ones are in
+		while (stream.resident_level > 0 && !stream.levels.empty() && uploaded < UPLOAD_BUDGET)
+		{
+			uint32_t level = stream.resident_level - 1;
+			if (!stream.levels[level].valid() || stream.levels[level].wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+			{
+				break;
+			}
+
+			std::vector<char> pixels = stream.levels[level].get();
+			if (pixels.empty())
+			{
+				std::cout << "Failed to stream mip level " << level << " of texture: " << stream.name << "\n";
+				stream.levels.clear();
+				break;
+			}
+
+			engine->upload_texture_level(textures[stream.texture_id], pixels.data(), level);
+			engine->profile_upload(stream.name, pixels.size());
+			stream.resident_level = level;
+			uploaded += pixels.size();
+			changed = true;
+		}
+	}
+
+	streams.erase(std::remove_if(streams.begin(), streams.end(), [](const TextureStream &stream) {
+		return stream.resident_level == 0 || stream.levels.empty();
+	}), streams.end());
+
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - load_start;
+	if (remaining_loads > 0 && loads.empty())
 	{
-		std::cout << "Attempted to get id for mesh " << mesh_name << " which does not exist\n";
-		return (size_t)-1;
+		size_t ready_meshes = std::count(mesh_states.begin(), mesh_states.end(), ASSET_READY);
+		size_t ready_textures = std::count(texture_states.begin(), texture_states.end(), ASSET_READY);
+		std::cout << "Loaded " << ready_meshes << " meshes and " << ready_textures << " textures in " << elapsed.count() << " ms\n";
 	}
+
+	if (remaining_streams > 0 && streams.empty() && loads.empty())
+	{
+		std::cout << "Finished streaming textures in " << elapsed.count() << " ms\n";
+	}
+
+	changed = update_residency(engine) || changed;
+
+	return changed;
 }
 
-size_t AssetSystem::get_texture_id(std::string texture_name)
+bool AssetSystem::loading()
 {
-	if (t_id_map.count(texture_name) != 0)
+	return !loads.empty();
+}
+
+void AssetSystem::update_assets()
+{
+	if (watch_fd < 0)
 	{
-		return t_id_map[texture_name];
+		return;
+	}
+
+	// Writers may close a file more than once, each path is reloaded once
+	std::set<std::string> changed;
+
+	alignas(inotify_event) char buffer[4096];
+	ssize_t length;
+	while ((length = read(watch_fd, buffer, sizeof(buffer))) > 0)
+	{
+		for (char *p = buffer; p < buffer + length;)
+		{
+			const inotify_event *event = (const inotify_event*)p;
+
+			if (event->len > 0 && watch_dirs.count(event->wd) != 0)
+			{
+				changed.insert((std::filesystem::path(watch_dirs[event->wd]) / event->name).lexically_normal().string());
+			}
+
+			p += sizeof(inotify_event) + event->len;
+		}
+	}
+
+	for (auto &path : changed)
+	{
+		if (watched_files.count(path) != 0)
+		{
+			for (auto &asset : watched_files[path])
+			{
+				if (!valid(asset.handle))
+				{
+					continue;
+				}
+
+				std::cout << "Reloading " << asset.name << " from " << path << "\n";
+				reload(asset.handle, residency(asset.handle).bias);
+			}
+		}
+		else if (watched_archives.count(path) != 0)
+		{
+			reload_archive(watched_archives[path]);
+		}
+	}
+}
+
+std::string AssetSystem::watch(const std::string &filename)
+{
+	std::filesystem::path path = std::filesystem::path(filename).lexically_normal();
+	std::string dir = path.has_parent_path() ? path.parent_path().string() : ".";
+
+	// Packers that replace files by renaming show up as moves
+	int wd = inotify_add_watch(watch_fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+	if (wd < 0)
+	{
+		std::cout << "Failed to watch " << dir << "\n";
 	}
 	else
 	{
-		std::cout << "Attempted to get id for texture " << texture_name << " which does not exist\n";
-		return (size_t)-1;
+		watch_dirs[wd] = dir;
+	}
+
+	return (std::filesystem::path(dir) / path.filename()).lexically_normal().string();
+}
+
+void AssetSystem::reload_archive(size_t index)
+{
+	AssetPacker::Archive archive;
+	if (!AssetPacker::open_archive(archive_files[index], archive))
+	{
+		std::cout << "Failed to reopen archive: " << archive_files[index] << "\n";
+		return;
+	}
+
+	const AssetPacker::Archive &old_archive = archives[index];
+
+	// Only entries whose bytes changed are reloaded, new names are loaded
+	for (uint32_t i = 0; i < archive.header->entry_count; i++)
+	{
+		const AssetPacker::ArchiveEntry &entry = archive.entries[i];
+		std::string name = AssetPacker::entry_name(archive, entry);
+
+		if (entry.type != 'm' && entry.type != 't')
+		{
+			continue;
+		}
+
+		const AssetPacker::ArchiveEntry *old_entry = AssetPacker::find_entry(old_archive, entry.type, name);
+		if (old_entry != nullptr && old_entry->size == entry.size && memcmp(old_archive.data + old_entry->offset, archive.data + entry.offset, entry.size) == 0)
+		{
+			continue;
+		}
+
+		auto asset_file = std::make_shared<AssetPacker::AssetFile>();
+		if (!AssetPacker::open_entry(archive, entry, *asset_file))
+		{
+			continue;
+		}
+
+		std::unordered_map<NameId, size_t, NameIdHash> &ids = entry.type == 'm' ? mesh_ids : texture_ids;
+		auto it = ids.find(NameId(name));
+		if (it == ids.end())
+		{
+			queue_load(entry.type, name, archive_files[index], asset_file);
+			continue;
+		}
+
+		AssetHandle handle = slot_handle(entry.type, it->second);
+		residency(handle).file = asset_file;
+
+		std::cout << "Reloading " << name << " from " << archive_files[index] << "\n";
+		reload(handle, residency(handle).bias);
+	}
+
+	retired_archives.push_back(old_archive);
+	archives[index] = archive;
+}
+
+AssetHandle AssetSystem::get_mesh_id(NameId mesh_name)
+{
+	auto it = mesh_ids.find(mesh_name);
+	if (it == mesh_ids.end())
+	{
+		return {};
 	}
+
+	return slot_handle('m', it->second);
 }
 
-Mesh &AssetSystem::get_mesh(size_t mesh_id)
+AssetHandle AssetSystem::get_texture_id(NameId texture_name)
 {
-	return meshes[mesh_id];
+	auto it = texture_ids.find(texture_name);
+	if (it == texture_ids.end())
+	{
+		return {};
+	}
+
+	return slot_handle('t', it->second);
 }
 
-Texture &AssetSystem::get_texture(size_t texture_id)
+Mesh &AssetSystem::get_mesh(AssetHandle handle)
 {
-	return textures[texture_id];
+	if (!valid(handle) || handle.type != 'm')
+	{
+		return placeholder_mesh;
+	}
+
+	return meshes[handle.id];
 }
 
-Mesh AssetSystem::load_mesh(const char *filename)
+Texture &AssetSystem::get_texture(AssetHandle handle)
+{
+	if (!valid(handle) || handle.type != 't')
+	{
+		return placeholder_texture;
+	}
+
+	return textures[handle.id];
+}
+
+Mesh AssetSystem::load_mesh(const AssetPacker::AssetFile &m_data, const std::string &name, StagingBuffer &staging, VkDeviceSize &vertex_size)
 {
 	Mesh m;
-	AssetPacker::FileData m_data;
+	AssetPacker::MeshInfo info;
+
+	if (!AssetPacker::is_type(m_data, "MESH") || !AssetPacker::read_info(m_data, info))
+	{
+		std::cout << "Failed to load mesh: " << name << "\n";
+		return m;
+	}
+
+	const AssetPacker::ChunkHeader *vertex_chunk = AssetPacker::find_chunk(m_data, "VERT");
+	const AssetPacker::ChunkHeader *index_chunk = AssetPacker::find_chunk(m_data, "INDX");
+
+	size_t stride = 0;
+	if (info.vertex_layout == AssetPacker::VERTEX_LAYOUT_FULL)
+	{
+		stride = sizeof(Vertex);
+	}
+	else if (info.vertex_layout == AssetPacker::VERTEX_LAYOUT_COMPACT)
+	{
+		stride = sizeof(AssetPacker::CompactVertex);
+	}
+
+	bool valid_index_size = info.index_size == sizeof(uint16_t) || info.index_size == sizeof(uint32_t);
+
+	if (stride == 0 || !valid_index_size || info.vertex_count == 0 || info.index_count == 0 || info.vertex_size != stride || vertex_chunk == nullptr || index_chunk == nullptr ||
+		vertex_chunk->raw_size != (uint64_t)info.vertex_count * stride || index_chunk->raw_size != (uint64_t)info.index_count * info.index_size)
+	{
+		std::cout << "Mesh " << name << " does not match its header\n";
+		return m;
+	}
+
+	m._vertex_layout = (AssetPacker::VertexLayout)info.vertex_layout;
+	vertex_size = vertex_chunk->raw_size;
 
-	if (!AssetPacker::load_file(filename, m_data))
+	auto staging_start = std::chrono::steady_clock::now();
+	if (!uploader->create_staging_buffer(vertex_chunk->raw_size + index_chunk->raw_size, staging))
 	{
-		std::cout << "Failed to load mesh: " << filename << "\n";
+		std::cout << "Out of staging memory for mesh: " << name << "\n";
+		staging = {};
 		return m;
 	}
 
-	uint32_t num_verts = reinterpret_cast<uint32_t*>(m_data.metadata)[0];
-	uint32_t num_inds = reinterpret_cast<uint32_t*>(m_data.metadata)[1];
+	auto decode_start = std::chrono::steady_clock::now();
+	profiler::record("staging", name, staging_start, decode_start);
 
-	m._vertices.resize(num_verts);
-	m._indices.resize(num_inds);
+	bool decoded = AssetPacker::read_chunk(m_data, *vertex_chunk, staging.data, pool.get()) && AssetPacker::read_chunk(m_data, *index_chunk, staging.data + vertex_size, pool.get());
+	profiler::record("decode", name, decode_start, std::chrono::steady_clock::now());
+
+	if (!decoded)
+	{
+		std::cout << "Failed to load mesh: " << name << "\n";
+		uploader->destroy_staging_buffer(staging);
+		staging = {};
+		return m;
+	}
 
-	auto buf_size = sizeof(Vertex) * num_verts + sizeof(uint32_t) * num_inds;
-	char *buf = new char[buf_size];
-	LZ4_decompress_safe(m_data.data, buf, m_data.size, buf_size);
+	m._index_type = info.index_size == sizeof(uint16_t) ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
 
-	memcpy(m._vertices.data(), buf, sizeof(Vertex) * num_verts);
-	memcpy(m._indices.data(), buf + sizeof(Vertex) * num_verts, 4 * num_inds);
+	const AssetPacker::ChunkHeader *lod_chunk = AssetPacker::find_chunk(m_data, "LODS");
+	if (lod_chunk != nullptr)
+	{
+		size_t lod_count = lod_chunk->raw_size / sizeof(AssetPacker::MeshLod);
+		bool valid = lod_count > 0 && lod_count <= AssetPacker::MAX_MESH_LODS && lod_chunk->raw_size % sizeof(AssetPacker::MeshLod) == 0;
 
-	AssetPacker::close_file(m_data);
-	delete[] buf;
+		m._lods.resize(lod_count);
+		valid = valid && AssetPacker::read_chunk(m_data, *lod_chunk, m._lods.data());
+
+		for (auto &lod : m._lods)
+		{
+			valid = valid && (uint64_t)lod.first_index + lod.index_count <= info.index_count;
+		}
+
+		if (!valid)
+		{
+			std::cout << "Ignoring bad levels of detail of mesh: " << name << "\n";
+			m._lods.clear();
+		}
+	}
+
+	if (m._lods.empty())
+	{
+		m._lods.push_back({0, info.index_count, 0.0f, info.bounds});
+	}
+
+	m._index_count = m._lods[0].index_count;
+	m._bounds = info.bounds;
+
+	const AssetPacker::ChunkHeader *meshlet_chunk = AssetPacker::find_chunk(m_data, "MLET");
+	if (meshlet_chunk != nullptr)
+	{
+		m._meshlets.resize(meshlet_chunk->raw_size / sizeof(AssetPacker::Meshlet));
+
+		if (meshlet_chunk->raw_size % sizeof(AssetPacker::Meshlet) != 0 || !AssetPacker::read_chunk(m_data, *meshlet_chunk, m._meshlets.data()))
+		{
+			std::cout << "Ignoring bad meshlets of mesh: " << name << "\n";
+			m._meshlets.clear();
+		}
+	}
 
 	return m;
 }
 
-void *AssetSystem::load_texture(const char *filename, VkFormat &format, int &width, int &height)
+bool AssetSystem::load_texture(const AssetPacker::AssetFile &tex_data, const std::string &name, VkFormat &format, int &width, int &height, uint32_t &mip_levels, uint32_t &first_level, bool stream, StagingBuffer &staging)
 {
-	AssetPacker::FileData tex_data;
+	AssetPacker::TextureInfo info;
 
-	if (!AssetPacker::load_file(filename, tex_data))
+	if (!AssetPacker::is_type(tex_data, "TEXI") || !AssetPacker::read_info(tex_data, info))
 	{
-		std::cout << "Failed to load texture: " << filename << "\n";
-		return nullptr;
+		std::cout << "Failed to load texture: " << name << "\n";
+		return false;
 	}
 
-	width = reinterpret_cast<uint32_t*>(tex_data.metadata)[0];
-	height = reinterpret_cast<uint32_t*>(tex_data.metadata)[1];
-	int channels = reinterpret_cast<uint32_t*>(tex_data.metadata)[2];
-	format = (VkFormat)reinterpret_cast<uint32_t*>(tex_data.metadata)[3];
+	width = info.width;
+	height = info.height;
+	format = (VkFormat)info.format;
+	mip_levels = info.mip_levels;
 
-	auto pixels_size = width * height * 4;
-	void *pixel_ptr = (void*)(new char[pixels_size]);
+	if (width == 0 || height == 0 || mip_levels == 0 || mip_levels > AssetPacker::mip_level_count(width, height))
+	{
+		std::cout << "Texture " << name << " does not match its header\n";
+		return false;
+	}
 
-	LZ4_decompress_safe(tex_data.data, (char*)pixel_ptr, tex_data.size, pixels_size);
+	if (stream)
+	{
+		while (first_level + 1 < mip_levels && (uint32_t)std::max(width >> first_level, height >> first_level) > STREAM_RESIDENT_SIZE)
+		{
+			first_level++;
+		}
+	}
+
+	// Levels are decoded back to back, in the layout upload_texture expects.
+	// Large levels are split into blocks that the pool decodes in place.
+	size_t pixels_size = 0;
+	for (uint32_t i = first_level; i < mip_levels; i++)
+	{
+		pixels_size += AssetPacker::level_size(std::max(1, width >> i), std::max(1, height >> i), format);
+	}
+
+	auto staging_start = std::chrono::steady_clock::now();
+	if (!uploader->create_staging_buffer(pixels_size, staging))
+	{
+		std::cout << "Out of staging memory for texture: " << name << "\n";
+		staging = {};
+		return false;
+	}
+
+	auto decode_start = std::chrono::steady_clock::now();
+	profiler::record("staging", name, staging_start, decode_start);
+
+	size_t offset = 0;
+	for (uint32_t i = first_level; i < mip_levels; i++)
+	{
+		const AssetPacker::ChunkHeader *level = AssetPacker::find_chunk(tex_data, "MIPS", i);
+		size_t level_size = AssetPacker::level_size(std::max(1, width >> i), std::max(1, height >> i), format);
+
+		if (level == nullptr || level->raw_size != level_size || !AssetPacker::read_chunk(tex_data, *level, staging.data + offset, pool.get()))
+		{
+			std::cout << "Failed to load mip level " << i << " of texture: " << name << "\n";
+			uploader->destroy_staging_buffer(staging);
+			staging = {};
+			return false;
+		}
+
+		offset += level_size;
+	}
 
-	AssetPacker::close_file(tex_data);
+	profiler::record("decode", name, decode_start, std::chrono::steady_clock::now());
 
-	return pixel_ptr;
+	return true;
 }
@@ -4,33 +4,289 @@
 
 #include "mesh.h"
 #include "resource.h"
+#include "name_id.h"
+
+#include "asset_packer/archive.h"
+#include "thread_pool.h"
 
 #include <unordered_map>
+#include <memory>
 #include <vector>
 #include <string>
+#include <future>
+#include <atomic>
+#include <chrono>
 
 struct BaseEngine;
 
+// Largest mip level, in pixels on its longest side, loaded with the rest
+// of a texture when streaming
+const uint32_t STREAM_RESIDENT_SIZE = 256;
+// Bytes of loaded assets and streamed mip levels copied to the GPU per
+// frame. At least one is copied each frame whatever its size.
+const size_t UPLOAD_BUDGET = 32 * 1024 * 1024;
+// Evicted and trimmed textures only come back below this much of the video
+// memory budget, so they are not trimmed or evicted again straight away
+const uint32_t RESTORE_BUDGET_PERCENT = 90;
+
+enum AssetState
+{
+	ASSET_LOADING,
+	ASSET_READY,
+	ASSET_FAILED,
+	// Freed to stay within vram_budget, reloaded when next used
+	ASSET_EVICTED,
+	// Slot freed by unload, waiting to be reused
+	ASSET_UNLOADED
+};
+
+// Names a mesh ('m') or texture ('t') slot. Valid as soon as the asset is
+// requested; the slot holds a placeholder until the asset is ready. Slots
+// are reused after unload, generation tells the old handles apart.
+struct AssetHandle
+{
+	char type = 0;
+	size_t id = (size_t)-1;
+	uint32_t generation = 0;
+};
+
 class AssetSystem
 {
 public:
+	// Queues every asset of the list and returns without waiting for them
 	void init(std::string asset_list_name, BaseEngine *engine);
-	void destroy();
+	void destroy(BaseEngine *engine);
+
+	// Queues a reload of every asset whose packed file or archive changed
+	// since the last call. Reloads decode on the pool and keep their ids;
+	// update_loading swaps them in and retires the old GPU resources once
+	// no frame in flight uses them. Does nothing unless hot_reload was set.
+	void update_assets();
+
+	// Reads and decodes the asset on the pool. Requesting a name twice
+	// returns the first handle.
+	AssetHandle load_async(char type, const std::string &name, const std::string &file);
+
+	// Frees the asset and its slot. Handles to it stop being valid.
+	void unload(AssetHandle handle, BaseEngine *engine);
 
-	void update_assets(std::string filename);
+	// False for default handles and handles to unloaded assets
+	bool valid(AssetHandle handle);
+	bool ready(AssetHandle handle);
+	// Held assets are never evicted, only their textures' finer mip levels
+	void acquire(AssetHandle handle);
+	void release(AssetHandle handle);
+	// Marks an asset as drawn this frame. Call it from the draw path once a
+	// frame for each asset used. update_loading reloads evicted and trimmed
+	// assets drawn since its last call once they fit below
+	// RESTORE_BUDGET_PERCENT of vram_budget.
+	void touch(AssetHandle handle);
+	// Blocks until the asset is uploaded or has failed, returns true if it
+	// is ready. Main thread only, like update_loading.
+	bool wait(AssetHandle handle, BaseEngine *engine);
+	void wait_all(BaseEngine *engine);
 
-	size_t get_mesh_id(std::string mesh_name);
-	size_t get_texture_id(std::string texture_name);
+	// Uploads assets and streamed mip levels that have finished decoding,
+	// until UPLOAD_BUDGET bytes were copied this frame. Call once a frame
+	// after waiting on its fence. Returns true when a texture was replaced
+	// or gained a level, so descriptor sets holding textures need rewriting.
+	bool update_loading(BaseEngine *engine);
+	// True while assets are decoding or waiting to be uploaded
+	bool loading();
 
-	Mesh &get_mesh(size_t mesh_id);
-	Texture &get_texture(size_t texture_id);
+	// Set before init to load only the mip levels of at most
+	// STREAM_RESIDENT_SIZE pixels with each texture and stream the rest in
+	bool stream_textures = false;
+	// Set before init to watch the files assets were loaded from
+	bool hot_reload = false;
+	// Bytes of device local memory to stay within, 0 for no limit. Past it
+	// update_loading drops the finer mip levels of the least recently used
+	// textures, then evicts the least recently used textures nobody holds.
+	VkDeviceSize vram_budget = 0;
+	// Device local memory in use as of the last update_loading, less old
+	// copies waiting for frames in flight to finish with them
+	VkDeviceSize vram_usage = 0;
+
+	// Invalid handles for unknown names
+	AssetHandle get_mesh_id(NameId mesh_name);
+	AssetHandle get_texture_id(NameId texture_name);
+
+	// Invalid handles and evicted slots get the placeholder. Neither counts
+	// as a use, so writing descriptors never brings an asset back.
+	Mesh &get_mesh(AssetHandle handle);
+	Texture &get_texture(AssetHandle handle);
 
 private:
-	std::unordered_map<std::string, size_t> m_id_map;
-	std::unordered_map<std::string, size_t> t_id_map;
+	std::unordered_map<NameId, size_t, NameIdHash> mesh_ids;
+	std::unordered_map<NameId, size_t, NameIdHash> texture_ids;
 	std::vector<Mesh> meshes;
 	std::vector<Texture> textures;
+	std::vector<AssetState> mesh_states;
+	std::vector<AssetState> texture_states;
+
+	// What the residency manager knows of a mesh or texture slot
+	struct Residency
+	{
+		uint32_t refs = 0;
+		// update_loading call it was last used in
+		uint64_t last_used = 0;
+		// Device memory of the asset as last loaded
+		VkDeviceSize size = 0;
+		// Finest mip levels left out of a texture
+		uint32_t bias = 0;
+		bool reloading = false;
+		// Memory a trim still loading frees once it is in
+		VkDeviceSize trim_savings = 0;
+		// Bumped by unload
+		uint32_t generation = 0;
+		// Where to reload it from. file is only kept for archive entries,
+		// loose files are read again.
+		std::string name;
+		std::string filename;
+		std::shared_ptr<AssetPacker::AssetFile> file;
+	};
+
+	std::vector<Residency> mesh_residency;
+	std::vector<Residency> texture_residency;
+	// Unloaded slots
+	std::vector<size_t> free_meshes;
+	std::vector<size_t> free_textures;
+	uint64_t frame = 0;
+	VkPhysicalDeviceMemoryProperties memory_properties;
+	// Memory of retired textures still waiting in destroy_later
+	VkDeviceSize retiring_size = 0;
+
+	// Stand in for assets still loading. Meshes have no buffers and a
+	// single empty level of detail, textures are 1x1 white.
+	Mesh placeholder_mesh;
+	Texture placeholder_texture;
+
+	// Mapped for the lifetime of the asset system
+	std::vector<AssetPacker::Archive> archives;
+	std::vector<std::string> archive_files;
+	// Replaced by a reload. Jobs may still read them, so they are only
+	// closed by destroy.
+	std::vector<AssetPacker::Archive> retired_archives;
+
+	// Reads and decodes assets, the blocks of large chunks and streamed mip
+	// levels
+	std::unique_ptr<ThreadPool> pool;
+	// Creates the staging buffers loads decode into
+	BaseEngine *uploader = nullptr;
+
+	// An asset being decoded on the pool. The job fills in the fields below
+	// decoded, which the main thread reads once decoded is ready.
+	struct PendingLoad
+	{
+		AssetHandle handle;
+		std::string name;
+		std::string filename;
+		std::shared_ptr<AssetPacker::AssetFile> file;
+		std::future<bool> decoded;
+
+		Mesh mesh;
+		// Decoded straight from the file. Holds the mesh's vertices, the
+		// first vertex_size bytes, then its indices, or the texture's levels.
+		StagingBuffer staging;
+		VkDeviceSize vertex_size = 0;
+		VkFormat format;
+		int width;
+		int height;
+		uint32_t mip_levels;
+		uint32_t first_level = 0;
+		// Bytes to upload
+		size_t size = 0;
+		// Replaces a loaded asset, which is kept if this one fails
+		bool reload = false;
+		// Finest mip levels to leave out
+		uint32_t bias = 0;
+	};
+
+	std::vector<std::shared_ptr<PendingLoad>> loads;
+
+	// A texture whose finer mip levels are still on their way
+	struct TextureStream
+	{
+		size_t texture_id;
+		// Tells the stream apart from earlier ones of the same slot
+		uint64_t serial;
+		std::string name;
+		// Kept alive for the decoding jobs
+		std::shared_ptr<AssetPacker::AssetFile> file;
+		// Finest level in the image so far
+		uint32_t resident_level;
+		// Decoded pixels of each level below resident_level, empty on
+		// failure. Not valid until the level's decode has started.
+		std::vector<std::future<std::vector<char>>> levels;
+	};
+
+	std::vector<TextureStream> streams;
+	uint64_t next_stream_serial = 0;
+
+	// A streamed level waiting for a worker
+	struct StreamLevel
+	{
+		uint64_t stream_serial;
+		uint32_t level;
+		size_t size;
+	};
+
+	// Heap of the levels of every stream, smallest on top, so each texture
+	// sharpens a step before the largest levels take up the pool. Only
+	// enough are started to keep the pool busy each frame, so levels of textures that
+	// finish loading later still go ahead of larger ones queued earlier.
+	std::vector<StreamLevel> pending_levels;
+	std::atomic<uint32_t> running_levels{0};
+	static bool stream_level_after(const StreamLevel &a, const StreamLevel &b);
+	std::chrono::steady_clock::time_point load_start;
+	// Tells queued decoding jobs to give up
+	std::atomic<bool> stopping{false};
+
+	// An asset loaded from a loose file, reloaded when the file changes
+	struct WatchedAsset
+	{
+		AssetHandle handle;
+		std::string name;
+	};
+
+	// inotify instance, -1 when not watching
+	int watch_fd = -1;
+	// Watched directories by watch descriptor
+	std::unordered_map<int, std::string> watch_dirs;
+	// Keyed by normalized path
+	std::unordered_map<std::string, std::vector<WatchedAsset>> watched_files;
+	std::unordered_map<std::string, size_t> watched_archives;
+
+	AssetHandle queue_load(char type, const std::string &name, const std::string &filename, std::shared_ptr<AssetPacker::AssetFile> file);
+	void start_load(AssetHandle handle, const std::string &name, const std::string &filename, std::shared_ptr<AssetPacker::AssetFile> file, bool reload, uint32_t bias = 0);
+	// Reloads from the recorded source, with bias finest levels left out
+	void reload(AssetHandle handle, uint32_t bias);
+	Residency &residency(AssetHandle handle);
+	// Handle to whatever holds the slot now
+	AssetHandle slot_handle(char type, size_t id);
+	// Frees the resources of a ready asset once frames in flight are done
+	// with them
+	void retire(AssetHandle handle, BaseEngine *engine);
+	// Measures memory use and trims or evicts assets past vram_budget, or
+	// reloads those drawn again once there is room. Returns true if a
+	// texture was evicted.
+	bool update_residency(BaseEngine *engine);
+	// Trims, then evicts, the least recently drawn textures until excess
+	// bytes will have been freed. Returns true if a texture was evicted.
+	bool free_memory(VkDeviceSize excess, BaseEngine *engine);
+	// Watches the directory holding filename and returns the key the file
+	// is reported under
+	std::string watch(const std::string &filename);
+	void reload_archive(size_t index);
+	bool decode(PendingLoad &load);
+	bool finish_load(PendingLoad &load, BaseEngine *engine);
+	void queue_stream(TextureStream &stream);
+	// Starts decoding pending levels while workers are free
+	void start_stream_levels();
 
-	Mesh load_mesh(const char *filename);
-	void *load_texture(const char *filename, VkFormat &format, int &width, int &height);
+	// Both decode into a new staging buffer, left empty on failure
+	Mesh load_mesh(const AssetPacker::AssetFile &file, const std::string &name, StagingBuffer &staging, VkDeviceSize &vertex_size);
+	// Decodes levels first_level and up. With stream set, first_level is
+	// raised to the first level small enough to load now.
+	bool load_texture(const AssetPacker::AssetFile &file, const std::string &name, VkFormat &format, int &width, int &height, uint32_t &mip_levels, uint32_t &first_level, bool stream, StagingBuffer &staging);
 };
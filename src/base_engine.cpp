@@ -13,22 +13,35 @@
 #include <vma/vk_mem_alloc.h>
 
 #include <fstream>
+#include <algorithm>
 
 #include "asset_packer/asset_packer.h"
 #include <lz4.h>
 
 #include "pipeline_builder.h"
+#include "profiler.h"
 
 void BaseEngine::cleanup()
 {
-	// Wait for current frame to finish
-	vkWaitForFences(_device, 1, &_render_fences[(_frame_number-1) % FRAME_OVERLAP], true, 1000000000);
+	// Wait for every frame in flight to finish. The fences start signaled,
+	// so this also holds if no frame was drawn.
+	vkWaitForFences(_device, FRAME_OVERLAP, _render_fences, true, 1000000000);
+	wait_uploads();
+
+	for (auto &deletor : _retired_deletors)
+	{
+		deletor.second();
+	}
+	_retired_deletors.clear();
 
 	// Delete vulkan objects
 	_swapchain_deletion_queue.flush();
 	_material_system.destroy(this);
+	_asset_system.destroy(this);
 	_main_deletion_queue.flush();
 
+	profiler::write_reports("startup_profile");
+
 	// Finish cleaning up vulkan/SDL
 	vkDestroySurfaceKHR(_instance, _surface, nullptr);
 	vkDestroyDevice(_device, nullptr);
@@ -64,8 +77,25 @@ bool BaseEngine::start_draw(uint32_t *frame_index, uint32_t *swapchain_image_ind
 	*frame_index = _frame_number % FRAME_OVERLAP;
 
 	VK_CHECK(vkWaitForFences(_device, 1, &_render_fences[*frame_index], true, UINT64_MAX));
+
+	// Startup ends with the first frame drawn after every asset is in
+	if (profiler::recording() && !_asset_system.loading())
+	{
+		profiler::stop();
+	}
 	VK_CHECK(vkResetFences(_device, 1, &_render_fences[*frame_index]));
 
+	// The GPU is done with what this frame pushed last time round
+	_frame_data_head = *frame_index * FRAME_DATA_SIZE;
+	_frame_data_end = _frame_data_head + FRAME_DATA_SIZE;
+
+	// Every frame before the one this fence belonged to has finished too
+	while (!_retired_deletors.empty() && _retired_deletors.front().first + (int)FRAME_OVERLAP <= _frame_number)
+	{
+		_retired_deletors.front().second();
+		_retired_deletors.pop_front();
+	}
+
 	VkResult result = vkAcquireNextImageKHR(_device, _swapchain, UINT64_MAX, _present_semaphores[*frame_index], nullptr, swapchain_image_index);
 
 	// If swapchain is out of date, resize window
@@ -101,6 +131,9 @@ void BaseEngine::end_draw(uint32_t frame_index, uint32_t swapchain_image_index,
 {
 	VK_CHECK(vkEndCommandBuffer(cmd));
 
+	// Uploads recorded this frame go first
+	flush_uploads();
+
 	VkSubmitInfo submit = {};
 	submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 	submit.pNext = nullptr;
@@ -146,6 +179,8 @@ void BaseEngine::end_draw(uint32_t frame_index, uint32_t swapchain_image_index,
 
 void BaseEngine::init_sdl(std::string window_name)
 {
+	ProfileScope profile("init", "init_sdl");
+
 	SDL_Init(SDL_INIT_VIDEO);
 
 	SDL_WindowFlags window_flags = (SDL_WindowFlags)(SDL_WINDOW_VULKAN);
@@ -155,6 +190,8 @@ void BaseEngine::init_sdl(std::string window_name)
 
 void BaseEngine::init_vulkan(std::string app_name, bool validation_layers)
 {
+	ProfileScope profile("init", "init_vulkan");
+
 	// Create Instance
 	vkb::InstanceBuilder builder;
 
@@ -171,10 +208,15 @@ void BaseEngine::init_vulkan(std::string app_name, bool validation_layers)
 	SDL_Vulkan_CreateSurface(_window, _instance, &_surface);
 
 	// Select physical device
+	// Packed textures are BC compressed
+	VkPhysicalDeviceFeatures required_features = {};
+	required_features.textureCompressionBC = VK_TRUE;
+
 	vkb::PhysicalDeviceSelector selector {vkb_inst};
 	vkb::PhysicalDevice physical_device = selector
 		.set_minimum_version(1, 2)
 		.set_surface(_surface)
+		.set_required_features(required_features)
 		.select()
 		.value();
 
@@ -189,6 +231,22 @@ void BaseEngine::init_vulkan(std::string app_name, bool validation_layers)
 	_graphics_queue = vkb_device.get_queue(vkb::QueueType::graphics).value();
 	_graphics_queue_family = vkb_device.get_queue_index(vkb::QueueType::graphics).value();
 
+	// Uploads go through a transfer only queue when there is one, so they
+	// can run alongside rendering
+	auto transfer_queue = vkb_device.get_dedicated_queue(vkb::QueueType::transfer);
+	if (transfer_queue.has_value())
+	{
+		_transfer_queue = transfer_queue.value();
+		_transfer_queue_family = vkb_device.get_dedicated_queue_index(vkb::QueueType::transfer).value();
+		_dedicated_transfer = true;
+	}
+	else
+	{
+		_transfer_queue = _graphics_queue;
+		_transfer_queue_family = _graphics_queue_family;
+		_dedicated_transfer = false;
+	}
+
 	_gpu_properties = vkb_device.physical_device.properties;
 
 	// Create memory allocator
@@ -205,6 +263,8 @@ void BaseEngine::init_vulkan(std::string app_name, bool validation_layers)
 
 void BaseEngine::init_swapchain()
 {
+	ProfileScope profile("init", "init_swapchain");
+
 	// Initialize swapchain
 	vkb::SwapchainBuilder swapchain_builder{_chosen_gpu, _device, _surface};
 
@@ -255,6 +315,8 @@ void BaseEngine::init_swapchain()
 
 void BaseEngine::init_commands()
 {
+	ProfileScope profile("init", "init_commands");
+
 	// Create main command pool and allocate buffers
 	VkCommandPoolCreateInfo command_pool_info = infos::command_pool_create_info(_graphics_queue_family, VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
 
@@ -279,10 +341,85 @@ void BaseEngine::init_commands()
 
 	VkCommandBufferAllocateInfo cmd_alloc_info = infos::command_buffer_allocate_info(_upload_command_pool, 1);
 	VK_CHECK(vkAllocateCommandBuffers(_device, &cmd_alloc_info, &_upload_command_buffer));
+
+	// Create command pools for batched uploads
+	for (int i = 0; i < UPLOAD_BATCHES; i++)
+	{
+		UploadBatch &batch = _upload_batches[i];
+
+		VkCommandPoolCreateInfo transfer_pool_info = infos::command_pool_create_info(_transfer_queue_family);
+		VK_CHECK(vkCreateCommandPool(_device, &transfer_pool_info, nullptr, &batch.transfer_pool));
+		cmd_alloc_info = infos::command_buffer_allocate_info(batch.transfer_pool, 1);
+		VK_CHECK(vkAllocateCommandBuffers(_device, &cmd_alloc_info, &batch.transfer_cmd));
+
+		VK_CHECK(vkCreateCommandPool(_device, &upload_command_pool_info, nullptr, &batch.graphics_pool));
+		cmd_alloc_info = infos::command_buffer_allocate_info(batch.graphics_pool, 1);
+		VK_CHECK(vkAllocateCommandBuffers(_device, &cmd_alloc_info, &batch.graphics_cmd));
+
+		_main_deletion_queue.push_function([=]() {
+			vkDestroyCommandPool(_device, _upload_batches[i].transfer_pool, nullptr);
+			vkDestroyCommandPool(_device, _upload_batches[i].graphics_pool, nullptr);
+		});
+	}
+
+	// Create staging ring. Offsets into it suit any copy, including ones
+	// into block compressed images.
+	_staging_ring = create_buffer(STAGING_RING_SIZE, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+	_staging_alignment = std::max<VkDeviceSize>(16, _gpu_properties.limits.optimalBufferCopyOffsetAlignment);
+
+	void *data;
+	vmaMapMemory(_allocator, _staging_ring._allocation, &data);
+	_staging_data = (char*)data;
+
+	_main_deletion_queue.push_function([=]() {
+		vmaUnmapMemory(_allocator, _staging_ring._allocation);
+		vmaDestroyBuffer(_allocator, _staging_ring._buffer, _staging_ring._allocation);
+	});
+
+	// Create the buffers meshes are uploaded into
+	_mesh_vertex_buffer = create_buffer(MESH_VERTEX_BUFFER_SIZE, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+	_mesh_index_buffer = create_buffer(MESH_INDEX_BUFFER_SIZE, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+	_mesh_vertices.init(MESH_VERTEX_BUFFER_SIZE);
+	_mesh_indices.init(MESH_INDEX_BUFFER_SIZE);
+
+	_main_deletion_queue.push_function([=]() {
+		vmaDestroyBuffer(_allocator, _mesh_vertex_buffer._buffer, _mesh_vertex_buffer._allocation);
+		vmaDestroyBuffer(_allocator, _mesh_index_buffer._buffer, _mesh_index_buffer._allocation);
+	});
+
+	// Create the buffer per frame data is pushed into. Device local host
+	// visible memory saves the GPU reading it over the bus; coherent memory
+	// saves flushing it.
+	VkBufferCreateInfo frame_buffer_info = {};
+	frame_buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	frame_buffer_info.pNext = nullptr;
+	frame_buffer_info.size = FRAME_DATA_SIZE * FRAME_OVERLAP;
+	frame_buffer_info.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+
+	VmaAllocationCreateInfo frame_alloc_info = {};
+	frame_alloc_info.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
+	frame_alloc_info.requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+	frame_alloc_info.preferredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+	frame_alloc_info.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+	VmaAllocationInfo frame_allocation;
+	VK_CHECK(vmaCreateBuffer(_allocator, &frame_buffer_info, &frame_alloc_info, &_frame_buffer._buffer, &_frame_buffer._allocation, &frame_allocation));
+	_frame_buffer._buffer_info = {};
+	_frame_buffer._buffer_info.buffer = _frame_buffer._buffer;
+	_frame_buffer._buffer_info.offset = 0;
+	_frame_buffer._buffer_info.range = FRAME_DATA_SIZE * FRAME_OVERLAP;
+	_frame_data = (char*)frame_allocation.pMappedData;
+	_frame_data_alignment = std::max(_gpu_properties.limits.minUniformBufferOffsetAlignment, _gpu_properties.limits.minStorageBufferOffsetAlignment);
+
+	_main_deletion_queue.push_function([=]() {
+		vmaDestroyBuffer(_allocator, _frame_buffer._buffer, _frame_buffer._allocation);
+	});
 }
 
 void BaseEngine::init_sync_structures()
 {
+	ProfileScope profile("init", "init_sync_structures");
+
 	// Create fences and semaphores
 	VkFenceCreateInfo fence_info = infos::fence_create_info(VK_FENCE_CREATE_SIGNALED_BIT);
 	VkSemaphoreCreateInfo semaphore_info = infos::semaphore_create_info();
@@ -310,15 +447,29 @@ void BaseEngine::init_sync_structures()
 	_main_deletion_queue.push_function([=]() {
 		vkDestroyFence(_device, _upload_fence, nullptr);
 	});
+
+	for (int i = 0; i < UPLOAD_BATCHES; i++)
+	{
+		VK_CHECK(vkCreateFence(_device, &upload_fence_create_info, nullptr, &_upload_batches[i].fence));
+		VK_CHECK(vkCreateSemaphore(_device, &semaphore_info, nullptr, &_upload_batches[i].transferred));
+
+		_main_deletion_queue.push_function([=]() {
+			vkDestroyFence(_device, _upload_batches[i].fence, nullptr);
+			vkDestroySemaphore(_device, _upload_batches[i].transferred, nullptr);
+		});
+	}
 }
 
 void BaseEngine::init_descriptor_pool()
 {
+	ProfileScope profile("init", "init_descriptor_pool");
+
 	// Create main descriptor pool
 	std::vector<VkDescriptorPoolSize> sizes = {
 		{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1000},
 		{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1000},
 		{VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1000},
+		{VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 1000},
 		{VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1000}
 	};
 
@@ -338,6 +489,8 @@ void BaseEngine::init_descriptor_pool()
 
 void BaseEngine::init_imgui(VkRenderPass render_pass)
 {
+	ProfileScope profile("init", "init_imgui");
+
 	// Setup imgui for use with vulkan
 	VkDescriptorPoolSize pool_sizes[] = {
 		{VK_DESCRIPTOR_TYPE_SAMPLER, 1000},
@@ -467,7 +620,7 @@ VkPipeline BaseEngine::create_pipeline(const PipelineInfo &info, VkPipelineLayou
 
 	pipeline_builder._vertex_input_info = infos::vertex_input_state_create_info();
 	pipeline_builder._input_assembly = infos::input_assembly_create_info(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
-	VertexInputDescription vertex_description = Vertex::get_vertex_description();
+	VertexInputDescription vertex_description = Vertex::get_vertex_description(info.vertex_layout);
 
 	if (!(info.flags & PIPELINE_INFO_NO_VERTICES))
 	{
@@ -696,198 +849,652 @@ Texture BaseEngine::create_texture(size_t width, size_t height, size_t pixel_siz
 	return texture;
 }
 
-void BaseEngine::upload_texture(Texture &tex, void *pixel_ptr, VkFormat format)
+void BaseEngine::upload_texture(Texture &tex, void *pixel_ptr, VkFormat format, uint32_t mip_levels, uint32_t first_level)
 {
-	/*// Load in texture
-	AssetPacker::FileData tex_data;
-	AssetPacker::load_file(file, tex_data);
-	int width = reinterpret_cast<uint32_t*>(tex_data.metadata)[0];
-	int height = reinterpret_cast<uint32_t*>(tex_data.metadata)[1];
-	int channels = reinterpret_cast<uint32_t*>(tex_data.metadata)[2];
+	// Stage every mip level from first_level on
+	VkDeviceSize image_size = 0;
+	for (uint32_t i = first_level; i < mip_levels; i++)
+	{
+		image_size += AssetPacker::level_size(std::max(1u, tex.width >> i), std::max(1u, tex.height >> i), format);
+	}
+	StagedData staged = stage(pixel_ptr, image_size);
 
-	auto pixels_size = width * height * 4;
-	void *pixel_ptr = (void*)(new char[pixels_size]);
+	delete[] (char*)pixel_ptr;
 
-	LZ4_decompress_safe(tex_data.data, (char*)pixel_ptr, tex_data.size, pixels_size);
+	upload_texture(tex, staged, format, mip_levels, first_level);
+}
 
-	AssetPacker::close_file(tex_data);*/
+void BaseEngine::upload_texture(Texture &tex, const StagingBuffer &staging, VkFormat format, uint32_t mip_levels, uint32_t first_level)
+{
+	upload_texture(tex, take_staging(staging), format, mip_levels, first_level);
+}
 
+void BaseEngine::upload_texture(Texture &tex, StagedData staged, VkFormat format, uint32_t mip_levels, uint32_t first_level)
+{
 	int width = tex.width;
 	int height = tex.height;
-
-	// Create staging buffer
-	VkDeviceSize image_size = width * height * 4;
 	VkFormat image_format = format;
-	Buffer staging_buffer = create_buffer(image_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
 
-	// Copy data to staging buffer
-	void *data;
-	vmaMapMemory(_allocator, staging_buffer._allocation, &data);
-	memcpy(data, pixel_ptr, static_cast<size_t>(image_size));
-	vmaUnmapMemory(_allocator, staging_buffer._allocation);
+	// One copy region per mip level, packed back to back in the buffer
+	std::vector<VkBufferImageCopy> copy_regions(mip_levels - first_level);
+	VkDeviceSize offset = staged.offset;
+	for (uint32_t i = first_level; i < mip_levels; i++)
+	{
+		uint32_t mip_width = std::max(1, width >> i);
+		uint32_t mip_height = std::max(1, height >> i);
+
+		VkBufferImageCopy &region = copy_regions[i - first_level];
+		region = {};
+		region.bufferOffset = offset;
+		region.bufferRowLength = 0;
+		region.bufferImageHeight = 0;
+		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		region.imageSubresource.mipLevel = i;
+		region.imageSubresource.baseArrayLayer = 0;
+		region.imageSubresource.layerCount = 1;
+		region.imageExtent = {mip_width, mip_height, 1};
+
+		offset += AssetPacker::level_size(mip_width, mip_height, format);
+	}
 
-	delete[] (char*)pixel_ptr;
+	// Create texture
+	tex = create_texture(width, height, 4, image_format, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY, VK_IMAGE_ASPECT_COLOR_BIT, VK_FILTER_LINEAR, mip_levels);
+
+	VkCommandBuffer cmd = upload_cmd();
+
+	// Transition layout into DST_OPTIMAL and copy from staging buffer
+	// to texture
+	VkImageSubresourceRange range;
+	range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	range.baseMipLevel = 0;
+	range.levelCount = tex._mip_levels;
+	range.baseArrayLayer = 0;
+	range.layerCount = 1;
+
+	VkImageMemoryBarrier image_barrier_to_transfer = {};
+	image_barrier_to_transfer.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	image_barrier_to_transfer.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	image_barrier_to_transfer.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	image_barrier_to_transfer.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	image_barrier_to_transfer.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	image_barrier_to_transfer.image = tex._image;
+	image_barrier_to_transfer.subresourceRange = range;
+	image_barrier_to_transfer.srcAccessMask = 0;
+	image_barrier_to_transfer.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &image_barrier_to_transfer);
+
+	vkCmdCopyBufferToImage(cmd, staged.buffer, tex._image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, (uint32_t)copy_regions.size(), copy_regions.data());
+
+	// Transition all levels to SHADER_READ_ONLY_OPTIMAL, including any
+	// not uploaded yet, so the whole view is in the layout descriptors
+	// expect. Those stay with the transfer queue for upload_texture_level.
+	if (first_level > 0)
+	{
+		VkImageMemoryBarrier image_barrier_to_streamed = image_barrier_to_transfer;
+		image_barrier_to_streamed.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		image_barrier_to_streamed.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		image_barrier_to_streamed.subresourceRange.levelCount = first_level;
+		image_barrier_to_streamed.srcAccessMask = 0;
+		image_barrier_to_streamed.dstAccessMask = 0;
+
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &image_barrier_to_streamed);
+	}
 
-	VkExtent3D image_extent;
-	image_extent.width = width;
-	image_extent.height = height;
-	image_extent.depth = 1;
+	VkImageMemoryBarrier image_barrier_to_readable = image_barrier_to_transfer;
+	image_barrier_to_readable.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	image_barrier_to_readable.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	image_barrier_to_readable.subresourceRange.baseMipLevel = first_level;
+	image_barrier_to_readable.subresourceRange.levelCount = mip_levels - first_level;
+	image_barrier_to_readable.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	image_barrier_to_readable.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
 
-	// Calculate mip levels
-	uint32_t mip_levels = (uint32_t)std::floor(std::log2(std::max(width, height))) + 1;
+	finish_upload(0, nullptr, 1, &image_barrier_to_readable, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
 
-	// Create texture
-	tex = create_texture(width, height, 4, image_format, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_GPU_ONLY, VK_IMAGE_ASPECT_COLOR_BIT, VK_FILTER_LINEAR, mip_levels);
+	// Levels above first_level hold garbage until streamed in, the sampler
+	// keeps them from being read
+	if (first_level > 0)
+	{
+		vkDestroySampler(_device, tex._image_info.sampler, nullptr);
+		tex._image_info.sampler = min_lod_sampler(first_level);
+	}
 
-	immediate_submit([&](VkCommandBuffer cmd) {
-		// Transition layout into DST_OPTIMAL and copy from staging buffer
-		// to texture
-		VkImageSubresourceRange range;
-		range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		range.baseMipLevel = 0;
-		range.levelCount = tex._mip_levels;
-		range.baseArrayLayer = 0;
-		range.layerCount = 1;
-
-		VkImageMemoryBarrier image_barrier_to_transfer = {};
-		image_barrier_to_transfer.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-		image_barrier_to_transfer.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-		image_barrier_to_transfer.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-		image_barrier_to_transfer.image = tex._image;
-		image_barrier_to_transfer.subresourceRange = range;
-		image_barrier_to_transfer.srcAccessMask = 0;
-		image_barrier_to_transfer.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-
-		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &image_barrier_to_transfer);
-
-		VkBufferImageCopy copy_region = {};
-		copy_region.bufferOffset = 0;
-		copy_region.bufferRowLength = 0;
-		copy_region.bufferImageHeight = 0;
-		copy_region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		copy_region.imageSubresource.mipLevel = 0;
-		copy_region.imageSubresource.baseArrayLayer = 0;
-		copy_region.imageSubresource.layerCount = 1;
-		copy_region.imageExtent = image_extent;
-
-		vkCmdCopyBufferToImage(cmd, staging_buffer._buffer, tex._image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy_region);
-
-		// Setup barrier for generating mipmaps
-		VkImageMemoryBarrier mip_barrier = {};
-		mip_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-		mip_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-		mip_barrier.image = tex._image;
-		mip_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-		mip_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-		mip_barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		mip_barrier.subresourceRange.baseArrayLayer = 0;
-		mip_barrier.subresourceRange.layerCount = 1;
-		mip_barrier.subresourceRange.levelCount = 1;
-
-		uint32_t mip_width = width;
-		uint32_t mip_height = height;
-
-		for (int i = 1; i < tex._mip_levels; i++)
+	//return tex;
+}
+
+void BaseEngine::upload_texture_level(Texture &tex, const void *pixel_ptr, uint32_t level)
+{
+	uint32_t mip_width = std::max(1u, tex.width >> level);
+	uint32_t mip_height = std::max(1u, tex.height >> level);
+	VkDeviceSize level_size = AssetPacker::level_size(mip_width, mip_height, tex._format);
+
+	StagedData staged = stage(pixel_ptr, level_size);
+
+	VkBufferImageCopy region = {};
+	region.bufferOffset = staged.offset;
+	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	region.imageSubresource.mipLevel = level;
+	region.imageSubresource.baseArrayLayer = 0;
+	region.imageSubresource.layerCount = 1;
+	region.imageExtent = {mip_width, mip_height, 1};
+
+	VkCommandBuffer cmd = upload_cmd();
+
+	// Frames in flight may be sampling the coarser levels, but never
+	// this one, so only this level changes layout
+	VkImageSubresourceRange range;
+	range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	range.baseMipLevel = level;
+	range.levelCount = 1;
+	range.baseArrayLayer = 0;
+	range.layerCount = 1;
+
+	VkImageMemoryBarrier image_barrier_to_transfer = {};
+	image_barrier_to_transfer.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	image_barrier_to_transfer.oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	image_barrier_to_transfer.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	image_barrier_to_transfer.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	image_barrier_to_transfer.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	image_barrier_to_transfer.image = tex._image;
+	image_barrier_to_transfer.subresourceRange = range;
+	image_barrier_to_transfer.srcAccessMask = 0;
+	image_barrier_to_transfer.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &image_barrier_to_transfer);
+
+	vkCmdCopyBufferToImage(cmd, staged.buffer, tex._image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+	VkImageMemoryBarrier image_barrier_to_readable = image_barrier_to_transfer;
+	image_barrier_to_readable.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	image_barrier_to_readable.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	image_barrier_to_readable.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	image_barrier_to_readable.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+	finish_upload(0, nullptr, 1, &image_barrier_to_readable, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+
+	tex._image_info.sampler = min_lod_sampler(level);
+}
+
+VkSampler BaseEngine::min_lod_sampler(uint32_t level)
+{
+	if (level >= _min_lod_samplers.size())
+	{
+		_min_lod_samplers.resize(level + 1, VK_NULL_HANDLE);
+	}
+
+	if (_min_lod_samplers[level] == VK_NULL_HANDLE)
+	{
+		// Same settings as the samplers create_texture makes
+		VkSamplerCreateInfo sampler_info = infos::sampler_create_info(VK_FILTER_LINEAR);
+		sampler_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+		sampler_info.minLod = (float)level;
+		sampler_info.maxLod = VK_LOD_CLAMP_NONE;
+		VK_CHECK(vkCreateSampler(_device, &sampler_info, nullptr, &_min_lod_samplers[level]));
+
+		VkSampler sampler = _min_lod_samplers[level];
+		_main_deletion_queue.push_function([=]() {
+			vkDestroySampler(_device, sampler, nullptr);
+		});
+	}
+
+	return _min_lod_samplers[level];
+}
+
+bool BaseEngine::upload_mesh(Mesh &mesh)
+{
+	if (!allocate_mesh(mesh, mesh._vertices.size(), mesh._indices.size()))
+	{
+		return false;
+	}
+
+	// Copy vertices and indices through the staging ring
+	upload_buffer(_mesh_vertex_buffer._buffer, mesh._vertex_range.offset, mesh._vertices.data(), mesh._vertex_range.size, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT);
+	upload_buffer(_mesh_index_buffer._buffer, mesh._index_range.offset, mesh._indices.data(), mesh._index_range.size, VK_ACCESS_INDEX_READ_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT);
+
+	return true;
+}
+
+bool BaseEngine::upload_mesh(Mesh &mesh, const StagingBuffer &staging, VkDeviceSize vertex_size)
+{
+	StagedData staged = take_staging(staging);
+
+	if (!allocate_mesh(mesh, vertex_size, staging.size - vertex_size))
+	{
+		return false;
+	}
+
+	StagedData staged_indices = staged;
+	staged_indices.offset += vertex_size;
+
+	upload_buffer(_mesh_vertex_buffer._buffer, mesh._vertex_range.offset, staged, mesh._vertex_range.size, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT);
+	upload_buffer(_mesh_index_buffer._buffer, mesh._index_range.offset, staged_indices, mesh._index_range.size, VK_ACCESS_INDEX_READ_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT);
+
+	return true;
+}
+
+bool BaseEngine::allocate_mesh(Mesh &mesh, VkDeviceSize buffer_size, VkDeviceSize i_buffer_size)
+{
+	// vertexOffset and firstIndex count whole vertices and indices, so the
+	// ranges start on multiples of their sizes
+	VkDeviceSize stride = mesh._vertex_layout == AssetPacker::VERTEX_LAYOUT_COMPACT ? sizeof(AssetPacker::CompactVertex) : sizeof(Vertex);
+	VkDeviceSize index_size = mesh._index_type == VK_INDEX_TYPE_UINT16 ? 2 : 4;
+
+	if (!_mesh_vertices.allocate(buffer_size, stride, &mesh._vertex_range))
+	{
+		std::cout << "Out of space for " << buffer_size << " bytes of vertices, " << _mesh_vertices._used << " of " << _mesh_vertices._size << " used\n";
+		return false;
+	}
+
+	if (!_mesh_indices.allocate(i_buffer_size, index_size, &mesh._index_range))
+	{
+		std::cout << "Out of space for " << i_buffer_size << " bytes of indices, " << _mesh_indices._used << " of " << _mesh_indices._size << " used\n";
+		_mesh_vertices.free(mesh._vertex_range);
+		mesh._vertex_range = {};
+		return false;
+	}
+
+	mesh._vertex_offset = (int32_t)(mesh._vertex_range.offset / stride);
+	mesh._first_index = (uint32_t)(mesh._index_range.offset / index_size);
+
+	return true;
+}
+
+void BaseEngine::bind_mesh_buffers(VkCommandBuffer cmd, VkIndexType index_type)
+{
+	VkDeviceSize offset = 0;
+	vkCmdBindVertexBuffers(cmd, 0, 1, &_mesh_vertex_buffer._buffer, &offset);
+	vkCmdBindIndexBuffer(cmd, _mesh_index_buffer._buffer, 0, index_type);
+}
+
+void BaseEngine::destroy_mesh(const Mesh &mesh)
+{
+	_mesh_vertices.free(mesh._vertex_range);
+	_mesh_indices.free(mesh._index_range);
+}
+
+void BaseEngine::destroy_texture(const Texture &tex)
+{
+	// Samplers from min_lod_sampler are shared
+	if (std::find(_min_lod_samplers.begin(), _min_lod_samplers.end(), tex._image_info.sampler) == _min_lod_samplers.end())
+	{
+		vkDestroySampler(_device, tex._image_info.sampler, nullptr);
+	}
+
+	vkDestroyImageView(_device, tex._image_view, nullptr);
+	vmaDestroyImage(_allocator, tex._image, tex._allocation);
+}
+
+void BaseEngine::destroy_later(std::function<void()> &&function)
+{
+	_retired_deletors.push_back({_frame_number, std::move(function)});
+}
+
+void BaseEngine::upload_buffer(VkBuffer dst, VkDeviceSize dst_offset, const void *data, VkDeviceSize size, VkAccessFlags dst_access, VkPipelineStageFlags dst_stage)
+{
+	// Staging may submit the current batch to make room, so the copy is
+	// recorded after it
+	upload_buffer(dst, dst_offset, stage(data, size), size, dst_access, dst_stage);
+}
+
+void BaseEngine::upload_buffer(VkBuffer dst, VkDeviceSize dst_offset, StagedData staged, VkDeviceSize size, VkAccessFlags dst_access, VkPipelineStageFlags dst_stage)
+{
+	VkCommandBuffer cmd = upload_cmd();
+
+	VkBufferCopy copy;
+	copy.srcOffset = staged.offset;
+	copy.dstOffset = dst_offset;
+	copy.size = size;
+	vkCmdCopyBuffer(cmd, staged.buffer, dst, 1, &copy);
+
+	VkBufferMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = dst_access;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.buffer = dst;
+	barrier.offset = dst_offset;
+	barrier.size = size;
+
+	finish_upload(1, &barrier, 0, nullptr, dst_stage);
+}
+
+StagedData BaseEngine::stage(const void *data, VkDeviceSize size)
+{
+	StagedData staged;
+
+	if (size > STAGING_RING_SIZE)
+	{
+		StagingBuffer staging;
+		if (!create_staging_buffer(size, staging))
 		{
-			// Transfer one level into SRC_OPTIMAL
-			mip_barrier.subresourceRange.baseMipLevel = i-1;
-			mip_barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-			mip_barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-			mip_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-			mip_barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-
-			vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &mip_barrier);
-
-			// Copy from one layer to the next, with linear filtering
-			VkImageBlit blit = {};
-			blit.srcOffsets[0] = {0, 0, 0};
-			blit.srcOffsets[1] = {(int32_t)mip_width, (int32_t)mip_height, 1};
-			blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-			blit.srcSubresource.mipLevel = i - 1;
-			blit.srcSubresource.baseArrayLayer = 0;
-			blit.srcSubresource.layerCount = 1;
-			blit.dstOffsets[0] = {0, 0, 0};
-			blit.dstOffsets[1] = {(int)mip_width > 1 ? (int)mip_width / 2 : 1, (int)mip_height > 1 ? (int)mip_height / 2 : 1, 1};
-			blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-			blit.dstSubresource.mipLevel = i;
-			blit.dstSubresource.baseArrayLayer = 0;
-			blit.dstSubresource.layerCount = 1;
-
-			vkCmdBlitImage(cmd, tex._image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, tex._image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
-
-			// Transition level to SHADER_READ_ONLY_OPTIMAL
-			mip_barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-			mip_barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-			mip_barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-			mip_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-			vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &mip_barrier);
-
-			mip_width = std::max(1, (int)mip_width / 2);
-			mip_height = std::max(1, (int)mip_height / 2);
+			std::cout << "Failed to allocate " << size << " bytes of staging memory\n";
+			abort();
 		}
 
-		// Transfer lowest mip level to SHADER_READ_ONLY_OPTIMAL
-		mip_barrier.subresourceRange.baseMipLevel = tex._mip_levels - 1;
-		mip_barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-		mip_barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-		mip_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-		mip_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		memcpy(staging.data, data, size);
+		return take_staging(staging);
+	}
 
-		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &mip_barrier);
-	});
+	for (;;)
+	{
+		VkDeviceSize offset = (_staging_head + _staging_alignment - 1) / _staging_alignment * _staging_alignment;
+		bool fits;
 
-	_main_deletion_queue.push_function([=]() {
-		vkDestroySampler(_device, tex._image_info.sampler, nullptr);
-		vkDestroyImageView(_device, tex._image_view, nullptr);
-		vmaDestroyImage(_allocator, tex._image, tex._allocation);
-	});
+		// Free space is after the head up to the end and before the tail, or
+		// between the head and the tail once wrapped. The head never catches
+		// up with the tail, so equal means empty.
+		if (_staging_head >= _staging_tail)
+		{
+			if (offset + size > STAGING_RING_SIZE)
+			{
+				offset = 0;
+				fits = size < _staging_tail;
+			}
+			else
+			{
+				fits = true;
+			}
+		}
+		else
+		{
+			fits = offset + size < _staging_tail;
+		}
 
-	vmaDestroyBuffer(_allocator, staging_buffer._buffer, staging_buffer._allocation);
+		if (fits)
+		{
+			upload_cmd();
+			memcpy(_staging_data + offset, data, size);
+			_staging_head = offset + size;
 
-	//return tex;
+			staged.buffer = _staging_ring._buffer;
+			staged.offset = offset;
+			return staged;
+		}
+
+		// Make room by waiting for the oldest batch, submitting this one if
+		// it is the only one holding staging memory
+		bool retired = false;
+		for (uint32_t i = 1; i < UPLOAD_BATCHES && !retired; i++)
+		{
+			UploadBatch &batch = _upload_batches[(_upload_batch + i) % UPLOAD_BATCHES];
+			if (batch.in_flight)
+			{
+				retire_batch(batch);
+				retired = true;
+			}
+		}
+
+		if (!retired)
+		{
+			flush_uploads();
+		}
+	}
 }
 
-void BaseEngine::upload_mesh(Mesh &mesh)
+bool BaseEngine::create_staging_buffer(VkDeviceSize size, StagingBuffer &staging)
 {
-	// Create staging buffers for vertex and index buffers
-	const size_t buffer_size = mesh._vertices.size() * sizeof(Vertex);
-	const size_t i_buffer_size = mesh._indices.size() * sizeof(uint32_t);
-	Buffer staging_buffer = create_buffer(buffer_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
-	Buffer i_staging_buffer = create_buffer(i_buffer_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+	VkBufferCreateInfo buffer_info = {};
+	buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	buffer_info.pNext = nullptr;
+	buffer_info.size = size;
+	buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
 
-	// Copy data to staging buffers
-	void *data;
-	vmaMapMemory(_allocator, staging_buffer._allocation, &data);
-	memcpy(data, mesh._vertices.data(), buffer_size);
-	vmaUnmapMemory(_allocator, staging_buffer._allocation);
-
-	vmaMapMemory(_allocator, i_staging_buffer._allocation, &data);
-	memcpy(data, mesh._indices.data(), i_buffer_size);
-	vmaUnmapMemory(_allocator, i_staging_buffer._allocation);
-
-	// Create buffers
-	mesh._vertex_buffer = create_buffer(buffer_size, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
-	mesh._index_buffer = create_buffer(i_buffer_size, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
-
-	// Copy staging buffers to vertex and index buffers
-	immediate_submit([=](VkCommandBuffer cmd) {
-		VkBufferCopy copy;
-		copy.dstOffset = 0;
-		copy.srcOffset = 0;
-		copy.size = buffer_size;
-		vkCmdCopyBuffer(cmd, staging_buffer._buffer, mesh._vertex_buffer._buffer, 1, &copy);
-		copy.size = i_buffer_size;
-		vkCmdCopyBuffer(cmd, i_staging_buffer._buffer, mesh._index_buffer._buffer, 1, &copy);
-	});
+	// LZ4 reads back what it has already written, which is very slow from
+	// uncached write combined memory
+	VmaAllocationCreateInfo vma_alloc_info = {};
+	vma_alloc_info.usage = VMA_MEMORY_USAGE_CPU_ONLY;
+	vma_alloc_info.preferredFlags = VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+	vma_alloc_info.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
 
-	_main_deletion_queue.push_function([=]() {
-		vmaDestroyBuffer(_allocator, mesh._vertex_buffer._buffer, mesh._vertex_buffer._allocation);
-		vmaDestroyBuffer(_allocator, mesh._index_buffer._buffer, mesh._index_buffer._allocation);
-	});
+	VmaAllocationInfo allocation_info;
+	if (vmaCreateBuffer(_allocator, &buffer_info, &vma_alloc_info, &staging.buffer._buffer, &staging.buffer._allocation, &allocation_info) != VK_SUCCESS)
+	{
+		return false;
+	}
+
+	staging.buffer._buffer_info = {};
+	staging.buffer._buffer_info.buffer = staging.buffer._buffer;
+	staging.buffer._buffer_info.offset = 0;
+	staging.buffer._buffer_info.range = size;
+	staging.data = (char*)allocation_info.pMappedData;
+	staging.size = size;
 
-	vmaDestroyBuffer(_allocator, staging_buffer._buffer, staging_buffer._allocation);
-	vmaDestroyBuffer(_allocator, i_staging_buffer._buffer, i_staging_buffer._allocation);
+	return true;
+}
+
+void BaseEngine::destroy_staging_buffer(const StagingBuffer &staging)
+{
+	if (staging.data == nullptr)
+	{
+		return;
+	}
+
+	vmaDestroyBuffer(_allocator, staging.buffer._buffer, staging.buffer._allocation);
+}
+
+StagedData BaseEngine::take_staging(const StagingBuffer &staging)
+{
+	upload_cmd();
+	_upload_batches[_upload_batch].overflow.push_back(staging.buffer);
+
+	StagedData staged;
+	staged.buffer = staging.buffer._buffer;
+	staged.offset = 0;
+	return staged;
+}
+
+void BaseEngine::profile_upload(const std::string &asset, VkDeviceSize size)
+{
+	if (profiler::recording())
+	{
+		upload_cmd();
+		_upload_batches[_upload_batch].profiled_uploads.push_back({asset, size});
+	}
+}
+
+VkCommandBuffer BaseEngine::upload_cmd()
+{
+	UploadBatch &batch = _upload_batches[_upload_batch];
+
+	if (!batch.recording)
+	{
+		VkCommandBufferBeginInfo cmd_begin_info = infos::command_buffer_begin_info(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+		VK_CHECK(vkBeginCommandBuffer(batch.transfer_cmd, &cmd_begin_info));
+
+		if (_dedicated_transfer)
+		{
+			VK_CHECK(vkBeginCommandBuffer(batch.graphics_cmd, &cmd_begin_info));
+		}
+
+		batch.recording = true;
+	}
+
+	return batch.transfer_cmd;
+}
+
+void BaseEngine::finish_upload(uint32_t buffer_count, const VkBufferMemoryBarrier *buffer_barriers, uint32_t image_count, const VkImageMemoryBarrier *image_barriers, VkPipelineStageFlags dst_stage)
+{
+	UploadBatch &batch = _upload_batches[_upload_batch];
+
+	if (!_dedicated_transfer)
+	{
+		vkCmdPipelineBarrier(batch.transfer_cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, dst_stage, 0, 0, nullptr, buffer_count, buffer_barriers, image_count, image_barriers);
+		return;
+	}
+
+	// The transfer queue releases the resources and the graphics queue
+	// acquires them with matching barriers. Access masks only apply on the
+	// side of the queue that does the access.
+	std::vector<VkBufferMemoryBarrier> buffer_release(buffer_barriers, buffer_barriers + buffer_count);
+	std::vector<VkImageMemoryBarrier> image_release(image_barriers, image_barriers + image_count);
+
+	for (auto &barrier : buffer_release)
+	{
+		barrier.srcQueueFamilyIndex = _transfer_queue_family;
+		barrier.dstQueueFamilyIndex = _graphics_queue_family;
+		barrier.dstAccessMask = 0;
+	}
+
+	for (auto &barrier : image_release)
+	{
+		barrier.srcQueueFamilyIndex = _transfer_queue_family;
+		barrier.dstQueueFamilyIndex = _graphics_queue_family;
+		barrier.dstAccessMask = 0;
+	}
+
+	vkCmdPipelineBarrier(batch.transfer_cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, (uint32_t)buffer_release.size(), buffer_release.data(), (uint32_t)image_release.size(), image_release.data());
+
+	std::vector<VkBufferMemoryBarrier> buffer_acquire(buffer_barriers, buffer_barriers + buffer_count);
+	std::vector<VkImageMemoryBarrier> image_acquire(image_barriers, image_barriers + image_count);
+
+	for (auto &barrier : buffer_acquire)
+	{
+		barrier.srcQueueFamilyIndex = _transfer_queue_family;
+		barrier.dstQueueFamilyIndex = _graphics_queue_family;
+		barrier.srcAccessMask = 0;
+	}
+
+	for (auto &barrier : image_acquire)
+	{
+		barrier.srcQueueFamilyIndex = _transfer_queue_family;
+		barrier.dstQueueFamilyIndex = _graphics_queue_family;
+		barrier.srcAccessMask = 0;
+	}
+
+	// The submission waits on the transfer's semaphore before this runs
+	vkCmdPipelineBarrier(batch.graphics_cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, dst_stage, 0, 0, nullptr, (uint32_t)buffer_acquire.size(), buffer_acquire.data(), (uint32_t)image_acquire.size(), image_acquire.data());
+}
+
+void BaseEngine::flush_uploads()
+{
+	UploadBatch &batch = _upload_batches[_upload_batch];
+
+	if (!batch.recording)
+	{
+		return;
+	}
+
+	VK_CHECK(vkEndCommandBuffer(batch.transfer_cmd));
+	VkSubmitInfo submit = infos::submit_info(&batch.transfer_cmd);
+
+	if (_dedicated_transfer)
+	{
+		VK_CHECK(vkEndCommandBuffer(batch.graphics_cmd));
+
+		submit.signalSemaphoreCount = 1;
+		submit.pSignalSemaphores = &batch.transferred;
+		VK_CHECK(vkQueueSubmit(_transfer_queue, 1, &submit, VK_NULL_HANDLE));
+
+		// Anything submitted to the graphics queue later sees the uploads
+		VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+		VkSubmitInfo acquire_submit = infos::submit_info(&batch.graphics_cmd);
+		acquire_submit.waitSemaphoreCount = 1;
+		acquire_submit.pWaitSemaphores = &batch.transferred;
+		acquire_submit.pWaitDstStageMask = &wait_stage;
+		VK_CHECK(vkQueueSubmit(_graphics_queue, 1, &acquire_submit, batch.fence));
+	}
+	else
+	{
+		VK_CHECK(vkQueueSubmit(_transfer_queue, 1, &submit, batch.fence));
+	}
+
+	batch.staging_end = _staging_head;
+	batch.recording = false;
+	batch.in_flight = true;
+
+	// Free the staging memory of batches that already finished, oldest first
+	for (uint32_t i = 1; i < UPLOAD_BATCHES; i++)
+	{
+		UploadBatch &old_batch = _upload_batches[(_upload_batch + i) % UPLOAD_BATCHES];
+		if (!old_batch.in_flight)
+		{
+			continue;
+		}
+
+		if (vkGetFenceStatus(_device, old_batch.fence) != VK_SUCCESS)
+		{
+			break;
+		}
+
+		retire_batch(old_batch);
+	}
+
+	// The next batch is the oldest, wait for it if it is still in flight
+	_upload_batch = (_upload_batch + 1) % UPLOAD_BATCHES;
+	if (_upload_batches[_upload_batch].in_flight)
+	{
+		retire_batch(_upload_batches[_upload_batch]);
+	}
+}
+
+void BaseEngine::wait_uploads()
+{
+	flush_uploads();
+
+	for (uint32_t i = 0; i < UPLOAD_BATCHES; i++)
+	{
+		UploadBatch &batch = _upload_batches[(_upload_batch + i) % UPLOAD_BATCHES];
+		if (batch.in_flight)
+		{
+			retire_batch(batch);
+		}
+	}
+}
+
+void BaseEngine::retire_batch(UploadBatch &batch)
+{
+	auto wait_start = std::chrono::steady_clock::now();
+	VK_CHECK(vkWaitForFences(_device, 1, &batch.fence, true, UINT64_MAX));
+	auto wait_end = std::chrono::steady_clock::now();
+	VK_CHECK(vkResetFences(_device, 1, &batch.fence));
+
+	if (profiler::recording())
+	{
+		VkDeviceSize total = 0;
+		for (auto &upload : batch.profiled_uploads)
+		{
+			total += upload.second;
+		}
+
+		// Split the wait into consecutive spans, one per asset
+		if (total == 0)
+		{
+			profiler::record("gpu_wait", "upload batch", wait_start, wait_end);
+		}
+
+		auto at = [&](VkDeviceSize bytes) {
+			return wait_start + std::chrono::duration_cast<std::chrono::steady_clock::duration>((wait_end - wait_start) * ((double)bytes / total));
+		};
+
+		VkDeviceSize done = 0;
+		for (auto &upload : batch.profiled_uploads)
+		{
+			auto begin = at(done);
+			done += upload.second;
+			profiler::record("upload_wait", upload.first, begin, at(done));
+		}
+	}
+	batch.profiled_uploads.clear();
+	VK_CHECK(vkResetCommandPool(_device, batch.transfer_pool, 0));
+	VK_CHECK(vkResetCommandPool(_device, batch.graphics_pool, 0));
+
+	for (auto &buffer : batch.overflow)
+	{
+		vmaDestroyBuffer(_allocator, buffer._buffer, buffer._allocation);
+	}
+	batch.overflow.clear();
+
+	// Batches retire in the order they were submitted, so the tail moves
+	// past this one's data
+	_staging_tail = batch.staging_end;
+	if (_staging_tail == _staging_head)
+	{
+		_staging_head = 0;
+		_staging_tail = 0;
+	}
+
+	batch.in_flight = false;
 }
 
 Mesh BaseEngine::load_mesh(std::string filename)
@@ -899,6 +1506,82 @@ Mesh BaseEngine::load_mesh(std::string filename)
 	return m;
 }
 
+uint32_t BaseEngine::frame_slot(NameId label)
+{
+	for (uint32_t i = 0; i < _frame_slot_count; i++)
+	{
+		if (_frame_labels[i] == label)
+		{
+			return i;
+		}
+	}
+
+	if (_frame_slot_count == MAX_FRAME_SLOTS)
+	{
+		std::cout << "More than MAX_FRAME_SLOTS labels of frame data\n";
+		abort();
+	}
+
+	_frame_labels[_frame_slot_count] = label;
+	_frame_pushed[_frame_slot_count] = -1;
+	return _frame_slot_count++;
+}
+
+char *BaseEngine::allocate_frame_data(uint32_t slot, VkDeviceSize size)
+{
+	VkDeviceSize offset = (_frame_data_head + _frame_data_alignment - 1) / _frame_data_alignment * _frame_data_alignment;
+	if (offset + size > _frame_data_end)
+	{
+		std::cout << "Frame data of " << size << " bytes does not fit in FRAME_DATA_SIZE\n";
+		abort();
+	}
+
+	_frame_data_head = offset + size;
+	_frame_offsets[slot] = (uint32_t)offset;
+	_frame_pushed[slot] = _frame_number;
+	return _frame_data + offset;
+}
+
+void BaseEngine::push_frame_data(uint32_t slot, const void *data, VkDeviceSize size)
+{
+	memcpy(allocate_frame_data(slot, size), data, size);
+}
+
+VkDescriptorBufferInfo BaseEngine::frame_buffer_info(VkDeviceSize range)
+{
+	VkDescriptorBufferInfo info = {};
+	info.buffer = _frame_buffer._buffer;
+	info.offset = 0;
+	info.range = range;
+	return info;
+}
+
+void BaseEngine::bind_descriptor_set(VkCommandBuffer cmd, VkPipelineLayout layout, VkDescriptorSet set, const std::vector<uint32_t> &dynamic_slots)
+{
+	if (dynamic_slots.size() > MAX_DYNAMIC_OFFSETS)
+	{
+		std::cout << "Descriptor set has " << dynamic_slots.size() << " dynamic descriptors, more than MAX_DYNAMIC_OFFSETS\n";
+		abort();
+	}
+
+	uint32_t offsets[MAX_DYNAMIC_OFFSETS];
+	for (size_t i = 0; i < dynamic_slots.size(); i++)
+	{
+		uint32_t slot = dynamic_slots[i];
+
+		// Any other offset would read data of another frame
+		if (_frame_pushed[slot] != _frame_number)
+		{
+			std::cout << "Frame data " << slot << " was not pushed before binding a set that reads it\n";
+			abort();
+		}
+
+		offsets[i] = _frame_offsets[slot];
+	}
+
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 0, 1, &set, (uint32_t)dynamic_slots.size(), offsets);
+}
+
 void BaseEngine::immediate_submit(std::function<void(VkCommandBuffer cmd)> &&function)
 {
 	// Get and begin command buffer
@@ -914,7 +1597,10 @@ void BaseEngine::immediate_submit(std::function<void(VkCommandBuffer cmd)> &&fun
 	VkSubmitInfo submit = infos::submit_info(&cmd);
 	VK_CHECK(vkQueueSubmit(_graphics_queue, 1, &submit, _upload_fence));
 
-	vkWaitForFences(_device, 1, &_upload_fence, true, 9999999999);
+	{
+		ProfileScope profile("gpu_wait", "immediate_submit");
+		vkWaitForFences(_device, 1, &_upload_fence, true, 9999999999);
+	}
 	vkResetFences(_device, 1, &_upload_fence);
 	vkResetCommandPool(_device, _upload_command_pool, 0);
 }
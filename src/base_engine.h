@@ -6,6 +6,7 @@
 #include <deque>
 
 #include "resource.h"
+#include "buffer_arena.h"
 #include "mesh.h"
 #include "deletion_queue.h"
 #include "asset_system.h"
@@ -27,6 +28,54 @@
 //Number of frames in flight at once
 const uint32_t FRAME_OVERLAP = 2;
 
+// Size of the staging ring uploads are copied through. Anything larger gets
+// a staging buffer of its own.
+const VkDeviceSize STAGING_RING_SIZE = 64 * 1024 * 1024;
+// Upload submissions that can be in flight before flush_uploads waits
+const uint32_t UPLOAD_BATCHES = 3;
+
+// Sizes of the vertex and index buffers every mesh is suballocated from
+const VkDeviceSize MESH_VERTEX_BUFFER_SIZE = 128 * 1024 * 1024;
+const VkDeviceSize MESH_INDEX_BUFFER_SIZE = 64 * 1024 * 1024;
+
+// Bytes of uniform and storage data each frame in flight can push
+const VkDeviceSize FRAME_DATA_SIZE = 4 * 1024 * 1024;
+// Labels of frame data an engine can use
+const uint32_t MAX_FRAME_SLOTS = 32;
+// Dynamic descriptors a set bound by bind_descriptor_set can hold
+const uint32_t MAX_DYNAMIC_OFFSETS = 16;
+
+// Where stage put a copy of the data
+struct StagedData
+{
+	VkBuffer buffer;
+	VkDeviceSize offset;
+};
+
+// Every copy recorded between two calls to flush_uploads, submitted together
+struct UploadBatch
+{
+	VkCommandPool transfer_pool;
+	VkCommandBuffer transfer_cmd;
+	// Acquires what transfer_cmd released to the graphics queue. Only used
+	// with a dedicated transfer queue.
+	VkCommandPool graphics_pool;
+	VkCommandBuffer graphics_cmd;
+	VkSemaphore transferred;
+	VkFence fence;
+
+	bool recording = false;
+	bool in_flight = false;
+	// Staging ring offset just past this batch's data
+	VkDeviceSize staging_end = 0;
+	// Staging buffers of uploads too large for the ring, and those handed
+	// over by take_staging
+	std::vector<Buffer> overflow;
+	// Assets and their bytes from profile_upload, which share the wait for
+	// the fence by size
+	std::vector<std::pair<std::string, VkDeviceSize>> profiled_uploads;
+};
+
 // Includes a set of helper functions to make setup
 // easier when starting a new project
 class BaseEngine
@@ -63,13 +112,92 @@ public:
 	VkShaderModule load_shader(std::string filename);
 	Buffer create_buffer(size_t alloc_size, VkBufferUsageFlags usage, VmaMemoryUsage memory_usage);
 	Texture create_texture(size_t width, size_t height, size_t pixel_size, VkFormat format, VkImageUsageFlags usage, VmaMemoryUsage memory_usage, VkImageAspectFlags aspect, VkFilter filter = VK_FILTER_NEAREST, uint32_t mip_levels = 1);
-	void upload_texture(Texture &tex, void *pixel_ptr, VkFormat format);
-	void upload_mesh(Mesh &mesh);
+	// pixel_ptr holds levels first_level and up, back to back. Any finer
+	// levels are left for upload_texture_level, and sampling is clamped to
+	// first_level until they arrive.
+	void upload_texture(Texture &tex, void *pixel_ptr, VkFormat format, uint32_t mip_levels, uint32_t first_level = 0);
+	// Same with the levels already in staging, which is taken over
+	void upload_texture(Texture &tex, const StagingBuffer &staging, VkFormat format, uint32_t mip_levels, uint32_t first_level = 0);
+	void upload_texture(Texture &tex, StagedData staged, VkFormat format, uint32_t mip_levels, uint32_t first_level);
+	// Copies one more level into a texture and lowers its sampler's min LOD
+	// to it. Descriptor sets holding the texture must be rewritten to see it.
+	void upload_texture_level(Texture &tex, const void *pixel_ptr, uint32_t level);
+	// Shared linear sampler that never reads levels below level
+	VkSampler min_lod_sampler(uint32_t level);
+	// Copies the mesh into _mesh_vertex_buffer and _mesh_index_buffer.
+	// Returns false if either has no room left.
+	bool upload_mesh(Mesh &mesh);
+	// Same with the first vertex_size bytes of staging holding the vertices
+	// and the rest the indices. staging is taken over, even on failure.
+	bool upload_mesh(Mesh &mesh, const StagingBuffer &staging, VkDeviceSize vertex_size);
+	// Takes ranges of the shared mesh buffers and sets the mesh's offsets
+	bool allocate_mesh(Mesh &mesh, VkDeviceSize vertex_size, VkDeviceSize index_size);
+	// Binds the shared mesh buffers, indexed by index_type
+	void bind_mesh_buffers(VkCommandBuffer cmd, VkIndexType index_type);
+	// Free what upload_mesh and upload_texture created. Whoever uploaded a
+	// resource destroys it, through destroy_later while frames may use it.
+	void destroy_mesh(const Mesh &mesh);
+	void destroy_texture(const Texture &tex);
+	// Runs function once every frame recorded so far has finished
+	void destroy_later(std::function<void()> &&function);
+	// Copies data into dst at dst_offset, which is read at dst_stage afterwards
+	void upload_buffer(VkBuffer dst, VkDeviceSize dst_offset, const void *data, VkDeviceSize size, VkAccessFlags dst_access, VkPipelineStageFlags dst_stage);
+	void upload_buffer(VkBuffer dst, VkDeviceSize dst_offset, StagedData src, VkDeviceSize size, VkAccessFlags dst_access, VkPipelineStageFlags dst_stage);
 	Mesh load_mesh(std::string filename);
+
+	// Uploads are recorded into the current batch and only reach the GPU on
+	// flush_uploads, which end_draw calls before submitting the frame, so
+	// anything uploaded while recording a frame is ready for it.
+
+	// Copies data into staging memory that stays valid until the batch
+	// recording its copy has finished
+	StagedData stage(const void *data, VkDeviceSize size);
+	// Safe to call from any thread. Returns false if out of memory.
+	bool create_staging_buffer(VkDeviceSize size, StagingBuffer &staging);
+	// For staging buffers that are never uploaded. Ignores empty ones.
+	void destroy_staging_buffer(const StagingBuffer &staging);
+	// Hands staging over to the current batch, which frees it once its
+	// copies have finished
+	StagedData take_staging(const StagingBuffer &staging);
+	// Counts size bytes of the current batch towards asset in the profile.
+	// The batch's GPU wait is split between its assets by size, as
+	// upload_wait spans. Does nothing unless the profiler is recording.
+	void profile_upload(const std::string &asset, VkDeviceSize size);
+	// Transfer command buffer of the current batch
+	VkCommandBuffer upload_cmd();
+	// Makes the transfer writes the barriers cover visible at dst_stage on
+	// the graphics queue, handing the resources over from the transfer
+	// queue's family when it has its own. The barriers are filled in as for
+	// a single queue.
+	void finish_upload(uint32_t buffer_count, const VkBufferMemoryBarrier *buffer_barriers, uint32_t image_count, const VkImageMemoryBarrier *image_barriers, VkPipelineStageFlags dst_stage);
+	void flush_uploads();
+	// Flushes and blocks until every upload has finished
+	void wait_uploads();
+	void retire_batch(UploadBatch &batch);
+
+	// Per frame uniform and storage data is pushed into the current frame's
+	// part of _frame_buffer, which start_draw empties. Descriptors read it
+	// through frame_buffer_info at a dynamic offset bind_descriptor_set
+	// looks up by slot, so data must be pushed before binding.
+
+	// Slot of the frame data under label, the same for the engine's
+	// lifetime. Labels are searched linearly, so resolve them once at init.
+	uint32_t frame_slot(NameId label);
+	// Takes size bytes of the frame's part for the slot's data. Aborts if
+	// FRAME_DATA_SIZE is too small for the frame's data.
+	char *allocate_frame_data(uint32_t slot, VkDeviceSize size);
+	void push_frame_data(uint32_t slot, const void *data, VkDeviceSize size);
+	// For a dynamic uniform or storage buffer descriptor of range bytes
+	VkDescriptorBufferInfo frame_buffer_info(VkDeviceSize range);
+	// Binds set at index 0 with the offsets of this frame's data in
+	// dynamic_slots, which follow the set's dynamic descriptors in binding
+	// order. Aborts if a slot's data was not pushed this frame.
+	void bind_descriptor_set(VkCommandBuffer cmd, VkPipelineLayout layout, VkDescriptorSet set, const std::vector<uint32_t> &dynamic_slots);
+
 	void immediate_submit(std::function<void(VkCommandBuffer cmd)> &&function);
 	void resize_swapchain(uint32_t w, uint32_t h, VkRenderPass render_pass);
 
-	int _frame_number;
+	int _frame_number = 0;
 	VkExtent2D _window_extent{1920, 1080};
 	struct SDL_Window *_window{nullptr};
 
@@ -79,6 +207,8 @@ public:
 	// need to be deleted and recreated when resizing the window.
 	DeletionQueue _main_deletion_queue;
 	DeletionQueue _swapchain_deletion_queue;
+	// Functions from destroy_later with the frame number they were queued in
+	std::deque<std::pair<int, std::function<void()>>> _retired_deletors;
 
 	VkInstance _instance;
 	VkDebugUtilsMessengerEXT _debug_messenger;
@@ -90,6 +220,10 @@ public:
 
 	VkQueue _graphics_queue;
 	uint32_t _graphics_queue_family;
+	// The graphics queue unless the device has a transfer only family
+	VkQueue _transfer_queue;
+	uint32_t _transfer_queue_family;
+	bool _dedicated_transfer = false;
 
 	VkSwapchainKHR _swapchain;
 	VkFormat _swapchain_image_format;
@@ -107,8 +241,44 @@ public:
 	VkSemaphore _present_semaphores[FRAME_OVERLAP];
 	VkFence _upload_fence;
 
+	// Persistently mapped. Live data runs from _staging_tail up to
+	// _staging_head, wrapping at the end; the two are equal only when empty.
+	Buffer _staging_ring;
+	char *_staging_data;
+	VkDeviceSize _staging_head = 0;
+	VkDeviceSize _staging_tail = 0;
+	VkDeviceSize _staging_alignment;
+
+	UploadBatch _upload_batches[UPLOAD_BATCHES];
+	uint32_t _upload_batch = 0;
+
+	// Every mesh's vertices and indices, so draws of different meshes need
+	// no rebinding. Ranges are freed through destroy_mesh.
+	Buffer _mesh_vertex_buffer;
+	Buffer _mesh_index_buffer;
+	BufferArena _mesh_vertices;
+	BufferArena _mesh_indices;
+
+	// Persistently mapped, device local where the device has host visible
+	// device local memory. Frame i uses FRAME_DATA_SIZE bytes from
+	// i * FRAME_DATA_SIZE.
+	Buffer _frame_buffer;
+	char *_frame_data;
+	VkDeviceSize _frame_data_head = 0;
+	VkDeviceSize _frame_data_end = 0;
+	VkDeviceSize _frame_data_alignment;
+	// Labels by slot
+	NameId _frame_labels[MAX_FRAME_SLOTS];
+	uint32_t _frame_slot_count = 0;
+	// Offset of each slot's data and the frame number it was pushed in
+	uint32_t _frame_offsets[MAX_FRAME_SLOTS];
+	int _frame_pushed[MAX_FRAME_SLOTS];
+
 	MaterialSystem _material_system;
 	AssetSystem _asset_system;
 
 	VkDescriptorPool _descriptor_pool;
+
+	// Created on demand by min_lod_sampler, indexed by min LOD
+	std::vector<VkSampler> _min_lod_samplers;
 };
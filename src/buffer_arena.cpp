@@ -0,0 +1,75 @@
+#include "buffer_arena.h"
+
+#include <iterator>
+
+void BufferArena::init(VkDeviceSize size)
+{
+	_size = size;
+	_used = 0;
+	_free.clear();
+	_free[0] = size;
+}
+
+bool BufferArena::allocate(VkDeviceSize size, VkDeviceSize alignment, BufferRange *range)
+{
+	for (auto it = _free.begin(); it != _free.end(); it++)
+	{
+		VkDeviceSize start = it->first;
+		VkDeviceSize end = it->first + it->second;
+		VkDeviceSize offset = (start + alignment - 1) / alignment * alignment;
+
+		if (offset + size > end)
+		{
+			continue;
+		}
+
+		// Whatever is left on either side stays free
+		_free.erase(it);
+		if (offset > start)
+		{
+			_free[start] = offset - start;
+		}
+		if (offset + size < end)
+		{
+			_free[offset + size] = end - (offset + size);
+		}
+
+		range->offset = offset;
+		range->size = size;
+		_used += size;
+		return true;
+	}
+
+	return false;
+}
+
+void BufferArena::free(const BufferRange &range)
+{
+	if (range.size == 0)
+	{
+		return;
+	}
+
+	VkDeviceSize offset = range.offset;
+	VkDeviceSize size = range.size;
+	_used -= size;
+
+	auto next = _free.lower_bound(offset);
+	if (next != _free.end() && next->first == offset + size)
+	{
+		size += next->second;
+		next = _free.erase(next);
+	}
+
+	if (next != _free.begin())
+	{
+		auto prev = std::prev(next);
+		if (prev->first + prev->second == offset)
+		{
+			prev->second += size;
+			return;
+		}
+	}
+
+	_free[offset] = size;
+}
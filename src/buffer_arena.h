@@ -0,0 +1,30 @@
+#pragma once
+
+#include "inc.h"
+
+#include <map>
+
+// A range of bytes in a buffer shared by many resources
+struct BufferRange
+{
+	VkDeviceSize offset = 0;
+	VkDeviceSize size = 0;
+};
+
+// Hands out ranges of one large buffer, first fit. Freed ranges merge with
+// free neighbours so the space can be reused by larger ones.
+class BufferArena
+{
+public:
+	void init(VkDeviceSize size);
+	// Offsets are multiples of alignment, which need not be a power of two.
+	// Returns false if no free range is large enough.
+	bool allocate(VkDeviceSize size, VkDeviceSize alignment, BufferRange *range);
+	void free(const BufferRange &range);
+
+	VkDeviceSize _size = 0;
+	VkDeviceSize _used = 0;
+
+	// Sizes of the free ranges by offset
+	std::map<VkDeviceSize, VkDeviceSize> _free;
+};
@@ -11,9 +11,14 @@
 #include "glm/gtx/transform.hpp"
 #include "../pipeline_builder.h"
 #include "../asset_system.h"
+#include "../profiler.h"
 
 void DeferredEngine::init()
 {
+	// Written out as startup_profile.* by cleanup
+	profiler::start();
+	ProfileScope profile("init", "DeferredEngine::init");
+
 	init_sdl("Deferred Rendering");
 	init_vulkan("Deferred Rendering", true);
 	init_swapchain();
@@ -22,16 +27,20 @@ void DeferredEngine::init()
 	init_descriptor_pool();
 	init_render_passes();
 	init_framebuffers();
+	// The material sets are 4K, start drawing before their finest levels are in
+	_asset_system.stream_textures = true;
+	// Rerunning the asset packer updates the running scene
+	_asset_system.hot_reload = true;
 	_material_system.init("../assets/deferred/material_system", this, {_g_pass, _lighting_pass, _forward_pass});
 	
-	_mat_ids[0] = _material_system.get_material_id("rust");
-	_mat_ids[1] = _material_system.get_material_id("cheese");
-	_mat_ids[2] = _material_system.get_material_id("dent");
-	_mat_ids[3] = _material_system.get_material_id("rock");
-	_mat_ids[4] = _material_system.get_material_id("alien");
-	_mat_ids[5] = _material_system.get_material_id("conc");
-	_mat_ids[6] = _material_system.get_material_id("lighting");
-	_mat_ids[7] = _material_system.get_material_id("light_draw");
+	_mat_ids[0] = _material_system.get_material_id("rust"_id);
+	_mat_ids[1] = _material_system.get_material_id("cheese"_id);
+	_mat_ids[2] = _material_system.get_material_id("dent"_id);
+	_mat_ids[3] = _material_system.get_material_id("rock"_id);
+	_mat_ids[4] = _material_system.get_material_id("alien"_id);
+	_mat_ids[5] = _material_system.get_material_id("conc"_id);
+	_mat_ids[6] = _material_system.get_material_id("lighting"_id);
+	_mat_ids[7] = _material_system.get_material_id("light_draw"_id);
 
 	init_descriptors();
 	init_pipelines();
@@ -53,6 +62,24 @@ void DeferredEngine::draw()
 		return;
 	}
 
+	_asset_system.update_assets();
+	_asset_system.vram_budget = (VkDeviceSize)_vram_budget_mb * 1024 * 1024;
+
+	// A texture that finished loading, was reloaded, evicted or gained a
+	// mip level has a new image or sampler. Each frame's sets are rewritten
+	// once its previous use of them has finished. Evicted textures are
+	// written as the placeholder; only drawing brings them back.
+	if (_asset_system.update_loading(this))
+	{
+		_stale_descriptor_frames = FRAME_OVERLAP;
+	}
+
+	if (_stale_descriptor_frames > 0)
+	{
+		write_descriptors(frame_index);
+		_stale_descriptor_frames--;
+	}
+
 	// Set up viewport and scissor based on window dimensions
 	VkViewport viewport = {};
 	viewport.height = (float)_window_extent.height;
@@ -84,12 +111,60 @@ void DeferredEngine::draw()
 	ObjectData obj_data[NUM_MONKEYS+1];
 	obj_data[0].model_matrix = glm::translate(glm::vec3(5, -10, 0));
 
-	for (int i = 1; i < NUM_MONKEYS+1; i++)
+	// Pick the coarsest level of detail whose error stays under
+	// _lod_pixel_error pixels on screen for every monkey
+	// Meshes still loading are skipped
+	Mesh &monkey_mesh = _asset_system.get_mesh(_monkey_mesh);
+	Mesh &empire_mesh = _asset_system.get_mesh(_empire_mesh);
+	Mesh &light_mesh = _asset_system.get_mesh(_light_mesh);
+	bool monkey_ready = _asset_system.ready(_monkey_mesh);
+	bool empire_ready = _asset_system.ready(_empire_mesh);
+	bool light_ready = _asset_system.ready(_light_mesh);
+
+	const std::vector<AssetPacker::MeshLod> &lods = monkey_mesh._lods;
+	const float monkey_scale = 0.8f;
+	float pixels_per_unit = std::abs(projection[1][1]) * _window_extent.height * 0.5f;
+
+	uint32_t monkey_lods[NUM_MONKEYS];
+	uint32_t batch_counts[NUM_TEXTURES][AssetPacker::MAX_MESH_LODS] = {};
+	uint32_t lod_totals[AssetPacker::MAX_MESH_LODS] = {};
+
+	for (int i = 0; i < NUM_MONKEYS; i++)
+	{
+		float distance = glm::length(_monkey_pos[i] + cam_pos);
+		uint32_t lod = 0;
+
+		while (lod + 1 < lods.size() && lods[lod + 1].error * monkey_scale * pixels_per_unit <= _lod_pixel_error * distance)
+		{
+			lod++;
+		}
+
+		monkey_lods[i] = lod;
+		batch_counts[i % NUM_TEXTURES][lod]++;
+		lod_totals[lod]++;
+	}
+
+	// Group monkeys by texture, then level of detail, so each group is one
+	// instanced draw. Index 0 belongs to the empire.
+	uint32_t batch_firsts[NUM_TEXTURES][AssetPacker::MAX_MESH_LODS];
+	uint32_t batch_fill[NUM_TEXTURES][AssetPacker::MAX_MESH_LODS];
+	uint32_t first_instance = 1;
+	for (int t = 0; t < NUM_TEXTURES; t++)
+	{
+		for (size_t l = 0; l < lods.size(); l++)
+		{
+			batch_firsts[t][l] = first_instance;
+			batch_fill[t][l] = first_instance;
+			first_instance += batch_counts[t][l];
+		}
+	}
+
+	for (int i = 0; i < NUM_MONKEYS; i++)
 	{
-		glm::mat4 translate = glm::translate(_monkey_pos[i-1]);
-		glm::mat4 rotate = glm::rotate(glm::mat4(1.0f), glm::radians(_frame_number * 0.2f), glm::vec3(std::sin(0.2 * i), std::cos(0.2 * i), 0.0f));
-		glm::mat4 scale = glm::scale(glm::vec3(0.8f, 0.8f, 0.8f));
-		obj_data[i].model_matrix = translate * rotate * scale;
+		glm::mat4 translate = glm::translate(_monkey_pos[i]);
+		glm::mat4 rotate = glm::rotate(glm::mat4(1.0f), glm::radians(_frame_number * 0.2f), glm::vec3(std::sin(0.2 * (i+1)), std::cos(0.2 * (i+1)), 0.0f));
+		glm::mat4 scale = glm::scale(glm::vec3(monkey_scale));
+		obj_data[batch_fill[i % NUM_TEXTURES][monkey_lods[i]]++].model_matrix = translate * rotate * scale;
 	}
 
 	// Initialize structures for light uniform buffers
@@ -134,32 +209,22 @@ void DeferredEngine::draw()
 
 	}
 
-	// Write data to uniform buffers
-	void *data;
-	vmaMapMemory(_allocator, _uniform_buffers[frame_index]._allocation, &data);
-	memcpy(data, &cam_data, sizeof(CameraData));
-	vmaUnmapMemory(_allocator, _uniform_buffers[frame_index]._allocation);
-
-	vmaMapMemory(_allocator, _storage_buffers[frame_index]._allocation, &data);
-	memcpy(data, obj_data, sizeof(ObjectData) * NUM_MONKEYS+1);
-	vmaUnmapMemory(_allocator, _storage_buffers[frame_index]._allocation);
-
-	// Write the data for front facing light volumes to the beginning of the buffer
-	// Then write the data for the back facing light volumes to the end
-	vmaMapMemory(_allocator, _light_buffers[frame_index]._allocation, &data);
-	memcpy(data, _lights_info_front, sizeof(LightData) * front_index);
-	memcpy((LightData*)data + front_index, _lights_info_back, sizeof(LightData) * back_index);
-	vmaUnmapMemory(_allocator, _light_buffers[frame_index]._allocation);
-
-	vmaMapMemory(_allocator, _light_storage_buffers[frame_index]._allocation, &data);
-	memcpy(data, light_uniform_front, sizeof(ObjectData) * front_index);
-	memcpy((ObjectData*)data + front_index, light_uniform_back, sizeof(ObjectData) * back_index);
-	vmaUnmapMemory(_allocator, _light_storage_buffers[frame_index]._allocation);
-
-	vmaMapMemory(_allocator, _light_draw_storage_buffers[frame_index]._allocation, &data);
-	memcpy(data, light_draw_uniform_front, sizeof(ObjectData) * front_index);
-	memcpy((ObjectData*)data + front_index, light_draw_uniform_back, sizeof(ObjectData) * back_index);
-	vmaUnmapMemory(_allocator, _light_draw_storage_buffers[frame_index]._allocation);
+	// Push this frame's data. Front facing light volumes go at the start of
+	// each light buffer, back facing ones after them.
+	push_frame_data(_cam_slot, &cam_data, sizeof(CameraData));
+	push_frame_data(_obj_slot, obj_data, sizeof(ObjectData) * (NUM_MONKEYS+1));
+
+	LightData *light_data = (LightData*)allocate_frame_data(_light_slot, sizeof(LightData) * NUM_LIGHTS);
+	memcpy(light_data, _lights_info_front, sizeof(LightData) * front_index);
+	memcpy(light_data + front_index, _lights_info_back, sizeof(LightData) * back_index);
+
+	ObjectData *light_obj_data = (ObjectData*)allocate_frame_data(_light_obj_slot, sizeof(ObjectData) * NUM_LIGHTS);
+	memcpy(light_obj_data, light_uniform_front, sizeof(ObjectData) * front_index);
+	memcpy(light_obj_data + front_index, light_uniform_back, sizeof(ObjectData) * back_index);
+
+	ObjectData *light_draw_data = (ObjectData*)allocate_frame_data(_light_draw_slot, sizeof(ObjectData) * NUM_LIGHTS);
+	memcpy(light_draw_data, light_draw_uniform_front, sizeof(ObjectData) * front_index);
+	memcpy(light_draw_data + front_index, light_draw_uniform_back, sizeof(ObjectData) * back_index);
 
 	VkClearValue clear_value;
 	clear_value.color = {{0.0f, 0.0f, 0.0f, 1.0f}};
@@ -178,6 +243,21 @@ void DeferredEngine::draw()
 		}
 	}
 
+	if (ImGui::CollapsingHeader("Monkey Levels of Detail"))
+	{
+		ImGui::SliderFloat("Max pixel error", &_lod_pixel_error, 0.0f, 10.0f);
+		for (size_t l = 0; l < lods.size(); l++)
+		{
+			ImGui::Text("LOD %d: %u triangles, %u monkeys", (int)l, lods[l].index_count / 3, lod_totals[l]);
+		}
+	}
+
+	if (ImGui::CollapsingHeader("Video Memory"))
+	{
+		ImGui::Text("In use: %u MB", (uint32_t)(_asset_system.vram_usage / (1024 * 1024)));
+		ImGui::SliderInt("Budget (MB, 0 is none)", &_vram_budget_mb, 0, 4096);
+	}
+
 	if (ImGui::CollapsingHeader("Lights"))
 	{
 		for (int n = 0; n < NUM_LIGHTS; n++)
@@ -208,19 +288,36 @@ void DeferredEngine::draw()
 
 	vkCmdBeginRenderPass(cmd, &rp_info, VK_SUBPASS_CONTENTS_INLINE);
 	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _g_pipeline);
-	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _g_pipeline_layout, 0, 1, &_descriptor_sets[NUM_TEXTURES-1][frame_index], 0, nullptr);
-	VkDeviceSize offset = 0;
-	vkCmdBindVertexBuffers(cmd, 0, 1, &_empire_mesh._vertex_buffer._buffer, &offset);
-	vkCmdBindIndexBuffer(cmd, _empire_mesh._index_buffer._buffer, 0, VK_INDEX_TYPE_UINT32);
-	vkCmdDrawIndexed(cmd, _empire_mesh._indices.size(), 1, 0, 0, 0);
-
-	// Draw monkeys with random textures
-	vkCmdBindVertexBuffers(cmd, 0, 1, &_monkey_mesh._vertex_buffer._buffer, &offset);
-	for (int i = 0; i < NUM_TEXTURES; i++)
+	bind_descriptor_set(cmd, _g_pipeline_layout, _descriptor_sets[NUM_TEXTURES-1][frame_index], _dynamic_slots[NUM_TEXTURES-1]);
+	// All meshes share one vertex and one index buffer, which only has to be
+	// bound again for a different index type
+	VkIndexType index_type = empire_mesh._index_type;
+	bind_mesh_buffers(cmd, index_type);
+	if (empire_ready)
 	{
-		vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _g_pipeline_layout, 0, 1, &_descriptor_sets[i % NUM_TEXTURES][frame_index], 0, nullptr);
-		vkCmdBindIndexBuffer(cmd, _monkey_mesh._index_buffer._buffer, 0, VK_INDEX_TYPE_UINT32);
-		vkCmdDrawIndexed(cmd, _monkey_mesh._indices.size(), NUM_MONKEYS/NUM_TEXTURES, 0, 0, i*(NUM_MONKEYS/NUM_TEXTURES));
+		touch_set_textures(NUM_TEXTURES-1);
+		vkCmdDrawIndexed(cmd, empire_mesh._index_count, 1, empire_mesh._first_index, empire_mesh._vertex_offset, 0);
+	}
+
+	// Draw monkeys with random textures, one draw per texture and level of detail
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _g_compact_pipeline);
+	if (monkey_ready && monkey_mesh._index_type != index_type)
+	{
+		index_type = monkey_mesh._index_type;
+		vkCmdBindIndexBuffer(cmd, _mesh_index_buffer._buffer, 0, index_type);
+	}
+	for (int i = 0; i < NUM_TEXTURES && monkey_ready; i++)
+	{
+		bind_descriptor_set(cmd, _g_compact_pipeline_layout, _descriptor_sets[i % NUM_TEXTURES][frame_index], _dynamic_slots[i % NUM_TEXTURES]);
+		touch_set_textures(i % NUM_TEXTURES);
+
+		for (size_t l = 0; l < lods.size(); l++)
+		{
+			if (batch_counts[i][l] > 0)
+			{
+				vkCmdDrawIndexed(cmd, lods[l].index_count, batch_counts[i][l], monkey_mesh._first_index + lods[l].first_index, monkey_mesh._vertex_offset, batch_firsts[i][l]);
+			}
+		}
 	}
 	vkCmdEndRenderPass(cmd);
 
@@ -232,19 +329,25 @@ void DeferredEngine::draw()
 	vkCmdBeginRenderPass(cmd, &rp_info, VK_SUBPASS_CONTENTS_INLINE);
 	// Draw ambient light in a single full-screen quad
 	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _ambient_pipeline);
-	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _ambient_pipeline_layout, 0, 1, &_descriptor_sets[NUM_TEXTURES+1][frame_index], 0, nullptr);
+	bind_descriptor_set(cmd, _ambient_pipeline_layout, _descriptor_sets[NUM_TEXTURES+1][frame_index], _dynamic_slots[NUM_TEXTURES+1]);
 	vkCmdDraw(cmd, 6, 1, 0, 0);
 
 	//Draw front facing light volumes
 	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _lighting_front_pipeline);
-	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _lighting_pipeline_layout, 0, 1, &_descriptor_sets[NUM_TEXTURES+0][frame_index], 0, nullptr);
-	vkCmdBindVertexBuffers(cmd, 0, 1, &_light_mesh._vertex_buffer._buffer, &offset);
-	vkCmdBindIndexBuffer(cmd, _light_mesh._index_buffer._buffer, 0, VK_INDEX_TYPE_UINT32);
-
-	// Draw back facing light volumes
-	vkCmdDrawIndexed(cmd, _light_mesh._indices.size(), front_index, 0, 0, 0);
-	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _lighting_back_pipeline);
-	vkCmdDrawIndexed(cmd, _light_mesh._indices.size(), back_index, 0, 0, front_index);
+	bind_descriptor_set(cmd, _lighting_pipeline_layout, _descriptor_sets[NUM_TEXTURES+0][frame_index], _dynamic_slots[NUM_TEXTURES+0]);
+	if (light_ready)
+	{
+		if (light_mesh._index_type != index_type)
+		{
+			index_type = light_mesh._index_type;
+			vkCmdBindIndexBuffer(cmd, _mesh_index_buffer._buffer, 0, index_type);
+		}
+
+		// Draw back facing light volumes
+		vkCmdDrawIndexed(cmd, light_mesh._index_count, front_index, light_mesh._first_index, light_mesh._vertex_offset, 0);
+		vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _lighting_back_pipeline);
+		vkCmdDrawIndexed(cmd, light_mesh._index_count, back_index, light_mesh._first_index, light_mesh._vertex_offset, front_index);
+	}
 	vkCmdEndRenderPass(cmd);
 
 	// Begin pass to draw lights into the scene
@@ -254,10 +357,13 @@ void DeferredEngine::draw()
 	rp_info.pClearValues = nullptr;
 	vkCmdBeginRenderPass(cmd, &rp_info, VK_SUBPASS_CONTENTS_INLINE);
 	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _light_draw_pipeline);
-	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _light_draw_pipeline_layout, 0, 1, &_descriptor_sets[NUM_TEXTURES+2][frame_index], 0, nullptr);
+	bind_descriptor_set(cmd, _light_draw_pipeline_layout, _descriptor_sets[NUM_TEXTURES+2][frame_index], _dynamic_slots[NUM_TEXTURES+2]);
 
 	// Draw lights
-	vkCmdDrawIndexed(cmd, _light_mesh._indices.size(), NUM_LIGHTS, 0, 0, 0);
+	if (light_ready)
+	{
+		vkCmdDrawIndexed(cmd, light_mesh._index_count, NUM_LIGHTS, light_mesh._first_index, light_mesh._vertex_offset, 0);
+	}
 
 	ImGui::Render();
 	ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), cmd);
@@ -358,6 +464,49 @@ void DeferredEngine::init_descriptors()
 	_descriptor_sets[NUM_TEXTURES+1] = allocate_descriptor_sets(_ambient_descriptor_layout, FRAME_OVERLAP);
 	_descriptor_sets[NUM_TEXTURES+2] = allocate_descriptor_sets(_light_draw_descriptor_layout, FRAME_OVERLAP);
 
+	_cam_slot = frame_slot("cam_data"_id);
+	_obj_slot = frame_slot("obj_data"_id);
+	_light_slot = frame_slot("light_data"_id);
+	_light_obj_slot = frame_slot("light_obj_data"_id);
+	_light_draw_slot = frame_slot("light_draw_data"_id);
+
+	// Record the slots of each set's frame data and the textures it
+	// samples, which draw marks as used. Sets are numbered as in
+	// write_descriptors, which reuses _descriptor_writes so rewriting sets
+	// while streaming allocates nothing.
+	int info_count = 0;
+	size_t max_descriptors = 0;
+	for (int n = 0; n < NUM_MATS; n++)
+	{
+		const std::vector<DescriptorInfo> &infos = _material_system.get_descriptor_infos(_mat_ids[n]);
+		for (int in = 0; in < infos.size(); in++)
+		{
+			if (in == 1)
+			{
+				info_count--;
+			}
+
+			_dynamic_slots[info_count].clear();
+			for (NameId label : infos[in].dynamic_ids)
+			{
+				_dynamic_slots[info_count].push_back(frame_slot(label));
+			}
+			max_descriptors = std::max(max_descriptors, infos[in].descriptor_names.size());
+
+			_set_textures[info_count].clear();
+			for (size_t j = 0; j < infos[in].descriptor_names.size(); j++)
+			{
+				if (infos[in].descriptor_names[j].compare(0, 4, "TEX:") == 0)
+				{
+					_set_textures[info_count].push_back(_asset_system.get_texture_id(infos[in].descriptor_ids[j]));
+				}
+			}
+
+			info_count++;
+		}
+	}
+	_descriptor_writes.reserve(max_descriptors * FRAME_OVERLAP);
+
 	// Create lighting pass descriptor sets
 	/*bindings = {
 		infos::descriptor_set_layout_binding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 0),
@@ -532,6 +681,8 @@ void DeferredEngine::init_pipelines()
 
 	_g_pipeline = _material_system._pipelines["g_pass"].pipeline;
 	_g_pipeline_layout = _material_system._pipelines["g_pass"].layout;
+	_g_compact_pipeline = _material_system._pipelines["g_pass_compact"].pipeline;
+	_g_compact_pipeline_layout = _material_system._pipelines["g_pass_compact"].layout;
 
 	/*_main_deletion_queue.push_function([=]() {
 		vkDestroyPipeline(_device, _g_pipeline, nullptr);
@@ -569,9 +720,15 @@ void DeferredEngine::init_models()
 	upload_mesh(_empire_mesh);
 	_light_mesh = load_mesh("../assets/sphere.m");
 	upload_mesh(_light_mesh);*/
-	_monkey_mesh = _asset_system.get_mesh(_asset_system.get_mesh_id("monkey"));
-	_empire_mesh = _asset_system.get_mesh(_asset_system.get_mesh_id("empire"));
-	_light_mesh = _asset_system.get_mesh(_asset_system.get_mesh_id("light"));
+	// The handles are valid while the meshes load, get_mesh is called every frame
+	_monkey_mesh = _asset_system.get_mesh_id("monkey"_id);
+	_empire_mesh = _asset_system.get_mesh_id("empire"_id);
+	_light_mesh = _asset_system.get_mesh_id("light"_id);
+
+	// Drawn every frame, so never evicted
+	_asset_system.acquire(_monkey_mesh);
+	_asset_system.acquire(_empire_mesh);
+	_asset_system.acquire(_light_mesh);
 
 	// Load textures
 	/*_albedo[0] = load_texture("../assets/iron/rustediron2_basecolor.t", VK_FORMAT_R8G8B8A8_SRGB);
@@ -595,63 +752,11 @@ void DeferredEngine::init_models()
 	_metal[3] = load_texture("../assets/concrete/degraded-concrete_metallic.t", VK_FORMAT_R8G8B8A8_UNORM);
 	_ao[3] = load_texture("../assets/concrete/degraded-concrete_ao.t", VK_FORMAT_R8G8B8A8_UNORM);*/
 
-	_albedo[0] = _asset_system.get_texture(_asset_system.get_texture_id("rust_albedo"));
-	_specular[0] = _asset_system.get_texture(_asset_system.get_texture_id("rust_specular"));
-	_normal[0] = _asset_system.get_texture(_asset_system.get_texture_id("rust_normal"));
-	_metal[0] = _asset_system.get_texture(_asset_system.get_texture_id("rust_metal"));
-	_ao[0] = _asset_system.get_texture(_asset_system.get_texture_id("rust_ao"));
-
-	_albedo[3] = _asset_system.get_texture(_asset_system.get_texture_id("cheese_albedo"));
-	_specular[3] = _asset_system.get_texture(_asset_system.get_texture_id("cheese_specular"));
-	_normal[3] = _asset_system.get_texture(_asset_system.get_texture_id("cheese_normal"));
-	_metal[3] = _asset_system.get_texture(_asset_system.get_texture_id("cheese_metal"));
-	_ao[3] = _asset_system.get_texture(_asset_system.get_texture_id("cheese_ao"));
-	
-	_albedo[1] = _asset_system.get_texture(_asset_system.get_texture_id("dent_albedo"));
-	_specular[1] = _asset_system.get_texture(_asset_system.get_texture_id("dent_specular"));
-	_normal[1] = _asset_system.get_texture(_asset_system.get_texture_id("dent_normal"));
-	_metal[1] = _asset_system.get_texture(_asset_system.get_texture_id("dent_metal"));
-	_ao[1] = _asset_system.get_texture(_asset_system.get_texture_id("dent_ao"));
-
-	_albedo[2] = _asset_system.get_texture(_asset_system.get_texture_id("rock_albedo"));
-	_specular[2] = _asset_system.get_texture(_asset_system.get_texture_id("rock_specular"));
-	_normal[2] = _asset_system.get_texture(_asset_system.get_texture_id("rock_normal"));
-	_metal[2] = _asset_system.get_texture(_asset_system.get_texture_id("rock_metal"));
-	_ao[2] = _asset_system.get_texture(_asset_system.get_texture_id("rock_ao"));
-
-	_albedo[4] = _asset_system.get_texture(_asset_system.get_texture_id("conc_albedo"));
-	_specular[4] = _asset_system.get_texture(_asset_system.get_texture_id("conc_specular"));
-	_normal[4] = _asset_system.get_texture(_asset_system.get_texture_id("conc_normal"));
-	_metal[4] = _asset_system.get_texture(_asset_system.get_texture_id("conc_metal"));
-	_ao[4] = _asset_system.get_texture(_asset_system.get_texture_id("conc_ao"));
+	// Textures are looked up by name when the descriptor sets are written
 }
 
 void DeferredEngine::init_scene()
 {
-	// Create uniform/storage buffers
-	for (int i = 0; i < FRAME_OVERLAP; i++)
-	{
-		_uniform_buffers[i] = create_buffer(sizeof(CameraData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-		_storage_buffers[i] = create_buffer(sizeof(ObjectData) * NUM_MONKEYS+1, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-		//_light_uniform_buffers[i] = create_buffer(sizeof(CameraData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-		_light_storage_buffers[i] = create_buffer(sizeof(ObjectData) * NUM_LIGHTS, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-		_light_buffers[i] = create_buffer(sizeof(LightData) * NUM_LIGHTS, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-		_light_draw_storage_buffers[i] = create_buffer(sizeof(ObjectData) * NUM_LIGHTS, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-
-	}
-
-	_main_deletion_queue.push_function([=]() {
-		for (int i = 0; i < FRAME_OVERLAP; i++)
-		{
-			vmaDestroyBuffer(_allocator, _uniform_buffers[i]._buffer, _uniform_buffers[i]._allocation);
-			vmaDestroyBuffer(_allocator, _storage_buffers[i]._buffer, _storage_buffers[i]._allocation);
-			//vmaDestroyBuffer(_allocator, _light_uniform_buffers[i]._buffer, _light_uniform_buffers[i]._allocation);
-			vmaDestroyBuffer(_allocator, _light_storage_buffers[i]._buffer, _light_storage_buffers[i]._allocation);
-			vmaDestroyBuffer(_allocator, _light_buffers[i]._buffer, _light_buffers[i]._allocation);
-			vmaDestroyBuffer(_allocator, _light_draw_storage_buffers[i]._buffer, _light_draw_storage_buffers[i]._allocation);
-		}
-	});
-
 	// Initialize light to random position/color/radius
 	for (int i = 0; i < NUM_LIGHTS; i++)
 	{
@@ -670,109 +775,122 @@ void DeferredEngine::init_scene()
 
 }
 
-void DeferredEngine::write_descriptors()
+void DeferredEngine::write_descriptors(int frame)
 {
-	std::vector<std::vector<DescriptorInfo>> infos = {};
-
-	for (int n = 0; n < NUM_MATS; n++)
-	{
-		infos.push_back(_material_system.get_descriptor_infos(_mat_ids[n]));
-	}
-
 	int info_count = 0;
 
+	// Buffers are the frame data, at the offsets it was pushed at
+	VkDescriptorBufferInfo cam_info = frame_buffer_info(sizeof(CameraData));
+	VkDescriptorBufferInfo obj_info = frame_buffer_info(sizeof(ObjectData) * (NUM_MONKEYS+1));
+	VkDescriptorBufferInfo light_obj_info = frame_buffer_info(sizeof(ObjectData) * NUM_LIGHTS);
+	VkDescriptorBufferInfo light_info = frame_buffer_info(sizeof(LightData) * NUM_LIGHTS);
+	VkDescriptorBufferInfo light_draw_info = frame_buffer_info(sizeof(ObjectData) * NUM_LIGHTS);
+
+	// Runs whenever a streamed texture changes, so labels are compared by
+	// their precomputed hashes rather than as strings
 	for (int n = 0; n < NUM_MATS; n++)
 	{
-		for (int in = 0; in < infos[n].size(); in++)
+		const std::vector<DescriptorInfo> &infos = _material_system.get_descriptor_infos(_mat_ids[n]);
+		for (int in = 0; in < infos.size(); in++)
 		{
-			std::vector<VkWriteDescriptorSet> writes = {};
-			auto info = infos[n][in];
+			_descriptor_writes.clear();
+			const DescriptorInfo &info = infos[in];
 			if (in == 1)
 			{
 				info_count--;
 			}
 			for (int i = 0; i < FRAME_OVERLAP; i++)
 			{
+				if (frame >= 0 && i != frame)
+				{
+					continue;
+				}
+
 				for (size_t j = 0; j < info.descriptor_names.size(); j++)
 				{
-					auto name = info.descriptor_names[j];
-					if (name.size() > 3 && name.substr(0, 3) == "UB:")
+					const std::string &name = info.descriptor_names[j];
+					NameId label = info.descriptor_ids[j];
+					if (name.size() > 3 && name.compare(0, 3, "UB:") == 0)
 					{
 						VkDescriptorBufferInfo *buffer_info;
-						auto label = name.substr(3, name.size()-3);
-						if (label == "cam_data")
+						if (label == "cam_data"_id)
 						{
-							buffer_info = &_uniform_buffers[i]._buffer_info;
+							buffer_info = &cam_info;
 						}
-						writes.push_back(infos::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, _descriptor_sets[info_count][i], buffer_info, j));
+						_descriptor_writes.push_back(infos::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, _descriptor_sets[info_count][i], buffer_info, j));
 					}
-					else if (name.size() > 3 && name.substr(0, 3) == "SB:")
+					else if (name.size() > 3 && name.compare(0, 3, "SB:") == 0)
 					{
 						VkDescriptorBufferInfo *buffer_info;
-						auto label = name.substr(3, name.size()-3);
-						if (label == "obj_data")
+						if (label == "obj_data"_id)
 						{
-							buffer_info = &_storage_buffers[i]._buffer_info;
+							buffer_info = &obj_info;
 						}
-						else if (label == "light_obj_data")
+						else if (label == "light_obj_data"_id)
 						{
-							buffer_info = &_light_storage_buffers[i]._buffer_info;
+							buffer_info = &light_obj_info;
 						}
-						else if (label == "light_data")
+						else if (label == "light_data"_id)
 						{
-							buffer_info = &_light_buffers[i]._buffer_info;
+							buffer_info = &light_info;
 						}
-						else if (label == "light_draw_data")
+						else if (label == "light_draw_data"_id)
 						{
-							buffer_info = &_light_draw_storage_buffers[i]._buffer_info;
+							buffer_info = &light_draw_info;
 						}
-						writes.push_back(infos::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, _descriptor_sets[info_count][i], buffer_info, j));
+						_descriptor_writes.push_back(infos::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, _descriptor_sets[info_count][i], buffer_info, j));
 					}
-					else if (name.size() > 4 && name.substr(0, 4) == "TEX:")
+					else if (name.size() > 4 && name.compare(0, 4, "TEX:") == 0)
 					{
 						VkDescriptorImageInfo *tex_info;
-						auto label = name.substr(4, name.size()-4);
 						tex_info = &_asset_system.get_texture(_asset_system.get_texture_id(label))._image_info;
-						writes.push_back(infos::write_descriptor_image(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, _descriptor_sets[info_count][i], tex_info, j));
+						_descriptor_writes.push_back(infos::write_descriptor_image(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, _descriptor_sets[info_count][i], tex_info, j));
 					}
-					else if (name.size() > 4 && name.substr(0, 4) == "ATT:")
+					else if (name.size() > 4 && name.compare(0, 4, "ATT:") == 0)
 					{
 						VkDescriptorImageInfo *tex_info;
-						auto label = name.substr(4, name.size()-4);
 
-						if (label == "g_albedo")
+						if (label == "g_albedo"_id)
 						{
 							tex_info = &_g_albedo_specular_image._image_info;
 						}
-						else if (label == "g_ao")
+						else if (label == "g_ao"_id)
 						{
 							tex_info = &_g_ao_image._image_info;
 						}
-						else if (label == "g_pos")
+						else if (label == "g_pos"_id)
 						{
 							tex_info = &_g_position_image._image_info;
 						}
-						else if (label == "g_norm")
+						else if (label == "g_norm"_id)
 						{
 							tex_info = &_g_normal_image._image_info;
 						}
-						else if (label == "g_depth")
+						else if (label == "g_depth"_id)
 						{
 							tex_info = &_g_depth_image._image_info;
 						}
 
-						writes.push_back(infos::write_descriptor_image(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, _descriptor_sets[info_count][i], tex_info, j));
+						_descriptor_writes.push_back(infos::write_descriptor_image(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, _descriptor_sets[info_count][i], tex_info, j));
 					}
 				}
 			}
 
-			vkUpdateDescriptorSets(_device, writes.size(), writes.data(), 0, nullptr);
+			vkUpdateDescriptorSets(_device, _descriptor_writes.size(), _descriptor_writes.data(), 0, nullptr);
 
 			info_count++;
 		}
 	}
 }
 
+void DeferredEngine::touch_set_textures(int set)
+{
+	for (AssetHandle texture : _set_textures[set])
+	{
+		_asset_system.touch(texture);
+	}
+}
+
 void DeferredEngine::resize_window(uint32_t w, uint32_t h)
 {
 	// Resize swapchain
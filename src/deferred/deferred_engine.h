@@ -38,7 +38,11 @@ public:
 	void init_pipelines();
 	void init_models();
 	void init_scene();
-	void write_descriptors();
+	// Writes the sets of one frame in flight, or of all of them by default
+	void write_descriptors(int frame = -1);
+	// Marks the textures of a set as used this frame, for the asset
+	// system's residency manager
+	void touch_set_textures(int set);
 
 	virtual void resize_window(uint32_t w, uint32_t h);
 
@@ -65,6 +69,14 @@ public:
 	VkDescriptorSetLayout _ambient_descriptor_layout;
 	// NOTE: NUM_TEXTURES+0 is tex, NUM_TEXTURES+1 is ambient, NUM_TEXTURES+2 is light_draw
 	std::vector<VkDescriptorSet> _descriptor_sets[NUM_TEXTURES + 3];
+	// Slots of the frame data each set's dynamic descriptors read
+	std::vector<uint32_t> _dynamic_slots[NUM_TEXTURES + 3];
+	// Slots draw pushes frame data to
+	uint32_t _cam_slot, _obj_slot, _light_slot, _light_obj_slot, _light_draw_slot;
+	// Textures each set samples
+	std::vector<AssetHandle> _set_textures[NUM_TEXTURES + 3];
+	// Filled by write_descriptors, kept so it does not allocate
+	std::vector<VkWriteDescriptorSet> _descriptor_writes;
 
 	// Pipelines to draw light_volumes. One draws front faces, the other draws back faces
 	VkPipeline _lighting_front_pipeline;
@@ -82,31 +94,15 @@ public:
 	// Pipeline to draw to g-buffers
 	VkPipeline _g_pipeline;
 	VkPipelineLayout _g_pipeline_layout;
+	// Same, for meshes packed with compact vertices
+	VkPipeline _g_compact_pipeline;
+	VkPipelineLayout _g_compact_pipeline_layout;
 
 	// Meshes are hardcoded because I didn't have an asset system by the time I made this,
 	// but it's easy enough to add more
-	Mesh _monkey_mesh;
-	Mesh _empire_mesh;
-	Mesh _light_mesh;
-
-	// Textures are also hardcoded
-	Texture _albedo[NUM_TEXTURES];
-	Texture _specular[NUM_TEXTURES];
-	Texture _normal[NUM_TEXTURES];
-	Texture _metal[NUM_TEXTURES];
-	Texture _ao[NUM_TEXTURES];
-
-	// Buffers for drawing objects into the scene
-	Buffer _uniform_buffers[FRAME_OVERLAP];
-	Buffer _storage_buffers[FRAME_OVERLAP];
-
-	// Buffers for drawing light volumes
-	Buffer _light_buffers[FRAME_OVERLAP];
-	//Buffer _light_uniform_buffers[FRAME_OVERLAP];
-	Buffer _light_storage_buffers[FRAME_OVERLAP];
-
-	// Buffer for drawing lights into scene
-	Buffer _light_draw_storage_buffers[FRAME_OVERLAP];
+	AssetHandle _monkey_mesh;
+	AssetHandle _empire_mesh;
+	AssetHandle _light_mesh;
 
 	// Keeps information about the lights
 	LightData _lights_info[NUM_LIGHTS];
@@ -119,4 +115,14 @@ public:
 
 	// Positions for monkey heads
 	glm::vec3 _monkey_pos[NUM_MONKEYS];
+
+	// Largest on-screen error in pixels allowed when picking a monkey's level of detail
+	float _lod_pixel_error = 1.0f;
+
+	// Device local memory the asset system keeps to, 0 for no limit
+	int _vram_budget_mb = 0;
+
+	// Frames whose descriptor sets still hold samplers from before a
+	// streamed texture gained a level
+	uint32_t _stale_descriptor_frames = 0;
 };
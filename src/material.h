@@ -1,6 +1,7 @@
 #pragma once
 
 #include "inc.h"
+#include "name_id.h"
 
 #include <vector>
 #include <string>
@@ -17,6 +18,10 @@ struct DescriptorInfo
 {
 	VkDescriptorSetLayout layout;
 	std::vector<std::string> descriptor_names;
+	// Hash of the part of each name after its prefix, e.g. "albedo" of "TEX:albedo"
+	std::vector<NameId> descriptor_ids;
+	// Those of the UB: and SB: descriptors, which are dynamic, in binding order
+	std::vector<NameId> dynamic_ids;
 };
 
 struct Material
@@ -2,12 +2,15 @@
 
 #include "base_engine.h"
 #include "infos.h"
+#include "profiler.h"
 
 #include <fstream>
 #include <iostream>
 
 void MaterialSystem::init(std::string filename, BaseEngine *engine, std::vector<VkRenderPass> render_passes)
 {
+	ProfileScope profile("init", "MaterialSystem::init");
+
 	std::ifstream system_file;
 	system_file.open(filename);
 
@@ -75,7 +78,7 @@ const Material &MaterialSystem::get_material(size_t mat_id)
 	return _materials[mat_id];
 };
 
-std::vector<DescriptorInfo> MaterialSystem::get_descriptor_infos(size_t mat_id)
+const std::vector<DescriptorInfo> &MaterialSystem::get_descriptor_infos(size_t mat_id)
 {
 	if (mat_id >= _materials.size())
 	{
@@ -86,14 +89,15 @@ std::vector<DescriptorInfo> MaterialSystem::get_descriptor_infos(size_t mat_id)
 	return _materials[mat_id].descriptors;
 }
 
-size_t MaterialSystem::get_material_id(std::string name)
+size_t MaterialSystem::get_material_id(NameId name)
 {
-	if (_material_ids.count(name) == 0)
+	auto it = _material_ids.find(name);
+	if (it == _material_ids.end())
 	{
 		return (size_t)-1;
 	}
 
-	return _material_ids[name];
+	return it->second;
 }
 
 bool MaterialSystem::read_pipelines(std::string filename, BaseEngine *engine, std::vector<VkRenderPass> render_passes)
@@ -117,6 +121,8 @@ bool MaterialSystem::read_pipelines(std::string filename, BaseEngine *engine, st
 		info.color_blend_attachment_state = infos::color_blend_attachment_state();
 		std::string name;
 		std::getline(file, name);
+		// Covers reading the shaders and compiling the pipeline
+		ProfileScope profile("pipeline", name);
 
 		while (std::getline(file, line) && line != "!PIPELINE")
 		{
@@ -180,6 +186,10 @@ bool MaterialSystem::read_pipelines(std::string filename, BaseEngine *engine, st
 			{
 				info.flags |= PIPELINE_INFO_NO_VERTICES;
 			}
+			else if (line == "COMPACT_VERTS")
+			{
+				info.vertex_layout = AssetPacker::VERTEX_LAYOUT_COMPACT;
+			}
 			else if (line == "BLEND_ADD")
 			{
 				info.color_blend_attachment_state.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
@@ -216,14 +226,15 @@ bool MaterialSystem::read_pipelines(std::string filename, BaseEngine *engine, st
 		{
 			for (uint32_t j = 0; j < shader.uniform_buffer_count; j++)
 			{
-				auto binding = infos::descriptor_set_layout_binding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, shader.type, i);
+				// Buffers hold per frame data, picked out by dynamic offset
+				auto binding = infos::descriptor_set_layout_binding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, shader.type, i);
 				bindings.push_back(binding);
 				i++;
 			}
 
 			for (uint32_t j = 0; j < shader.storage_buffer_count; j++)
 			{
-				auto binding = infos::descriptor_set_layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, shader.type, i);
+				auto binding = infos::descriptor_set_layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, shader.type, i);
 				bindings.push_back(binding);
 				i++;
 			}
@@ -299,12 +310,23 @@ bool MaterialSystem::read_materials(std::string filename, BaseEngine *engine)
 					continue;
 				}
 
+				size_t colon = line.find(':');
 				d_info.descriptor_names.push_back(line);
+				d_info.descriptor_ids.push_back(NameId(colon == std::string::npos ? line : line.substr(colon + 1)));
+				if (line.compare(0, 3, "UB:") == 0 || line.compare(0, 3, "SB:") == 0)
+				{
+					d_info.dynamic_ids.push_back(d_info.descriptor_ids.back());
+				}
 			}
 
 			mat.descriptors.push_back(d_info);
 		}
 
+		if (_material_ids.count(name) != 0)
+		{
+			std::cout << "Material " << name << " is defined twice or collides with another name\n";
+		}
+
 		_material_ids[name] = _materials.size();
 		_materials.push_back(mat);
 	}
@@ -32,6 +32,7 @@ struct PipelineInfo
 	uint32_t render_pass_index;
 	uint32_t framebuffer_count = 1;
 	uint32_t flags = 0;
+	AssetPacker::VertexLayout vertex_layout = AssetPacker::VERTEX_LAYOUT_FULL;
 };
 
 class MaterialSystem
@@ -40,13 +41,13 @@ public:
 	void init(std::string filename, BaseEngine *engine, std::vector<VkRenderPass> render_passes);
 	void destroy(BaseEngine *engine);
 	const Material &get_material(size_t mat_id);
-	std::vector<DescriptorInfo> get_descriptor_infos(size_t mat_id);
-	size_t get_material_id(std::string name);
+	const std::vector<DescriptorInfo> &get_descriptor_infos(size_t mat_id);
+	size_t get_material_id(NameId name);
 
 	bool read_pipelines(std::string filename, BaseEngine *engine, std::vector<VkRenderPass> render_passes);
 	bool read_materials(std::string filename, BaseEngine *engine);
 
 	std::unordered_map<std::string, Pipeline> _pipelines;
-	std::unordered_map<std::string, size_t> _material_ids;
+	std::unordered_map<NameId, size_t, NameIdHash> _material_ids;
 	std::vector<Material> _materials;
 };
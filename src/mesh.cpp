@@ -8,7 +8,7 @@
 
 #include "asset_packer/asset_packer.h"
 
-VertexInputDescription Vertex::get_vertex_description()
+VertexInputDescription Vertex::get_vertex_description(AssetPacker::VertexLayout layout)
 {
 	VertexInputDescription description;
 
@@ -17,8 +17,6 @@ VertexInputDescription Vertex::get_vertex_description()
 	main_binding.stride = sizeof(Vertex);
 	main_binding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
 
-	description.bindings.push_back(main_binding);
-
 	VkVertexInputAttributeDescription position_attribute = {};
 	position_attribute.binding = 0;
 	position_attribute.location = 0;
@@ -37,12 +35,28 @@ VertexInputDescription Vertex::get_vertex_description()
 	tangent_attribute.format = VK_FORMAT_R32G32B32_SFLOAT;
 	tangent_attribute.offset = offsetof(Vertex, tangent);
 
-	VkVertexInputAttributeDescription uv_attribute;
+	VkVertexInputAttributeDescription uv_attribute = {};
 	uv_attribute.binding = 0;
 	uv_attribute.location = 3;
 	uv_attribute.format = VK_FORMAT_R32G32_SFLOAT;
 	uv_attribute.offset = offsetof(Vertex, uv);
 
+	// Same locations, the input assembler expands the packed formats to float
+	if (layout == AssetPacker::VERTEX_LAYOUT_COMPACT)
+	{
+		main_binding.stride = sizeof(AssetPacker::CompactVertex);
+		position_attribute.format = VK_FORMAT_R16G16B16A16_SFLOAT;
+		position_attribute.offset = offsetof(AssetPacker::CompactVertex, position);
+		normal_attribute.format = VK_FORMAT_R8G8B8A8_SNORM;
+		normal_attribute.offset = offsetof(AssetPacker::CompactVertex, normal);
+		tangent_attribute.format = VK_FORMAT_R8G8B8A8_SNORM;
+		tangent_attribute.offset = offsetof(AssetPacker::CompactVertex, tangent);
+		uv_attribute.format = VK_FORMAT_R16G16_SFLOAT;
+		uv_attribute.offset = offsetof(AssetPacker::CompactVertex, uv);
+	}
+
+	description.bindings.push_back(main_binding);
+
 	description.attributes.push_back(position_attribute);
 	description.attributes.push_back(normal_attribute);
 	description.attributes.push_back(tangent_attribute);
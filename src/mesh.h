@@ -1,9 +1,11 @@
 #pragma once
 
 #include "resource.h"
+#include "buffer_arena.h"
 #include <vector>
 #include <glm/glm.hpp>
 #include "inc.h"
+#include "asset_packer/asset_file.h"
 
 struct VertexInputDescription
 {
@@ -20,7 +22,7 @@ struct Vertex
 	glm::vec3 tangent;
 	glm::vec2 uv;
 
-	static VertexInputDescription get_vertex_description();
+	static VertexInputDescription get_vertex_description(AssetPacker::VertexLayout layout = AssetPacker::VERTEX_LAYOUT_FULL);
 
 	bool operator==(const Vertex &other) const
 	{
@@ -30,8 +32,26 @@ struct Vertex
 
 struct Mesh
 {
-	std::vector<Vertex> _vertices;
-	std::vector<uint32_t> _indices;
-	Buffer _vertex_buffer;
-	Buffer _index_buffer;
+	// Raw vertex data, Vertex or CompactVertex depending on _vertex_layout
+	std::vector<char> _vertices;
+	AssetPacker::VertexLayout _vertex_layout = AssetPacker::VERTEX_LAYOUT_FULL;
+	// Raw index data of every level of detail, of _index_type
+	std::vector<char> _indices;
+	// Indices of the full detail level, which starts the buffer
+	uint32_t _index_count = 0;
+	VkIndexType _index_type = VK_INDEX_TYPE_UINT32;
+	// Culling clusters, empty unless the mesh was packed with MESHLETS
+	std::vector<AssetPacker::Meshlet> _meshlets;
+	// Levels of detail, finest first. Always holds at least level 0.
+	std::vector<AssetPacker::MeshLod> _lods;
+	// Box and sphere around the whole mesh, in model space. Each level of
+	// detail and meshlet has its own as well.
+	AssetPacker::Bounds _bounds = {};
+	// What upload_mesh took of the engine's shared vertex and index buffers
+	BufferRange _vertex_range;
+	BufferRange _index_range;
+	// The same offsets in vertices and indices, added to the vertexOffset
+	// and firstIndex of every draw of the mesh
+	int32_t _vertex_offset = 0;
+	uint32_t _first_index = 0;
 };
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+// 64 bit FNV-1a
+constexpr uint64_t hash_name(const char *name, size_t length)
+{
+	uint64_t hash = 0xcbf29ce484222325ull;
+	for (size_t i = 0; i < length; i++)
+	{
+		hash ^= (uint8_t)name[i];
+		hash *= 0x100000001b3ull;
+	}
+	return hash;
+}
+
+// Hashed name of an asset, material or descriptor. "name"_id hashes at
+// compile time, names read from files are hashed once when they are read.
+struct NameId
+{
+	uint64_t hash = 0;
+
+	constexpr NameId() = default;
+	constexpr explicit NameId(uint64_t h) : hash(h) {}
+	NameId(const std::string &name) : hash(hash_name(name.data(), name.size())) {}
+
+	constexpr bool operator==(NameId other) const { return hash == other.hash; }
+	constexpr bool operator!=(NameId other) const { return hash != other.hash; }
+};
+
+constexpr NameId operator""_id(const char *name, size_t length)
+{
+	return NameId(hash_name(name, length));
+}
+
+// The hash is already well mixed, maps use it as is
+struct NameIdHash
+{
+	size_t operator()(NameId id) const { return (size_t)id.hash; }
+};
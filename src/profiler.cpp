@@ -0,0 +1,247 @@
+#include "profiler.h"
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <cstdio>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Past this many spans the rest are dropped
+const size_t MAX_PROFILE_SPANS = 1 << 20;
+
+struct ProfileSpan
+{
+	const char *category;
+	std::string name;
+	uint32_t thread;
+	// Microseconds since start
+	double begin;
+	double duration;
+};
+
+static std::atomic<bool> active{false};
+static std::mutex mutex;
+static std::chrono::steady_clock::time_point start_time;
+static std::chrono::steady_clock::time_point stop_time;
+static std::vector<ProfileSpan> spans;
+// Small numbers for the trace, the thread that called start is 0
+static std::map<std::thread::id, uint32_t> threads;
+
+static const char *ASSET_CATEGORIES[] = {"io", "decode", "staging", "upload", "upload_wait"};
+
+static uint32_t thread_index()
+{
+	auto it = threads.find(std::this_thread::get_id());
+	if (it != threads.end())
+	{
+		return it->second;
+	}
+
+	uint32_t index = threads.size();
+	threads[std::this_thread::get_id()] = index;
+	return index;
+}
+
+static double microseconds(std::chrono::steady_clock::duration d)
+{
+	return std::chrono::duration<double, std::micro>(d).count();
+}
+
+static std::string json_string(const std::string &s)
+{
+	std::string out = "\"";
+	for (char c : s)
+	{
+		if (c == '"' || c == '\\')
+		{
+			out += '\\';
+			out += c;
+		}
+		else if ((unsigned char)c < 0x20)
+		{
+			char escaped[8];
+			snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+			out += escaped;
+		}
+		else
+		{
+			out += c;
+		}
+	}
+	return out + "\"";
+}
+
+static std::string csv_string(const std::string &s)
+{
+	if (s.find_first_of(",\"\n") == std::string::npos)
+	{
+		return s;
+	}
+
+	std::string out = "\"";
+	for (char c : s)
+	{
+		out += c;
+		if (c == '"')
+		{
+			out += '"';
+		}
+	}
+	return out + "\"";
+}
+
+void profiler::start()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	spans.clear();
+	threads.clear();
+	thread_index();
+	start_time = std::chrono::steady_clock::now();
+	active = true;
+}
+
+void profiler::stop()
+{
+	if (active.exchange(false))
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stop_time = std::chrono::steady_clock::now();
+	}
+}
+
+bool profiler::recording()
+{
+	return active;
+}
+
+void profiler::record(const char *category, const std::string &name, std::chrono::steady_clock::time_point begin, std::chrono::steady_clock::time_point end)
+{
+	if (!active)
+	{
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	if (spans.size() >= MAX_PROFILE_SPANS)
+	{
+		return;
+	}
+
+	spans.push_back({category, name, thread_index(), microseconds(begin - start_time), microseconds(end - begin)});
+}
+
+void profiler::write_reports(const std::string &prefix)
+{
+	stop();
+
+	std::lock_guard<std::mutex> lock(mutex);
+	if (spans.empty())
+	{
+		return;
+	}
+
+	// Summary. Times are summed, so nested spans count towards both and
+	// spans on different threads may add up to more than the total.
+	struct Total
+	{
+		uint32_t count = 0;
+		double duration = 0.0;
+	};
+
+	std::map<std::pair<std::string, std::string>, Total> phases;
+	std::map<std::string, std::map<std::string, double>> assets;
+
+	for (auto &span : spans)
+	{
+		bool asset = std::any_of(std::begin(ASSET_CATEGORIES), std::end(ASSET_CATEGORIES), [&](const char *c) {
+			return strcmp(c, span.category) == 0;
+		});
+
+		if (asset)
+		{
+			assets[span.name][span.category] += span.duration;
+		}
+		else
+		{
+			Total &total = phases[{span.category, span.name}];
+			total.count++;
+			total.duration += span.duration;
+		}
+	}
+
+	std::ofstream json(prefix + ".json");
+	json << std::fixed << std::setprecision(3);
+	json << "{\n\t\"total_ms\": " << microseconds(stop_time - start_time) / 1000.0 << ",\n\t\"phases\": [";
+	bool first = true;
+	for (auto &phase : phases)
+	{
+		json << (first ? "\n" : ",\n") << "\t\t{\"category\": " << json_string(phase.first.first) << ", \"name\": " << json_string(phase.first.second) << ", \"count\": " << phase.second.count << ", \"ms\": " << phase.second.duration / 1000.0 << "}";
+		first = false;
+	}
+	json << "\n\t],\n\t\"assets\": [";
+	first = true;
+	for (auto &asset : assets)
+	{
+		json << (first ? "\n" : ",\n") << "\t\t{\"name\": " << json_string(asset.first);
+		for (const char *category : ASSET_CATEGORIES)
+		{
+			json << ", \"" << category << "_ms\": " << asset.second[category] / 1000.0;
+		}
+		json << "}";
+		first = false;
+	}
+	json << "\n\t]\n}\n";
+	json.close();
+
+	// Every span
+	std::ofstream csv(prefix + ".csv");
+	csv << std::fixed << std::setprecision(3);
+	csv << "category,name,thread,start_ms,duration_ms\n";
+	for (auto &span : spans)
+	{
+		csv << span.category << "," << csv_string(span.name) << "," << span.thread << "," << span.begin / 1000.0 << "," << span.duration / 1000.0 << "\n";
+	}
+	csv.close();
+
+	// Chrome trace event format, complete events in microseconds
+	std::ofstream trace(prefix + ".trace.json");
+	trace << std::fixed << std::setprecision(3);
+	trace << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+	for (auto &thread : threads)
+	{
+		trace << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << thread.second << ", \"args\": {\"name\": \"" << (thread.second == 0 ? "main" : "worker " + std::to_string(thread.second)) << "\"}},\n";
+	}
+	for (size_t i = 0; i < spans.size(); i++)
+	{
+		const ProfileSpan &span = spans[i];
+		trace << "{\"name\": " << json_string(span.name) << ", \"cat\": \"" << span.category << "\", \"ph\": \"X\", \"ts\": " << span.begin << ", \"dur\": " << span.duration << ", \"pid\": 1, \"tid\": " << span.thread << "}" << (i + 1 < spans.size() ? ",\n" : "\n");
+	}
+	trace << "]}\n";
+	trace.close();
+
+	std::cout << "Wrote startup profile to " << prefix << ".json, " << prefix << ".csv and " << prefix << ".trace.json\n";
+}
+
+ProfileScope::ProfileScope(const char *category, const std::string &name)
+	: active(profiler::recording()), category(category)
+{
+	if (active)
+	{
+		this->name = name;
+		begin = std::chrono::steady_clock::now();
+	}
+}
+
+ProfileScope::~ProfileScope()
+{
+	if (active)
+	{
+		profiler::record(category, name, begin, std::chrono::steady_clock::now());
+	}
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <string>
+#include <chrono>
+
+// Times spans of startup work on any thread. At exit write_reports saves a
+// summary, every span as CSV and a trace for chrome://tracing or Perfetto.
+// Spans are only kept between start and stop.
+namespace profiler
+{
+	void start();
+	void stop();
+	bool recording();
+
+	// category groups spans in the summary. Spans of the io, decode,
+	// staging, upload and upload_wait categories are named after their
+	// asset and summed per asset, the rest are summed per name.
+	void record(const char *category, const std::string &name, std::chrono::steady_clock::time_point begin, std::chrono::steady_clock::time_point end);
+
+	// Writes prefix.json, prefix.csv and prefix.trace.json. Does nothing if
+	// nothing was recorded.
+	void write_reports(const std::string &prefix);
+}
+
+// Records the span from construction to destruction
+struct ProfileScope
+{
+	ProfileScope(const char *category, const std::string &name);
+	~ProfileScope();
+
+	bool active;
+	const char *category;
+	std::string name;
+	std::chrono::steady_clock::time_point begin;
+};
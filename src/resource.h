@@ -20,3 +20,12 @@ struct Buffer
 	VmaAllocation _allocation;
 	VkDescriptorBufferInfo _buffer_info;
 };
+
+// Host memory that stays mapped while it lives, so data can be decoded
+// straight into it on any thread. The upload copying from it takes it over.
+struct StagingBuffer
+{
+	Buffer buffer = {};
+	char *data = nullptr;
+	VkDeviceSize size = 0;
+};
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <algorithm>
+
+// Fixed size pool of worker threads pulling jobs from a shared queue.
+// submit returns a future for each job's result.
+class ThreadPool
+{
+public:
+	ThreadPool(uint32_t thread_count = 0)
+	{
+		if (thread_count == 0)
+		{
+			thread_count = std::max(1u, std::thread::hardware_concurrency());
+		}
+
+		for (uint32_t i = 0; i < thread_count; i++)
+		{
+			_workers.emplace_back([this]() { worker_loop(); });
+		}
+	}
+
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_stopping = true;
+		}
+		_condition.notify_all();
+
+		for (auto &worker : _workers)
+		{
+			worker.join();
+		}
+	}
+
+	ThreadPool(const ThreadPool &) = delete;
+	ThreadPool &operator=(const ThreadPool &) = delete;
+
+	// Queues a function and returns a future for its result
+	template<typename F>
+	auto submit(F &&function) -> std::future<decltype(function())>
+	{
+		using R = decltype(function());
+		auto task = std::make_shared<std::packaged_task<R()>>(std::forward<F>(function));
+		std::future<R> result = task->get_future();
+
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_jobs.push_back([task]() { (*task)(); });
+		}
+		_condition.notify_one();
+
+		return result;
+	}
+
+	size_t size() const
+	{
+		return _workers.size();
+	}
+
+private:
+	void worker_loop()
+	{
+		while (true)
+		{
+			std::function<void()> job;
+
+			{
+				std::unique_lock<std::mutex> lock(_mutex);
+				_condition.wait(lock, [this]() { return _stopping || !_jobs.empty(); });
+
+				if (_jobs.empty())
+				{
+					return;
+				}
+
+				job = std::move(_jobs.front());
+				_jobs.pop_front();
+			}
+
+			job();
+		}
+	}
+
+	std::vector<std::thread> _workers;
+	std::deque<std::function<void()>> _jobs;
+	std::mutex _mutex;
+	std::condition_variable _condition;
+	bool _stopping = false;
+};